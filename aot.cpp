@@ -0,0 +1,66 @@
+#include "aot.h"
+
+vector<const AotProgram *> &AOT_PROGRAMS()
+{
+  static vector<const AotProgram *> programs;
+  return programs;
+}
+
+//the program compiled from the ROM this machine holds, if any. ROM only changes on LOAD_ROM,
+//LOAD_STATE and the boot ROM, which all come here
+void CPU_::FIND_AOT()
+{
+  aot = nullptr;
+  if(AOT_PROGRAMS().empty())
+    return;
+
+  const BYTE *pages[0x80];
+  for(int page = 0; page < 0x80; page++)
+    pages[page] = memory[page]->data;
+  uint64_t hash = AOT_ROM_HASH(pages);
+
+  for(const AotProgram *program : AOT_PROGRAMS())
+  {
+    if(program->rom_hash == hash)
+      aot = program;
+  }
+}
+
+//runs compiled code from PC for as long as it can, STEP takes over from wherever it stops
+void CPU_::RUN_COMPILED()
+{
+  //the bitmap first, a machine stuck somewhere the program doesn't cover shouldn't pay for more
+  if(PC >= 0x8000 || !(aot->compiled[PC >> 3] & (1 << (PC & 7))))
+    return;
+  uint64_t horizon = HORIZON();
+  if(horizon <= 4 || !read_pages[PC >> 8])
+    return; //ROM hidden behind a DMA
+
+  AotState state;
+  state.af = AF;
+  state.bc = BC;
+  state.de = DE;
+  state.hl = HL;
+  state.sp = SP;
+  state.pc = PC;
+  state.ime = IME;
+  state.left = min<uint64_t>(horizon, UINT32_MAX);
+  state.spent = 0;
+  state.count = 0;
+  state.read_pages = read_pages;
+  state.write_pages = write_pages;
+  state.hram = &IO(0xFF80);
+
+  aot->run(state);
+
+  AF = state.af;
+  BC = state.bc;
+  DE = state.de;
+  HL = state.hl;
+  SP = state.sp;
+  PC = state.pc;
+  IME = state.ime;
+  cycles += state.spent;
+  instructions += state.count;
+  SYNC_LCD();
+}
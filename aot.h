@@ -0,0 +1,195 @@
+#ifndef _AOT_H_
+#define _AOT_H_
+
+#include "cpu.h"
+#include "hash.h"
+
+#include <vector>
+
+/*
+ * Ahead-of-time compiled ROMs, see recompiler.cpp for the gb++-aot tool that writes them.
+ *
+ * A compiled program is one function holding the ROM's code as C++, one label per instruction
+ * it found, that runs on a copy of the registers and the machine's bus tables. RUN_FRAME hands
+ * it the machine whenever the PC is somewhere it compiled, for as many cycles as HORIZON allows,
+ * and it gives the machine back before any instruction it can't run exactly like STEP would: one
+ * that would end past the horizon, touches a trapped page or IO, or that it doesn't know. The
+ * interpreter runs that instruction, so code it never found or running from RAM stays on STEP.
+ */
+
+struct AotState {
+    RegisterPair af, bc, de, hl;
+    WORD sp, pc;
+    bool ime;
+    uint32_t left; //cycles the program may run, each instruction must end before they run out
+    uint32_t spent;
+    uint32_t count; //instructions
+    BYTE *const *read_pages; //the machine's bus, null pages are left to the interpreter
+    BYTE *const *write_pages;
+    BYTE *hram; //0xFF80, plain memory behind the IO trap
+};
+
+typedef void (*AotRun)(AotState &state);
+
+struct AotProgram {
+    uint64_t rom_hash; //AOT_ROM_HASH of the 0x8000 bytes it was compiled from
+    AotRun run;
+    const BYTE *compiled; //a bit per ROM address, set where an instruction it can run starts
+    const char *name;
+};
+
+//programs compiled into this binary, each generated file registers its own
+vector<const AotProgram *> &AOT_PROGRAMS();
+
+struct AotRegistration {
+    explicit AotRegistration(const AotProgram &program) { AOT_PROGRAMS().push_back(&program); }
+};
+
+//the two fixed banks a page at a time, so a machine hashes its ROM pages where they are
+inline uint64_t AOT_ROM_HASH(const BYTE *const pages[0x80])
+{
+  uint64_t hash = 0;
+  for(int page = 0; page < 0x80; page++)
+    hash = HASH64(pages[page], 0x100, hash);
+  return hash;
+}
+
+//the flag logic of opcode.cpp, quirks and all, on a plain F register
+namespace aot {
+
+inline void FLAG(BYTE &f, int bit, bool set)
+{
+  f = set ? f | (1 << bit) : f & ~(1 << bit);
+}
+
+inline void INC(BYTE &f, BYTE &reg)
+{
+  reg++;
+  FLAG(f, ZERO_FLAG, reg == 0);
+  FLAG(f, SUBTRACT_FLAG, false);
+  FLAG(f, HALFCARRY_FLAG, ((((reg - 1) & 0xf) + (reg & 0xf)) & 0x10) == 0x10);
+}
+
+inline void DEC(BYTE &f, BYTE &reg)
+{
+  reg--;
+  FLAG(f, ZERO_FLAG, reg == 0);
+  FLAG(f, SUBTRACT_FLAG, true);
+  FLAG(f, HALFCARRY_FLAG, 0 > (((reg + 1) & 0xf) - (reg & 0xf)));
+}
+
+inline void ADD(BYTE &f, BYTE &reg, BYTE value)
+{
+  FLAG(f, HALFCARRY_FLAG, (((value & 0xF) + (reg & 0xF)) & 0x10) == 0x10);
+  FLAG(f, CARRY_FLAG, (((value & 0xFF) + (reg & 0xFF)) & 0x100) == 0x100);
+  reg += value;
+  FLAG(f, ZERO_FLAG, reg == 0);
+  FLAG(f, SUBTRACT_FLAG, false);
+}
+
+inline void ADD(BYTE &f, WORD &reg, WORD value)
+{
+  FLAG(f, HALFCARRY_FLAG, (((value & 0xFFF) + (reg & 0xFFF)) & 0x1000) == 0x1000);
+  FLAG(f, CARRY_FLAG, (((value & 0xFFFF) + (reg & 0xFFFF)) & 0x10000) == 0x10000);
+  reg += value;
+  FLAG(f, ZERO_FLAG, reg == 0);
+  FLAG(f, SUBTRACT_FLAG, false);
+}
+
+inline void XOR(BYTE &f, BYTE &reg, BYTE value)
+{
+  reg ^= value;
+  if(reg == 0)
+    FLAG(f, ZERO_FLAG, true);
+  FLAG(f, SUBTRACT_FLAG, false);
+  FLAG(f, CARRY_FLAG, false);
+  FLAG(f, HALFCARRY_FLAG, false);
+}
+
+inline void CP(BYTE &f, BYTE a, BYTE value)
+{
+  if(a < value)
+  {
+    FLAG(f, CARRY_FLAG, true);
+    FLAG(f, ZERO_FLAG, false);
+  }
+  else if(a == value)
+  {
+    FLAG(f, ZERO_FLAG, true);
+    FLAG(f, CARRY_FLAG, false);
+  }
+  FLAG(f, SUBTRACT_FLAG, true);
+  FLAG(f, HALFCARRY_FLAG, 0 > ((a & 0xf) - (value & 0xf)));
+}
+
+inline void RLA(BYTE &f, BYTE &reg)
+{
+  bool carry = reg & 0x80;
+  reg = (reg << 1) | ((f >> CARRY_FLAG) & 1);
+  FLAG(f, CARRY_FLAG, carry);
+  FLAG(f, ZERO_FLAG, false);
+  FLAG(f, SUBTRACT_FLAG, false);
+  FLAG(f, HALFCARRY_FLAG, false);
+}
+
+inline void RL(BYTE &f, BYTE &reg)
+{
+  bool carry = reg & 0x80;
+  reg = (reg << 1) | ((f >> CARRY_FLAG) & 1);
+  FLAG(f, CARRY_FLAG, carry);
+  if(reg == 0)
+    FLAG(f, ZERO_FLAG, true);
+  FLAG(f, SUBTRACT_FLAG, false);
+  FLAG(f, HALFCARRY_FLAG, false);
+}
+
+inline void BIT(BYTE &f, int bit, BYTE reg)
+{
+  FLAG(f, ZERO_FLAG, !(reg & (1 << bit)));
+  FLAG(f, HALFCARRY_FLAG, true);
+  FLAG(f, SUBTRACT_FLAG, false);
+}
+
+}
+
+//what generated code is written in. Registers live in locals for the whole run, so the
+//compiler can keep them in host registers, and only go back to the state on the way out
+#define AOT_ENTER(state) \
+  RegisterPair AF = state.af, BC = state.bc, DE = state.de, HL = state.hl; \
+  WORD SP = state.sp; \
+  WORD PC = state.pc; \
+  bool IME = state.ime; \
+  uint32_t left = state.left; \
+  uint32_t count = 0; \
+  BYTE *const *read_pages = state.read_pages; \
+  BYTE *const *write_pages = state.write_pages; \
+  BYTE *hram = state.hram; \
+  BYTE *page = nullptr; \
+  BYTE *second = nullptr; \
+  (void) read_pages; \
+  (void) write_pages; \
+  (void) hram; \
+  (void) page; \
+  (void) second
+
+#define AOT_LEAVE(state) \
+  state.af = AF; \
+  state.bc = BC; \
+  state.de = DE; \
+  state.hl = HL; \
+  state.sp = SP; \
+  state.pc = PC; \
+  state.ime = IME; \
+  state.spent = state.left - left; \
+  state.count = count
+
+//give the machine back with the instruction at address still to run
+#define AOT_EXIT(address) do { PC = address; goto leave; } while(0)
+//the instruction at address costs cost, leave it to STEP if that would reach the horizon
+#define AOT_BUDGET(address, cost) do { if(left <= cost) AOT_EXIT(address); } while(0)
+#define AOT_TICK(cost) do { left -= cost; count++; } while(0)
+//the fast page behind an access, leaving before the instruction changes anything if it's trapped
+#define AOT_READ_PAGE(address, at) do { page = read_pages[(WORD) (at) >> 8]; if(!page) AOT_EXIT(address); } while(0)
+#define AOT_WRITE_PAGE(address, at) do { page = write_pages[(WORD) (at) >> 8]; if(!page) AOT_EXIT(address); } while(0)
+
+#endif //_AOT_H_
@@ -0,0 +1,1461 @@
+#include "cpu.h"
+#include "debugger.h"
+#include "hash.h"
+#include "lockstep.h"
+#include "movie.h"
+#include "pacer.h"
+#include "pool.h"
+#include "resampler.h"
+#include "shmexport.h"
+#include "vecenv.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/*
+ * gb++-bench [FILTER] [--json FILE] [--baseline FILE] [--threshold PERCENT] [--perf]
+ *
+ * Suites whose name contains FILTER run. MEASURE results are ns/op with the spread over
+ * BENCH_RUNS runs, --perf adds hardware counters per op when perf_event_open is allowed.
+ * --json writes the results, --baseline compares against an earlier --json file and fails
+ * when something got slower than the threshold (10% by default).
+ */
+
+#define BENCH_RUNS 10
+#define PERF_COUNTERS 3
+
+struct Measurement {
+    string name;
+    double ns_per_op;
+    double spread; //relative standard deviation between runs, percent
+    double counters[PERF_COUNTERS]; //per op, negative if unavailable
+};
+
+static vector<Measurement> measurements;
+static bool use_perf = false;
+
+static double NOW()
+{
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//instructions, branch misses and cache misses of this thread, user space only
+class PerfCounters {
+ private:
+  int fds[PERF_COUNTERS] = {-1, -1, -1};
+
+ public:
+  PerfCounters()
+  {
+#ifdef __linux__
+    const uint64_t configs[PERF_COUNTERS] = {PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES,
+                                             PERF_COUNT_HW_CACHE_MISSES};
+    for(int i = 0; i < PERF_COUNTERS; i++)
+    {
+      perf_event_attr attr = {};
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = configs[i];
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+  }
+
+  ~PerfCounters()
+  {
+#ifdef __linux__
+    for(int fd : fds)
+    {
+      if(fd >= 0)
+        close(fd);
+    }
+#endif
+  }
+
+  void START()
+  {
+#ifdef __linux__
+    for(int fd : fds)
+    {
+      if(fd >= 0)
+      {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  void STOP(double ops, double *out)
+  {
+    for(int i = 0; i < PERF_COUNTERS; i++)
+    {
+      out[i] = -1;
+#ifdef __linux__
+      uint64_t value;
+      if(fds[i] >= 0 && ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0) == 0 && read(fds[i], &value, sizeof(value)) == sizeof(value))
+        out[i] = value / ops;
+#endif
+    }
+  }
+};
+
+//run body (which does ops operations) BENCH_RUNS times after a warm up
+static void MEASURE(const string &name, double ops, const function<void()> &body)
+{
+  body();
+
+  vector<double> samples;
+  Measurement result = {name, 0, 0, {-1, -1, -1}};
+  unique_ptr<PerfCounters> perf(use_perf ? new PerfCounters() : nullptr);
+  if(perf)
+    perf->START();
+
+  for(int run = 0; run < BENCH_RUNS; run++)
+  {
+    double start = NOW();
+    body();
+    samples.push_back((NOW() - start) * 1e9 / ops);
+  }
+
+  if(perf)
+    perf->STOP(ops * BENCH_RUNS, result.counters);
+
+  for(double sample : samples)
+    result.ns_per_op += sample / samples.size();
+  double variance = 0;
+  for(double sample : samples)
+    variance += (sample - result.ns_per_op) * (sample - result.ns_per_op) / samples.size();
+  result.spread = 100 * sqrt(variance) / result.ns_per_op;
+
+  printf("%-24s %10.2f ns/op  +-%4.1f%%", name.c_str(), result.ns_per_op, result.spread);
+  if(perf)
+  {
+    if(result.counters[0] < 0)
+      printf("  (perf counters unavailable)");
+    else
+      printf("  %.1f instructions %.3f branch-misses %.3f cache-misses /op", result.counters[0], result.counters[1],
+             result.counters[2]);
+  }
+  printf("\n");
+  measurements.push_back(result);
+}
+
+//interleaved stereo test tones at the APU rate
+static vector<float> TONES(size_t frames, const vector<double> &freqs)
+{
+  vector<float> signal(frames * RESAMPLER_CHANNELS);
+  for(size_t i = 0; i < frames; i++)
+  {
+    double sample = 0;
+    for(double freq : freqs)
+      sample += sin(2 * M_PI * freq * i / APU_FREQ) / freqs.size();
+
+    signal[i * 2] = (float) sample;
+    signal[i * 2 + 1] = (float) -sample;
+  }
+  return signal;
+}
+
+//feed the signal in one emulated frame worth of samples at a time, like the core would
+static vector<float> RESAMPLE(Resampler &resampler, const vector<float> &signal)
+{
+  const size_t chunk = FULL_FRAME_FREQ / 4;
+  size_t frames = signal.size() / RESAMPLER_CHANNELS;
+  vector<float> out;
+
+  for(size_t i = 0; i < frames; i += chunk)
+  {
+    size_t n = min(chunk, frames - i);
+    size_t base = out.size();
+    out.resize(base + resampler.MAX_OUTPUT(n) * RESAMPLER_CHANNELS);
+    size_t written = resampler.PROCESS(&signal[i * RESAMPLER_CHANNELS], n, &out[base]);
+    out.resize(base + written * RESAMPLER_CHANNELS);
+  }
+  return out;
+}
+
+//straight double precision evaluation of the same filter at the exact fractional positions
+static vector<double> REFERENCE(const vector<float> &signal, int taps)
+{
+  double step = (double) APU_FREQ / OUTPUT_FREQ;
+  double cutoff = 0.455 / step;
+  double half_width = RESAMPLER_ZERO_CROSSINGS / (2 * cutoff);
+  long frames = signal.size() / RESAMPLER_CHANNELS;
+  vector<double> out;
+
+  for(double x = 0; (long) x + taps / 2 < frames; x += step)
+  {
+    long n = (long) x;
+    double frac = x - n;
+    double sum = 0, weight = 0;
+    for(int k = 0; k < taps; k++)
+    {
+      long index = n - (taps / 2 - 1) + k;
+      double h = RESAMPLER_KERNEL(k - (taps / 2 - 1) - frac, cutoff, half_width);
+      weight += h;
+      if(index >= 0)
+        sum += h * signal[index * RESAMPLER_CHANNELS];
+    }
+    out.push_back(sum / weight);
+  }
+  return out;
+}
+
+static double RMS(const vector<float> &out, size_t skip)
+{
+  double sum = 0;
+  size_t count = 0;
+  for(size_t i = skip * RESAMPLER_CHANNELS; i < out.size(); i += RESAMPLER_CHANNELS, count++)
+    sum += (double) out[i] * out[i];
+  return count ? sqrt(sum / count) : 0;
+}
+
+static bool BENCH_RESAMPLER()
+{
+  bool passed = true;
+
+  //throughput, one emulated second per pass
+  vector<float> signal = TONES(APU_FREQ, {440, 3000, 12000});
+  for(ResamplerMode mode : {RESAMPLE_SINC, RESAMPLE_LINEAR})
+  {
+    Resampler resampler;
+    resampler.SET_MODE(mode);
+    RESAMPLE(resampler, signal); //warm up
+
+    const int passes = 5;
+    double start = NOW();
+    size_t produced = 0;
+    for(int i = 0; i < passes; i++)
+      produced += RESAMPLE(resampler, signal).size() / RESAMPLER_CHANNELS;
+    double elapsed = NOW() - start;
+
+    printf("resampler/%s: %.1f M input samples/s, %.2f M output samples/s, %.1fx realtime\n",
+           mode == RESAMPLE_SINC ? "sinc" : "linear",
+           passes * (double) APU_FREQ / elapsed / 1e6, produced / elapsed / 1e6, passes / elapsed);
+  }
+
+  //quality against the double precision reference, 5000 frames (~4.7ms) is plenty
+  vector<float> short_signal = TONES(5000 * 22, {440, 3000, 12000});
+  Resampler resampler;
+  vector<float> out = RESAMPLE(resampler, short_signal);
+  vector<double> reference = REFERENCE(short_signal, resampler.TAPS());
+
+  double signal_power = 0, noise_power = 0;
+  size_t count = min(out.size() / RESAMPLER_CHANNELS, reference.size());
+  for(size_t i = resampler.TAPS(); i < count; i++)
+  {
+    double error = out[i * RESAMPLER_CHANNELS] - reference[i];
+    signal_power += reference[i] * reference[i];
+    noise_power += error * error;
+  }
+  double snr = 10 * log10(signal_power / max(noise_power, 1e-30));
+  printf("resampler/quality: %.1f dB SNR against double precision reference (%d taps)\n", snr, resampler.TAPS());
+  if(snr < 80)
+  {
+    printf("resampler/quality: FAILED, expected at least 80 dB\n");
+    passed = false;
+  }
+
+  //a tone above the output nyquist must not alias back down
+  Resampler alias_resampler;
+  vector<float> alias = RESAMPLE(alias_resampler, TONES(5000 * 22, {30000}));
+  double rejection = 20 * log10(RMS(alias, alias_resampler.TAPS()) / sqrt(0.5));
+  printf("resampler/stopband: 30kHz tone attenuated by %.1f dB\n", -rejection);
+
+  //the rate controller: 1.0 at the target, +-0.5% at the extremes and no further
+  const struct {
+    double fill;
+    double ratio;
+  } RATIOS[] = {
+      {AUDIO_TARGET_FILL, 1.0},
+      {0.0, 1.0 + RATE_ADJUST_MAX},
+      {1.0, 1.0 - RATE_ADJUST_MAX},
+      {0.25, 1.0 + RATE_ADJUST_MAX / 2},
+      {-1.0, 1.0 + RATE_ADJUST_MAX},
+      {2.0, 1.0 - RATE_ADJUST_MAX},
+  };
+  bool control = true;
+  for(const auto &check : RATIOS)
+    control &= fabs(AUDIO_RATIO(check.fill) - check.ratio) < 1e-12;
+
+  //a ring that suddenly runs dry only moves the ratio a little per update, and never past the limit
+  Pacer pacer;
+  double first = pacer.UPDATE_AUDIO(0, 64);
+  double last = first;
+  for(int i = 0; i < 200; i++)
+  {
+    double ratio = pacer.UPDATE_AUDIO(0, 64);
+    control &= ratio >= last && ratio <= 1.0 + RATE_ADJUST_MAX;
+    last = ratio;
+  }
+  control &= first > 1.0 && first < 1.0 + RATE_ADJUST_MAX / 4 && last > 1.0 + RATE_ADJUST_MAX * 0.99;
+  control &= pacer.STATS().resample_ratio == last && pacer.STATS().buffer_fill < 0.01;
+
+  //and the resampler really produces that much more
+  Resampler fast, normal;
+  fast.SET_RATIO(1.0 + RATE_ADJUST_MAX);
+  double gained = (double) RESAMPLE(fast, short_signal).size() / RESAMPLE(normal, short_signal).size() - 1.0;
+  control &= fabs(gained - RATE_ADJUST_MAX) < RATE_ADJUST_MAX * 0.1;
+
+  printf("resampler/rate-control: ratio %.5f after the ring ran dry, %.3f%% more output\n", last, gained * 100);
+  if(!control)
+  {
+    printf("resampler/rate-control: FAILED\n");
+    passed = false;
+  }
+
+  return passed;
+}
+
+//cartridge with a tight load/store loop at 0x0153 using only implemented opcodes
+static vector<BYTE> LOOP_ROM()
+{
+  vector<BYTE> rom(0x8000);
+  const BYTE entry[] = {0xC3, 0x50, 0x01}; //JP 0x0150
+  const BYTE code[] = {
+      0x21, 0x00, 0xC0, //LD HL,0xC000
+      0x7E, //LD A,(HL)
+      0x04, //INC B
+      0x77, //LD (HL),A
+      0x0D, //DEC C
+      0xEA, 0x00, 0xC1, //LD (0xC100),A
+      0xC3, 0x53, 0x01 //JP 0x0153
+  };
+  memcpy(&rom[0x100], entry, sizeof(entry));
+  memcpy(&rom[0x150], code, sizeof(code));
+  return rom;
+}
+
+static double FRAMES_PER_SECOND(CPU_ &machine, int frames)
+{
+  //best of several passes, the host is noisy and we want the loop's own cost
+  double best = 0;
+  for(int pass = 0; pass < 5; pass++)
+  {
+    double start = NOW();
+    for(int i = 0; i < frames; i++)
+      machine.RUN_FRAME();
+    best = max(best, frames / (NOW() - start));
+  }
+  return best;
+}
+
+static bool BENCH_DEBUGGER()
+{
+  vector<BYTE> rom = LOOP_ROM();
+  const int frames = 300;
+
+  auto plain = make_unique<CPU_>();
+  plain->LOAD_ROM(rom.data(), rom.size());
+  plain->INIT_POST_BOOT();
+  double base = FRAMES_PER_SECOND(*plain, frames);
+  printf("debugger/none: %.0f frames/s\n", base);
+
+  //attached but nothing armed has to run the exact same loop as no debugger at all
+  auto machine = make_unique<CPU_>();
+  machine->LOAD_ROM(rom.data(), rom.size());
+  machine->INIT_POST_BOOT();
+  Debugger debugger;
+  debugger.ATTACH(machine.get());
+  double attached = FRAMES_PER_SECOND(*machine, frames);
+  printf("debugger/attached: %.0f frames/s (%.1f%% of none)\n", attached, 100 * attached / base);
+
+  debugger.ADD_WATCHPOINT(0xD000, 0xD0FF, WATCH_READ | WATCH_WRITE);
+  double watched = FRAMES_PER_SECOND(*machine, frames);
+  printf("debugger/watchpoint: %.0f frames/s (%.1f%% of none)\n", watched, 100 * watched / base);
+
+  debugger.ADD_BREAKPOINT(0x7FFF);
+  double armed = FRAMES_PER_SECOND(*machine, frames);
+  printf("debugger/breakpoint: %.0f frames/s (%.1f%% of none)\n", armed, 100 * armed / base);
+
+  //a condition on the loop head that never holds, so it is evaluated every iteration
+  bool passed = true;
+  string error;
+  if(!debugger.ADD_BREAKPOINT("PC==0x0153 && A>0x10 && [0xC000]==3 && !ZF", error))
+  {
+    printf("debugger/condition: FAILED, %s\n", error.c_str());
+    return false;
+  }
+  double conditional = FRAMES_PER_SECOND(*machine, frames);
+  if(!machine->RUN_FRAME())
+  {
+    printf("debugger/condition: FAILED, stopped on a false condition\n");
+    passed = false;
+  }
+  printf("debugger/condition: %.0f frames/s (%.1f%% of none)\n", conditional, 100 * conditional / base);
+
+  //the evaluation on its own
+  BreakCondition condition;
+  condition.COMPILE("PC==0x0153 && A>0x10 && [0xC000]==3 && !ZF", error);
+  const int evaluations = 1000000;
+  int held = 0;
+  double start = NOW();
+  for(int i = 0; i < evaluations; i++)
+    held += condition.EVALUATE(*machine);
+  double elapsed = NOW() - start;
+  printf("debugger/condition: %.1f ns/evaluation%s\n", 1e9 * elapsed / evaluations, held ? " (held)" : "");
+
+  //and it has to stop once it does hold
+  Registers regs = machine->GET_REGISTERS();
+  debugger.CLEAR();
+  debugger.ADD_BREAKPOINT("PC==0x0153 && B==" + to_string((regs.BC >> 8) ^ 0x80), error);
+  if(machine->RUN_FRAME() || debugger.REASON() != BREAK_BREAKPOINT || machine->GET_REGISTERS().PC != 0x0153)
+  {
+    printf("debugger/condition: FAILED, didn't stop when the condition held\n");
+    passed = false;
+  }
+
+  //overflow wraps and INT_MIN / -1 doesn't trap, both folded and on the stack machine (A - A
+  //keeps the compiler from folding), and literals past int32 don't compile at all
+  const struct {
+    const char *expression;
+    bool compiles;
+  } EDGES[] = {
+      {"2147483647+1 == -2147483647-1", true},
+      {"(A-A+2147483647)+1 == -2147483647-1", true},
+      {"(-2147483647-1)/-1 == -2147483647-1", true},
+      {"(A-A-2147483647-1)/(A-A-1) == -2147483647-1", true},
+      {"(-2147483647-1)%-1 == 0 && (A-A-2147483647-1)%(A-A-1) == 0", true},
+      {"65536*65536 == 0 && (A-A+65536)*65536 == 0", true},
+      {"-(-2147483647-1) == -2147483647-1 && -(A-A-2147483647-1) == -2147483647-1", true},
+      {"5/0 == 0 && 5%(A-A) == 0", true},
+      {"2147483648/-1", false},
+      {"0x80000000", false},
+      {"99999999999999999999", false},
+      {"0x-5", false},
+  };
+  for(const auto &edge : EDGES)
+  {
+    BreakCondition check;
+    bool compiled = check.COMPILE(edge.expression, error);
+    if(compiled != edge.compiles || (compiled && !check.EVALUATE(*machine)))
+    {
+      printf("debugger/condition: FAILED, %s %s\n", edge.expression,
+             compiled != edge.compiles ? (compiled ? "compiled" : "didn't compile") : "didn't hold");
+      passed = false;
+    }
+  }
+
+  return passed;
+}
+
+//DMG and CGB instances run loops built for their model, only CGB ones allocate CGB state
+static bool BENCH_MODEL()
+{
+  vector<BYTE> rom = LOOP_ROM();
+  const int frames = 300;
+  bool passed = true;
+
+  //A after boot is how games tell the hardware apart, and it follows the header LOAD_ROM reads
+  const struct {
+    Model model;
+    BYTE cgb_flag;
+    BYTE a;
+  } BOOTS[] = {
+      {MODEL_AUTO, 0x00, 0x01},
+      {MODEL_AUTO, 0x80, 0x11},
+      {MODEL_MGB, 0x00, 0xFF},
+      {MODEL_CGB, 0x00, 0x11},
+  };
+  for(const auto &boot : BOOTS)
+  {
+    rom[CGB_FLAG_ADDRESS] = boot.cgb_flag;
+    auto machine = make_unique<CPU_>();
+    machine->SET_MODEL(boot.model);
+    machine->LOAD_ROM(rom.data(), rom.size());
+    machine->INIT_POST_BOOT();
+    if(machine->GET_REGISTERS().AF >> 8 != boot.a)
+    {
+      printf("model/boot: FAILED, A=0x%02X after boot with header 0x%02X, expected 0x%02X\n",
+             machine->GET_REGISTERS().AF >> 8, boot.cgb_flag, boot.a);
+      passed = false;
+    }
+  }
+
+  for(Model model : {MODEL_DMG, MODEL_CGB})
+  {
+    rom[CGB_FLAG_ADDRESS] = model == MODEL_CGB ? 0x80 : 0x00;
+    auto machine = make_unique<CPU_>();
+    machine->SET_MODEL(model);
+    machine->LOAD_ROM(rom.data(), rom.size());
+    machine->INIT_POST_BOOT();
+
+    printf("model/%s: %.0f frames/s, %zu bytes per instance\n", model == MODEL_CGB ? "cgb" : "dmg",
+           FRAMES_PER_SECOND(*machine, frames), machine->RESIDENT_BYTES());
+  }
+
+  //an HBlank HDMA cancelled after a block reads back 0x80 | blocks left - 1, and starting it again
+  //carries on where it stopped
+  rom[CGB_FLAG_ADDRESS] = 0x80;
+  auto colour = make_unique<CPU_>();
+  colour->LOAD_ROM(rom.data(), rom.size());
+  colour->INIT_POST_BOOT();
+  for(int i = 0; i < 0x40; i++)
+    colour->WRITE(0xC000 + i, (BYTE) (i * 37 + 5));
+  const BYTE addresses[] = {0xC0, 0x00, 0x80, 0x00};
+  for(int i = 0; i < 4; i++)
+    colour->WRITE(0xFF51 + i, addresses[i]);
+  colour->WRITE(0xFF55, 0x83); //4 blocks
+  while(colour->READ(0xFF55) == 0x03)
+    colour->STEP();
+  colour->WRITE(0xFF55, 0x00);
+  BYTE cancelled = colour->READ(0xFF55);
+  colour->WRITE(0xFF55, 0x80 | (cancelled & 0x7F));
+  while(colour->READ(0xFF55) != 0xFF)
+    colour->STEP();
+  bool copied = true;
+  for(int i = 0; i < 0x40; i++)
+    copied &= colour->PEEK(0x8000 + i) == colour->PEEK(0xC000 + i);
+  if(cancelled != 0x82 || !copied)
+  {
+    printf("model/hdma: FAILED, read 0x%02X after a cancel, %s\n", cancelled,
+           copied ? "copied" : "resuming didn't finish the copy");
+    passed = false;
+  }
+
+  //machines that insert one RomImage only pay for their own state and the RAM they write
+  rom[CGB_FLAG_ADDRESS] = 0x00;
+  RomImage image(rom.data(), rom.size());
+  vector<unique_ptr<CPU_>> machines(1000);
+  size_t resident = 0;
+  for(auto &machine : machines)
+  {
+    machine = make_unique<CPU_>();
+    machine->LOAD_ROM(image);
+    machine->INIT_POST_BOOT();
+    machine->RUN_FRAME();
+    resident += machine->RESIDENT_BYTES();
+  }
+  if(machines[0]->GET_REGISTERS().PC != machines.back()->GET_REGISTERS().PC)
+  {
+    printf("model/shared_rom: FAILED, machines on one image diverged\n");
+    return false;
+  }
+  printf("model/shared_rom: %zu bytes per running instance, %zu instances per GB\n",
+         resident / machines.size(), ((size_t) 1 << 30) / (resident / machines.size()));
+
+  return passed;
+}
+
+//a loop at 0x0153 repeating body until about 1 KB of code, HL reset to 0xC000 each time around
+static vector<BYTE> MIX_ROM(const vector<BYTE> &body)
+{
+  vector<BYTE> rom(0x8000);
+  const BYTE entry[] = {0xC3, 0x50, 0x01}; //JP 0x0150
+  memcpy(&rom[0x100], entry, sizeof(entry));
+
+  size_t at = 0x150;
+  for(BYTE byte : {0x21, 0x00, 0xC0}) //LD HL,0xC000
+    rom[at++] = byte;
+  while(at < 0x550)
+  {
+    for(BYTE byte : body)
+      rom[at++] = byte;
+  }
+  for(BYTE byte : {0xC3, 0x50, 0x01}) //JP 0x0150
+    rom[at++] = byte;
+
+  rom[0x1000] = 0xC9; //RET, for CALL in the mixes
+  return rom;
+}
+
+static unique_ptr<CPU_> MACHINE(const vector<BYTE> &rom)
+{
+  auto machine = make_unique<CPU_>();
+  machine->LOAD_ROM(rom.data(), rom.size());
+  machine->INIT_POST_BOOT();
+  return machine;
+}
+
+//interpreter dispatch over instruction mixes, ns per instruction with the LCD off
+static bool BENCH_CPU()
+{
+  const struct {
+    const char *name;
+    vector<BYTE> body;
+  } MIXES[] = {
+      {"alu", {0x04, 0x0D, 0x80, 0x3C, 0xAF, 0x81, 0xFE, 0x10, 0x05, 0x0C}}, //INC/DEC/ADD/XOR/CP
+      {"load", {0x78, 0x41, 0x7E, 0x77, 0x2A, 0x22, 0xEA, 0x00, 0xC1, 0xF0, 0x80, 0xE0, 0x81}}, //LD r,r/(HL)/(nn)/LDH
+      {"branch", {0xCD, 0x00, 0x10, 0xC5, 0xC1, 0xD5, 0xE1}} //CALL/RET/PUSH/POP
+  };
+  const int steps = 100000;
+
+  for(const auto &mix : MIXES)
+  {
+    auto machine = MACHINE(MIX_ROM(mix.body));
+    machine->WRITE(0xFF40, 0x00);
+    MEASURE(string("cpu/") + mix.name, steps, [&]() {
+      for(int i = 0; i < steps; i++)
+        machine->STEP();
+    });
+  }
+  return true;
+}
+
+//the bus fast path (WRAM) and the trapped IO page (HRAM)
+static bool BENCH_BUS()
+{
+  auto machine = MACHINE(LOOP_ROM());
+  const int accesses = 1 << 20;
+  volatile BYTE sink = 0;
+
+  for(WORD base : {0xC000, 0xFF80})
+  {
+    const char *region = base == 0xC000 ? "wram" : "hram";
+    WORD mask = base == 0xC000 ? 0x1FFF : 0x007F;
+
+    MEASURE(string("bus/read/") + region, accesses, [&]() {
+      BYTE sum = 0;
+      for(int i = 0; i < accesses; i++)
+        sum += machine->READ(base + (i & mask));
+      sink = sum;
+    });
+    MEASURE(string("bus/write/") + region, accesses, [&]() {
+      for(int i = 0; i < accesses; i++)
+        machine->WRITE(base + (i & mask), (BYTE) i);
+    });
+  }
+  (void) sink;
+  return true;
+}
+
+static bool BENCH_PPU()
+{
+  //2bpp decode of every pixel of a tile
+  BYTE tile[16];
+  for(int i = 0; i < 16; i++)
+    tile[i] = (BYTE) (i * 37 + 11);
+  auto machine = MACHINE(LOOP_ROM());
+  const int tiles = 100000;
+  volatile int sink = 0;
+
+  MEASURE("ppu/tile_decode", tiles * 64.0, [&]() {
+    int sum = 0;
+    for(int n = 0; n < tiles; n++)
+    {
+      for(int row = 0; row < 8; row++)
+      {
+        for(int column = 0; column < 8; column++)
+          sum += machine->TILE_PIXEL(tile, row, column);
+      }
+    }
+    sink = sum;
+  });
+  (void) sink;
+
+  //BG and 10 sprites on line 0. No window, its line counter would run off the map rendering
+  //the same line over and over
+  machine->WRITE(0xFF40, 0x93);
+  for(int i = 0; i < 0x1800; i++)
+    machine->WRITE(0x8000 + i, (BYTE) (i * 13));
+  for(int i = 0; i < 10; i++)
+  {
+    machine->WRITE(0xFE00 + i * 4, 16);
+    machine->WRITE(0xFE01 + i * 4, 8 + i * 15);
+    machine->WRITE(0xFE02 + i * 4, i);
+    machine->WRITE(0xFE03 + i * 4, (i & 1) ? 0x20 : 0x80);
+  }
+
+  const int lines = 20000;
+  MEASURE("ppu/scanline", lines, [&]() {
+    for(int i = 0; i < lines; i++)
+      machine->RENDER_SCANLINE();
+  });
+  return true;
+}
+
+static bool BENCH_STATE()
+{
+  auto machine = MACHINE(LOOP_ROM());
+  for(int i = 0; i < 10; i++)
+    machine->RUN_FRAME();
+
+  vector<BYTE> state;
+  vector<BYTE> again;
+  const int round_trips = 1000;
+  MEASURE("state/round_trip", round_trips, [&]() {
+    for(int i = 0; i < round_trips; i++)
+    {
+      machine->SAVE_STATE(state);
+      machine->LOAD_STATE(state);
+    }
+  });
+
+  //a loaded state has to run exactly like the one it was saved from
+  machine->SAVE_STATE(state);
+  machine->RUN_FRAME();
+  machine->SAVE_STATE(again);
+  auto copy = make_unique<CPU_>();
+  if(!copy->LOAD_STATE(state))
+  {
+    printf("state/round_trip: FAILED, state didn't load\n");
+    return false;
+  }
+  copy->RUN_FRAME();
+  copy->SAVE_STATE(state);
+  if(state != again)
+  {
+    printf("state/round_trip: FAILED, a loaded state diverged\n");
+    return false;
+  }
+  printf("state/size: %zu bytes\n", state.size());
+
+  //a fork shares memory pages, it only pays for the machine itself up front
+  const int forks = 1000;
+  MEASURE("state/fork", forks, [&]() {
+    for(int i = 0; i < forks; i++)
+      machine->FORK();
+  });
+  printf("state/fork_size: %zu bytes plus pages written\n", machine->FORK()->RESIDENT_BYTES());
+
+  //both sides of a fork have to run on as if the other wasn't there
+  machine->SAVE_STATE(state);
+  auto child = machine->FORK();
+  child->WRITE(0xC123, 0x5A);
+  child->WRITE(0xE124, 0xA5); //echo
+  if(machine->READ(0xC123) == 0x5A || machine->READ(0xC124) == 0xA5 || child->READ(0xC124) != 0xA5)
+  {
+    printf("state/fork: FAILED, a write leaked between forks\n");
+    return false;
+  }
+  child->LOAD_STATE(state);
+  child->RUN_FRAME();
+  machine->RUN_FRAME();
+  child->SAVE_STATE(state);
+  machine->SAVE_STATE(again);
+  if(state != again)
+  {
+    printf("state/fork: FAILED, a fork diverged from its parent\n");
+    return false;
+  }
+  return true;
+}
+
+//STATE_HASH against hashing a save state, and whether it tells states apart
+static bool BENCH_HASH()
+{
+  bool passed = true;
+
+  for(bool colour : {false, true})
+  {
+    vector<BYTE> rom = LOOP_ROM();
+    rom[CGB_FLAG_ADDRESS] = colour ? 0x80 : 0x00;
+    auto machine = MACHINE(rom);
+    const char *model = colour ? "cgb" : "dmg";
+
+    //a frame dirties a handful of pages, like most games
+    const int hashes = 1000;
+    MEASURE(string("hash/incremental/") + model, hashes, [&]() {
+      for(int i = 0; i < hashes; i++)
+      {
+        for(WORD address : {0xC000, 0xC500, 0xD200, 0x9800})
+          machine->WRITE(address + (i & 0xFF), (BYTE) i);
+        machine->STATE_HASH();
+      }
+    });
+
+    vector<BYTE> state;
+    volatile uint64_t sink = 0;
+    MEASURE(string("hash/full/") + model, hashes, [&]() {
+      for(int i = 0; i < hashes; i++)
+      {
+        machine->SAVE_STATE(state);
+        sink = HASH64(state.data(), state.size());
+      }
+    });
+    (void) sink;
+
+    //kept up to date across frames and bank switches it has to match hashing from scratch
+    for(int frame = 0; frame < 20; frame++)
+    {
+      machine->RUN_FRAME();
+      machine->WRITE(0xFF70, frame & 0x07);
+      machine->WRITE(0xFF4F, frame & 0x01);
+      machine->WRITE(0xD000 + frame, frame);
+      machine->WRITE(0x8000 + frame, frame);
+      if(frame % 3 == 0)
+        machine->STATE_HASH();
+    }
+    machine->SAVE_STATE(state);
+    auto fresh = make_unique<CPU_>();
+    fresh->LOAD_STATE(state);
+    auto fork = machine->FORK();
+    uint64_t expected = fresh->STATE_HASH();
+    if(machine->STATE_HASH() != expected || fork->STATE_HASH() != expected)
+    {
+      printf("hash/%s: FAILED, the incremental hash drifted from a full one\n", model);
+      passed = false;
+    }
+
+    //every single byte change in WRAM gets its own hash, and undoing it gets the old one back
+    uint64_t base = machine->STATE_HASH();
+    unordered_set<uint64_t> seen = {base};
+    size_t variants = 0;
+    bool collided = false;
+    for(int address = 0xC000; address < 0xE000; address++)
+    {
+      BYTE original = machine->PEEK(address);
+      for(int bit = 0; bit < 8; bit++, variants++)
+      {
+        machine->WRITE(address, original ^ (1 << bit));
+        collided |= !seen.insert(machine->STATE_HASH()).second;
+      }
+      machine->WRITE(address, original);
+    }
+    if(collided || machine->STATE_HASH() != base)
+    {
+      printf("hash/%s: FAILED, %s\n", model, collided ? "collision" : "undoing a write changed the hash");
+      passed = false;
+    }
+    else
+      printf("hash/%s: %zu single bit variants, no collisions\n", model, variants);
+  }
+  return passed;
+}
+
+//what --shm adds to every frame
+static bool BENCH_SHM()
+{
+  auto machine = MACHINE(LOOP_ROM());
+  SharedExport shared;
+  string name = "gbpp-bench-" + to_string(getpid());
+  if(!shared.START(name))
+  {
+    printf("shm: skipped, could not create %s\n", name.c_str());
+    return true;
+  }
+
+  const int publishes = 1000;
+  MEASURE("shm/publish", publishes, [&]() {
+    for(int i = 0; i < publishes; i++)
+      shared.PUBLISH(*machine);
+  });
+  return true;
+}
+
+//a mix of cheap (LCD off) and expensive (sprites, timer) machines on every core. Per worker
+//throughput and frame latency. Every batch has to run exactly one frame per machine
+static bool BENCH_POOL()
+{
+  MachinePool pool(0, true);
+  const int per_worker = 16;
+  int workers = pool.STATS().size();
+
+  pool.SPAWN(workers * per_worker, [](int index) {
+    auto machine = MACHINE(index % 4 ? LOOP_ROM() : MIX_ROM({0xCD, 0x00, 0x10, 0xC5, 0xC1, 0xD5, 0xE1}));
+    if(index % 4 == 1 || index % 4 == 2)
+      machine->WRITE(0xFF40, 0x00);
+    else
+      machine->WRITE(0xFF07, 0x05);
+    return machine;
+  });
+
+  const int batches = 5;
+  MEASURE("pool/frame", (double) pool.SIZE() * batches, [&]() {
+    for(int i = 0; i < batches; i++)
+      pool.STEP_ALL();
+  });
+
+  vector<PoolWorkerStats> stats = pool.STATS();
+  uint64_t frames = 0;
+  for(const PoolWorkerStats &worker : stats)
+    frames += worker.frames;
+  if(frames != (uint64_t) pool.SIZE() * batches * (BENCH_RUNS + 1))
+  {
+    printf("pool: FAILED, %llu frames run for %d machines\n", (unsigned long long) frames, pool.SIZE());
+    return false;
+  }
+
+  for(size_t i = 0; i < stats.size(); i++)
+  {
+    printf("pool/worker%zu: cpu %d, %llu frames (%llu stolen), %.0f frames/s busy, p50 %.0f us p99 %.0f us max %.0f us\n",
+           i, stats[i].cpu, (unsigned long long) stats[i].frames, (unsigned long long) stats[i].stolen,
+           stats[i].frames_per_second, stats[i].p50_us, stats[i].p99_us, stats[i].max_us);
+  }
+  return true;
+}
+
+//a loop made only of instructions lanes can run, copying 0xC000 up into 0xC800 with a sum
+static vector<BYTE> LANE_ROM()
+{
+  vector<BYTE> rom(0x8000);
+  const BYTE entry[] = {0xC3, 0x50, 0x01}; //JP 0x0150
+  const BYTE code[] = {
+      0x21, 0x00, 0xC0, //LD HL,0xC000
+      0x01, 0x00, 0xC8, //LD BC,0xC800
+      0x16, 0x00, //LD D,0
+      0x2A, //LD A,(HL+)
+      0x80, //ADD A,B
+      0x02, //LD (BC),A
+      0x03, //INC BC
+      0x14, //INC D
+      0x1D, //DEC E
+      0x7A, //LD A,D
+      0xFE, 0x40, //CP 0x40
+      0x20, 0xF4, //JR NZ,-12
+      0xC3, 0x50, 0x01 //JP 0x0150
+  };
+  memcpy(&rom[0x100], entry, sizeof(entry));
+  memcpy(&rom[0x150], code, sizeof(code));
+  return rom;
+}
+
+//what WRITE_COVERAGE would write, empty without ENABLE_COVERAGE
+static vector<BYTE> COVERAGE_OF(CPU_ &machine)
+{
+  const string path = (filesystem::temp_directory_path() / "gb++-bench.gbcov").string();
+  vector<BYTE> bits;
+  if(machine.WRITE_COVERAGE(path))
+  {
+    ifstream file(path, ios::binary);
+    bits.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    filesystem::remove(path);
+  }
+  return bits;
+}
+
+//the same machines twice over, one set run on its own and one in lanes, must end up identical
+static bool LOCKSTEP_MATCHES(const char *name, const function<unique_ptr<CPU_>(int index)> &make, int count,
+                             int frames, bool report)
+{
+  vector<unique_ptr<CPU_>> scalar;
+  vector<unique_ptr<CPU_>> lanes;
+  vector<CPU_ *> pointers;
+  for(int i = 0; i < count; i++)
+  {
+    scalar.push_back(make(i));
+    lanes.push_back(make(i));
+    pointers.push_back(lanes.back().get());
+  }
+  Lockstep lockstep(pointers);
+
+  uint64_t before = 0;
+  for(auto &machine : scalar)
+    before += machine->INSTRUCTION_COUNT();
+
+  double start = NOW();
+  for(int frame = 0; frame < frames; frame++)
+  {
+    for(auto &machine : scalar)
+      machine->RUN_FRAME();
+  }
+  double scalar_seconds = NOW() - start;
+
+  start = NOW();
+  for(int frame = 0; frame < frames; frame++)
+    lockstep.RUN_FRAME();
+  double lane_seconds = NOW() - start;
+
+  uint64_t instructions = 0;
+  vector<BYTE> expected;
+  vector<BYTE> actual;
+  for(int i = 0; i < count; i++)
+  {
+    instructions += scalar[i]->INSTRUCTION_COUNT();
+    scalar[i]->SAVE_STATE(expected);
+    lanes[i]->SAVE_STATE(actual);
+    if(expected != actual)
+    {
+      printf("lockstep/%s: FAILED, machine %d diverged from running on its own\n", name, i);
+      return false;
+    }
+    if(COVERAGE_OF(*scalar[i]) != COVERAGE_OF(*lanes[i]))
+    {
+      printf("lockstep/%s: FAILED, machine %d covered different code than on its own\n", name, i);
+      return false;
+    }
+  }
+  instructions -= before;
+
+  if(report)
+  {
+    LockstepStats stats = lockstep.STATS();
+    uint64_t total = stats.vector_instructions + stats.scalar_instructions;
+    printf("lockstep/%s: %.1fM instructions/s in lanes vs %.1fM on their own (%.2fx), %.0f%% in lanes, "
+           "%.1f lanes per dispatch\n", name, instructions / lane_seconds / 1e6, instructions / scalar_seconds / 1e6,
+           scalar_seconds / lane_seconds, 100.0 * stats.vector_instructions / total,
+           stats.dispatches ? (double) stats.vector_instructions / stats.dispatches : 0.0);
+  }
+  return true;
+}
+
+//the experimental lockstep interpreter against the same machines each running their own frames
+static bool BENCH_LOCKSTEP()
+{
+  const int machines = 32;
+  const int frames = 20;
+  vector<BYTE> lane_rom = LANE_ROM();
+  vector<BYTE> call_rom = MIX_ROM({0xCD, 0x00, 0x10, 0xC5, 0xC1, 0xD5, 0xE1});
+
+  //one program from different data, the case lanes are for
+  auto same = [&](int index) {
+    auto machine = MACHINE(lane_rom);
+    for(int i = 0; i < 0x100; i++)
+      machine->WRITE(0xC000 + i, (BYTE) (i * 31 + index * 7));
+    return machine;
+  };
+  bool passed = LOCKSTEP_MATCHES("same", same, machines, frames, true);
+
+  //half of them on CALL/PUSH/POP, which always run on STEP
+  auto mixed = [&](int index) {
+    return index % 2 ? same(index) : MACHINE(call_rom);
+  };
+  passed &= LOCKSTEP_MATCHES("mixed", mixed, machines, frames, true);
+
+  //a lane marks nothing, so machines recording coverage have to stay on STEP
+  auto covered = [&](int index) {
+    auto machine = same(index);
+    machine->ENABLE_COVERAGE();
+    return machine;
+  };
+  passed &= LOCKSTEP_MATCHES("coverage", covered, 8, 4, false);
+
+  //random code reaches IO, the LCD switching and every kind of hand back
+  auto random = [](int index) {
+    vector<BYTE> rom(0x8000);
+    uint32_t seed = 0x9E3779B9u * (index + 1);
+    for(BYTE &byte : rom)
+    {
+      seed = seed * 1664525 + 1013904223;
+      byte = seed >> 24;
+    }
+    rom[CGB_FLAG_ADDRESS] = 0x00;
+    return MACHINE(rom);
+  };
+  passed &= LOCKSTEP_MATCHES("random", random, 64, 10, false);
+  if(passed)
+    printf("lockstep/random: 64 random programs match\n");
+  return passed;
+}
+
+//a loop at 0x0150 of code, for the idioms the interpreter fuses
+static vector<BYTE> IDIOM_ROM(const vector<BYTE> &code)
+{
+  vector<BYTE> rom(0x8000);
+  const BYTE entry[] = {0xC3, 0x50, 0x01}; //JP 0x0150
+  memcpy(&rom[0x100], entry, sizeof(entry));
+  memcpy(&rom[0x150], code.data(), code.size());
+  size_t at = 0x150 + code.size();
+  for(BYTE byte : {0xC3, 0x50, 0x01}) //JP 0x0150
+    rom[at++] = byte;
+  return rom;
+}
+
+//fused idioms against the same machines one opcode at a time, which an attached debugger forces.
+//Both have to end up identical
+static bool BENCH_FUSION()
+{
+  const struct {
+    const char *name;
+    vector<BYTE> code;
+    bool lcd;
+  } IDIOMS[] = {
+      //LD HL,0xC000 / LD BC,0xC800 / LD DE,0xD000 / LD C,0 / LD A,(HL+) / LD (BC),A / INC DE / DEC C / JR NZ
+      {"copy", {0x21, 0x00, 0xC0, 0x01, 0x00, 0xC8, 0x11, 0x00, 0xD0, 0x0E, 0x00,
+                0x2A, 0x12, 0x13, 0x0D, 0x20, 0xFA}, true},
+      {"copy_lcd_off", {0x21, 0x00, 0xC0, 0x01, 0x00, 0xC8, 0x11, 0x00, 0xD0, 0x0E, 0x00,
+                        0x2A, 0x12, 0x13, 0x0D, 0x20, 0xFA}, false},
+      //LD DE,0xC000 / LD HL,0xC800 / LD C,0 / LD A,(DE) / LD (HL+),A / INC DE / DEC C / JR NZ
+      {"copy_de", {0x11, 0x00, 0xC0, 0x21, 0x00, 0xC8, 0x0E, 0x00, 0x1A, 0x22, 0x13, 0x0D, 0x20, 0xFA}, true},
+      //LDH A,(LY) / CP 0x90 / JR NZ, then the same for line 0
+      {"poll", {0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA, 0xF0, 0x44, 0xFE, 0x00, 0x20, 0xFA}, true},
+      //DIV only matches if every read is on the right cycle
+      {"poll_div", {0xF0, 0x04, 0xFE, 0x80, 0x20, 0xFA, 0xF0, 0x04, 0xFE, 0x00, 0x20, 0xFA}, false},
+  };
+  //rounds of frames, each machine's median round. Taking turns to go first keeps either from
+  //always running on a cold cache or a clock that hasn't ramped up yet
+  const int rounds = 15;
+  const int frames = 8;
+  bool passed = true;
+
+  for(const auto &idiom : IDIOMS)
+  {
+    vector<BYTE> rom = IDIOM_ROM(idiom.code);
+    auto fused = MACHINE(rom);
+    auto single = MACHINE(rom);
+    Debugger debugger;
+    debugger.ATTACH(single.get());
+    if(!idiom.lcd)
+    {
+      fused->WRITE(0xFF40, 0x00);
+      single->WRITE(0xFF40, 0x00);
+    }
+
+    auto ROUND = [&](CPU_ &machine) {
+      double start = NOW();
+      for(int i = 0; i < frames; i++)
+        machine.RUN_FRAME();
+      return NOW() - start;
+    };
+    vector<double> fused_times;
+    vector<double> single_times;
+    for(int round = 0; round < rounds; round++)
+    {
+      if(round % 2)
+        fused_times.push_back(ROUND(*fused));
+      single_times.push_back(ROUND(*single));
+      if(!(round % 2))
+        fused_times.push_back(ROUND(*fused));
+    }
+    sort(fused_times.begin(), fused_times.end());
+    sort(single_times.begin(), single_times.end());
+    double fused_seconds = fused_times[rounds / 2];
+    double single_seconds = single_times[rounds / 2];
+
+    vector<BYTE> expected;
+    vector<BYTE> actual;
+    single->SAVE_STATE(expected);
+    fused->SAVE_STATE(actual);
+    if(expected != actual || fused->INSTRUCTION_COUNT() != single->INSTRUCTION_COUNT())
+    {
+      printf("fusion/%s: FAILED, fused run diverged\n", idiom.name);
+      passed = false;
+      continue;
+    }
+    double instructions = (double) fused->INSTRUCTION_COUNT() / rounds;
+    printf("fusion/%s: %.1fM instructions/s fused vs %.1fM one at a time (%.2fx)\n", idiom.name,
+           instructions / fused_seconds / 1e6, instructions / single_seconds / 1e6, single_seconds / fused_seconds);
+  }
+  return passed;
+}
+
+//adds JOYP into 256 bytes of WRAM over and over, so every button pressed changes the state for good
+static vector<BYTE> INPUT_ROM()
+{
+  return IDIOM_ROM({0x21, 0x00, 0xC0, //LD HL,0xC000
+                    0x06, 0x00, //LD B,0
+                    0x3E, 0x20, 0xE0, 0x00, //LD A,0x20 / LDH (JOYP),A, the direction row
+                    0xF0, 0x00, //LDH A,(JOYP)
+                    0x86, //ADD A,(HL)
+                    0x22, //LD (HL+),A
+                    0x05, //DEC B
+                    0x20, 0xF5}); //JR NZ to the LD A, then JP 0x0150
+}
+
+//a recorded movie has to play back to the machine that recorded it, from the start and from a
+//seek, and notice a machine that went somewhere else. A seek replays less than a keyframe interval
+static bool BENCH_MOVIE()
+{
+  const int frames = 1200;
+  const uint64_t target = 1150; //just short of a keyframe, the most a seek replays
+  const string path = (filesystem::temp_directory_path() / "gb++-bench.gbm").string();
+  bool passed = true;
+
+  auto recorded = MACHINE(INPUT_ROM());
+  Movie recording(60, 300);
+  recording.START(*recorded);
+  mt19937 rng(7);
+  for(int i = 0; i < frames; i++)
+    recording.RECORD_FRAME(*recorded, (rng() & 3) ? 0 : (BYTE) (1 << (rng() & 7)));
+  if(!recording.SAVE(path))
+  {
+    printf("movie: FAILED, could not write %s\n", path.c_str());
+    return false;
+  }
+
+  Movie movie;
+  if(!movie.LOAD(path))
+  {
+    printf("movie: FAILED, could not read %s back\n", path.c_str());
+    return false;
+  }
+  printf("movie/size: %ju bytes for %d frames\n", (uintmax_t) filesystem::file_size(path), frames);
+
+  //no ROM loaded, the start state brings it
+  auto player = make_unique<CPU_>();
+  bool synced = movie.SEEK(*player, 0);
+  while(synced && movie.POSITION() < movie.FRAMES())
+    synced = movie.PLAY_FRAME(*player);
+  vector<BYTE> expected;
+  vector<BYTE> actual;
+  recorded->SAVE_STATE(expected);
+  player->SAVE_STATE(actual);
+  if(!synced || expected != actual)
+  {
+    printf("movie/playback: FAILED, the playback diverged\n");
+    passed = false;
+  }
+
+  //a breakpoint on the loop stops every frame part way, the movie has to run through it
+  auto broken = make_unique<CPU_>();
+  Debugger debugger;
+  debugger.ATTACH(broken.get());
+  debugger.ADD_BREAKPOINT(0x0150);
+  synced = movie.SEEK(*broken, 0);
+  while(synced && movie.POSITION() < 120)
+    synced = movie.PLAY_FRAME(*broken);
+  if(!synced)
+  {
+    printf("movie/breakpoint: FAILED, desynced under a breakpoint\n");
+    passed = false;
+  }
+  debugger.DETACH();
+
+  auto seeker = make_unique<CPU_>();
+  auto replayer = make_unique<CPU_>();
+  MEASURE("movie/seek", 1, [&]() { movie.SEEK(*seeker, target); });
+  MEASURE("movie/replay", 1, [&]() {
+    movie.SEEK(*replayer, 0);
+    while(movie.POSITION() < target)
+      movie.PLAY_FRAME(*replayer);
+  });
+  seeker->SAVE_STATE(expected);
+  replayer->SAVE_STATE(actual);
+  if(expected != actual)
+  {
+    printf("movie/seek: FAILED, a seek ended somewhere else than the replay\n");
+    passed = false;
+  }
+
+  //one byte off has to show at the next hash
+  auto desynced = make_unique<CPU_>();
+  movie.SEEK(*desynced, 0);
+  desynced->WRITE(0xC010, desynced->READ(0xC010) ^ 0x01);
+  while(movie.POSITION() < movie.FRAMES() && movie.PLAY_FRAME(*desynced))
+    ;
+  if(movie.POSITION() != 60)
+  {
+    printf("movie/desync: FAILED, noticed by frame %ju instead of 60\n", (uintmax_t) movie.POSITION());
+    passed = false;
+  }
+
+  filesystem::remove(path);
+  return passed;
+}
+
+//whole frames on small built in programs
+static bool BENCH_FRAME()
+{
+  const int frames = 60;
+
+  auto loop = MACHINE(LOOP_ROM());
+  MEASURE("frame/loop", frames, [&]() {
+    for(int i = 0; i < frames; i++)
+      loop->RUN_FRAME();
+  });
+
+  auto lcd_off = MACHINE(LOOP_ROM());
+  lcd_off->WRITE(0xFF40, 0x00);
+  MEASURE("frame/lcd_off", frames, [&]() {
+    for(int i = 0; i < frames; i++)
+      lcd_off->RUN_FRAME();
+  });
+
+  //the fastest TIMA rate keeps the scheduler busy
+  auto timer = MACHINE(LOOP_ROM());
+  timer->WRITE(0xFF07, 0x05);
+  MEASURE("frame/timer", frames, [&]() {
+    for(int i = 0; i < frames; i++)
+      timer->RUN_FRAME();
+  });
+
+  auto calls = MACHINE(MIX_ROM({0xCD, 0x00, 0x10, 0xC5, 0xC1, 0xD5, 0xE1}));
+  MEASURE("frame/calls", frames, [&]() {
+    for(int i = 0; i < frames; i++)
+      calls->RUN_FRAME();
+  });
+  return true;
+}
+
+//batched stepping, ns per machine-frame on one thread and on all of them. Both have to agree
+//on every observation, the machines don't share anything
+static bool BENCH_ENV()
+{
+  vector<BYTE> rom = LOOP_ROM();
+  int cores = max(1u, thread::hardware_concurrency());
+  const int n = 4 * cores;
+  const int steps = 10;
+  const uint16_t ram[] = {0xC000, 0xC100, 0xFF44};
+
+  vector<BYTE> observations[2];
+  int index = 0;
+  for(int threads : {1, cores})
+  {
+    gb_vec_env *env = gb_vec_env_create(n, rom.data(), rom.size(), threads);
+    gb_vec_env_set_observation(env, 2);
+    gb_vec_env_set_ram(env, ram, 3);
+    gb_vec_env_set_max_frames(env, 25);
+
+    vector<BYTE> actions(n);
+    vector<BYTE> obs(n * gb_vec_env_observation_size(env));
+    vector<BYTE> ram_out(n * 3);
+    vector<BYTE> done(n);
+    for(int i = 0; i < n; i++)
+      actions[i] = i & 0xFF;
+
+    gb_vec_env_reset(env, obs.data(), ram_out.data());
+    MEASURE("env/threads_" + to_string(threads), (double) n * steps, [&]() {
+      for(int i = 0; i < steps; i++)
+        gb_vec_env_step(env, actions.data(), obs.data(), ram_out.data(), done.data());
+    });
+
+    //same number of steps from the reset state for the comparison
+    gb_vec_env_reset(env, obs.data(), ram_out.data());
+    for(int i = 0; i < 30; i++)
+      gb_vec_env_step(env, actions.data(), obs.data(), ram_out.data(), done.data());
+    observations[index++] = obs;
+    gb_vec_env_destroy(env);
+
+    if(cores == 1)
+      return true;
+  }
+
+  if(observations[0] != observations[1])
+  {
+    printf("env: FAILED, threaded observations differ\n");
+    return false;
+  }
+  return true;
+}
+
+static bool WRITE_JSON(const string &path)
+{
+  ofstream out(path);
+  if(!out.is_open())
+    return false;
+
+  out << "{\"results\": [" << endl;
+  for(size_t i = 0; i < measurements.size(); i++)
+  {
+    const Measurement &m = measurements[i];
+    char line[256];
+    snprintf(line, sizeof(line), "  {\"name\": \"%s\", \"ns_per_op\": %.4f, \"spread_percent\": %.2f}%s",
+             m.name.c_str(), m.ns_per_op, m.spread, i + 1 < measurements.size() ? "," : "");
+    out << line << endl;
+  }
+  out << "]}" << endl;
+  return true;
+}
+
+//reads back what WRITE_JSON wrote, one result per line
+static bool COMPARE_BASELINE(const string &path, double threshold)
+{
+  ifstream in(path);
+  if(!in.is_open())
+  {
+    printf("could not read baseline %s\n", path.c_str());
+    return false;
+  }
+
+  map<string, double> baseline;
+  string line;
+  while(getline(in, line))
+  {
+    char name[128];
+    double ns;
+    if(sscanf(line.c_str(), " {\"name\": \"%127[^\"]\", \"ns_per_op\": %lf", name, &ns) == 2)
+      baseline[name] = ns;
+  }
+
+  bool passed = true;
+  for(const Measurement &m : measurements)
+  {
+    auto entry = baseline.find(m.name);
+    if(entry == baseline.end())
+      continue;
+
+    double change = 100 * (m.ns_per_op - entry->second) / entry->second;
+    bool regressed = change > threshold;
+    printf("%-24s %10.2f -> %10.2f ns/op  %+6.1f%%%s\n", m.name.c_str(), entry->second, m.ns_per_op, change,
+           regressed ? "  REGRESSION" : "");
+    passed &= !regressed;
+  }
+  return passed;
+}
+
+int main(int argc, char **argv)
+{
+  const char *filter = "";
+  string json;
+  string baseline;
+  double threshold = 10;
+
+  for(int i = 1; i < argc; i++)
+  {
+    string arg = argv[i];
+    if(arg == "--json" && i + 1 < argc)
+      json = argv[++i];
+    else if(arg == "--baseline" && i + 1 < argc)
+      baseline = argv[++i];
+    else if(arg == "--threshold" && i + 1 < argc)
+      threshold = stod(argv[++i]);
+    else if(arg == "--perf")
+      use_perf = true;
+    else if(arg[0] != '-')
+      filter = argv[i];
+    else
+    {
+      printf("usage: gb++-bench [FILTER] [--json FILE] [--baseline FILE] [--threshold PERCENT] [--perf]\n");
+      return 1;
+    }
+  }
+
+  bool passed = true;
+
+  if(strstr("cpu", filter))
+    passed &= BENCH_CPU();
+  if(strstr("bus", filter))
+    passed &= BENCH_BUS();
+  if(strstr("ppu", filter))
+    passed &= BENCH_PPU();
+  if(strstr("state", filter))
+    passed &= BENCH_STATE();
+  if(strstr("hash", filter))
+    passed &= BENCH_HASH();
+  if(strstr("shm", filter))
+    passed &= BENCH_SHM();
+  if(strstr("pool", filter))
+    passed &= BENCH_POOL();
+  if(strstr("lockstep", filter))
+    passed &= BENCH_LOCKSTEP();
+  if(strstr("fusion", filter))
+    passed &= BENCH_FUSION();
+  if(strstr("movie", filter))
+    passed &= BENCH_MOVIE();
+  if(strstr("frame", filter))
+    passed &= BENCH_FRAME();
+  if(strstr("env", filter))
+    passed &= BENCH_ENV();
+  if(strstr("resampler", filter))
+    passed &= BENCH_RESAMPLER();
+  if(strstr("debugger", filter))
+    passed &= BENCH_DEBUGGER();
+  if(strstr("model", filter))
+    passed &= BENCH_MODEL();
+
+  if(!json.empty() && !WRITE_JSON(json))
+  {
+    printf("could not write %s\n", json.c_str());
+    passed = false;
+  }
+  if(!baseline.empty())
+    passed &= COMPARE_BASELINE(baseline, threshold);
+
+  return passed ? 0 : 1;
+}
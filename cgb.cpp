@@ -0,0 +1,201 @@
+#include "cpu.h"
+
+#include <cstring>
+
+//CGB registers. VRAM and WRAM banks are switched by repointing the bus pages, so an access to a
+//banked region costs the same as any other
+
+void CPU_::SET_MODEL(Model hardware)
+{
+  requested_model = hardware;
+}
+
+Model CPU_::GET_MODEL()
+{
+  return model;
+}
+
+//a CGB game on DMG hardware runs as a DMG game, a DMG game on a CGB runs in compatibility mode
+void CPU_::DETECT_MODEL()
+{
+  bool cgb_game = PEEK(CGB_FLAG_ADDRESS) & 0x80;
+
+  if(requested_model == MODEL_AUTO)
+    model = cgb_game ? MODEL_CGB : MODEL_DMG;
+  else if(requested_model == MODEL_CGB && !cgb_game)
+    model = MODEL_CGB_DMG;
+  else
+    model = requested_model;
+
+  if(model == MODEL_CGB)
+    ENABLE_CGB();
+}
+
+const CPU_::IoHandlers &CPU_::CGB_IO()
+{
+  static const IoHandlers handlers = [] {
+    IoHandlers io = DMG_IO();
+    io.read[0x4D] = &CPU_::READ_KEY1;
+    io.write[0x4D] = &CPU_::WRITE_KEY1;
+    io.read[0x4F] = &CPU_::READ_VBK;
+    io.write[0x4F] = &CPU_::WRITE_VBK;
+    for(int hdma = 0x51; hdma <= 0x54; hdma++)
+      io.write[hdma] = &CPU_::WRITE_HDMA_ADDRESS;
+    io.read[0x55] = &CPU_::READ_HDMA5;
+    io.write[0x55] = &CPU_::WRITE_HDMA5;
+    io.read[0x69] = &CPU_::READ_PALETTE;
+    io.write[0x69] = &CPU_::WRITE_PALETTE;
+    io.read[0x6B] = &CPU_::READ_PALETTE;
+    io.write[0x6B] = &CPU_::WRITE_PALETTE;
+    io.read[0x70] = &CPU_::READ_SVBK;
+    io.write[0x70] = &CPU_::WRITE_SVBK;
+    return io;
+  }();
+  return handlers;
+}
+
+void CPU_::ENABLE_CGB()
+{
+  if(!cgb)
+    cgb = make_unique<CgbState>();
+
+  io = &CGB_IO();
+  MAP_BANKS();
+}
+
+void CPU_::MAP_BANKS()
+{
+  BYTE *video = (IO(VBK) & 0x01) ? cgb->vram_bank1 : vram;
+  for(int page = 0x80; page < 0xA0; page++)
+  {
+    read_map[page] = write_map[page] = &video[(page - 0x80) << 8];
+    UPDATE_PAGE(page);
+  }
+
+  //bank 0 selects bank 1, the echo at 0xF000 follows whatever is mapped at 0xD000
+  int bank = (IO(SVBK) & 0x07) ? (IO(SVBK) & 0x07) : 1;
+  for(int page = 0xD0; page < 0xE0; page++)
+  {
+    BYTE *wram = bank == 1 ? memory[page]->data : &cgb->wram_banks[bank - 2][(page - 0xD0) << 8];
+    read_map[page] = write_map[page] = wram;
+    UPDATE_PAGE(page);
+
+    if(page + 0x20 < 0xFE)
+    {
+      read_map[page + 0x20] = write_map[page + 0x20] = read_map[page];
+      UPDATE_PAGE(page + 0x20);
+    }
+  }
+
+  //the same bus pages now reach other slots
+  if(hashing)
+    ARM_HASH_TRAPS();
+}
+
+BYTE CPU_::READ_KEY1(WORD)
+{
+  return (cgb->speed_shift ? 0x80 : 0x00) | 0x7E | (IO(KEY1) & 0x01);
+}
+
+void CPU_::WRITE_KEY1(WORD, BYTE value)
+{
+  IO(KEY1) = value & 0x01;
+}
+
+//STOP with KEY1 armed, the CPU side (timer, DMA, events) just sees cycles arrive faster
+void CPU_::SWITCH_SPEED()
+{
+  cgb->speed_shift ^= DOUBLE_SPEED_SHIFT;
+  IO(KEY1) = 0;
+  WRITE_DIV(0xFF04, 0);
+}
+
+BYTE CPU_::READ_VBK(WORD)
+{
+  return 0xFE | IO(VBK);
+}
+
+void CPU_::WRITE_VBK(WORD, BYTE value)
+{
+  IO(VBK) = value & 0x01;
+  MAP_BANKS();
+}
+
+BYTE CPU_::READ_SVBK(WORD)
+{
+  return 0xF8 | IO(SVBK);
+}
+
+void CPU_::WRITE_SVBK(WORD, BYTE value)
+{
+  IO(SVBK) = value & 0x07;
+  MAP_BANKS();
+}
+
+//BCPD at 0xFF69 and OCPD at 0xFF6B, each indexed by the specification register before it
+BYTE CPU_::READ_PALETTE(WORD address)
+{
+  BYTE *palettes = address == 0xFF69 ? cgb->bg_palettes : cgb->obj_palettes;
+  return palettes[IO(address - 1) & 0x3F];
+}
+
+void CPU_::WRITE_PALETTE(WORD address, BYTE value)
+{
+  BYTE *palettes = address == 0xFF69 ? cgb->bg_palettes : cgb->obj_palettes;
+  BYTE &specification = IO(address - 1);
+
+  palettes[specification & 0x3F] = value;
+  if(specification & 0x80)
+    specification = 0x80 | ((specification + 1) & 0x3F);
+}
+
+//the addresses are loaded as they are written rather than when HDMA5 starts a transfer, so
+//starting again after a cancel carries on from where the copy stopped
+void CPU_::WRITE_HDMA_ADDRESS(WORD address, BYTE value)
+{
+  IO(address) = value;
+  cgb->hdma_source = ((IO(HDMA1) << 8) | IO(HDMA2)) & 0xFFF0;
+  cgb->hdma_destination = 0x8000 | (((IO(HDMA3) << 8) | IO(HDMA4)) & 0x1FF0);
+}
+
+BYTE CPU_::READ_HDMA5(WORD)
+{
+  //bit 7 clear while an HBlank transfer is still going
+  return cgb->hdma_blocks ? (cgb->hdma_blocks - 1) : cgb->hdma_status;
+}
+
+void CPU_::WRITE_HDMA5(WORD, BYTE value)
+{
+  if(cgb->hdma_blocks && !(value & 0x80))
+  {
+    //games read back what was left to pick the transfer up again later
+    cgb->hdma_status = 0x80 | (cgb->hdma_blocks - 1);
+    cgb->hdma_blocks = 0;
+    return;
+  }
+
+  cgb->hdma_status = 0xFF; //what a transfer that runs to the end leaves
+  cgb->hdma_blocks = (value & 0x7F) + 1;
+
+  if(value & 0x80)
+    return; //one block every HBlank from LCD_STEP
+
+  //general purpose, the whole thing at once with the CPU stalled for it
+  while(cgb->hdma_blocks)
+    COPY_HDMA_BLOCK();
+}
+
+void CPU_::COPY_HDMA_BLOCK()
+{
+  BYTE *source = read_map[cgb->hdma_source >> 8];
+  BYTE *destination = write_map[cgb->hdma_destination >> 8];
+  if(source && destination)
+    memcpy(&destination[cgb->hdma_destination & 0xF0], &source[cgb->hdma_source & 0xF0], 0x10);
+  if(hashing)
+    DIRTY_PAGE(cgb->hdma_destination >> 8);
+
+  cgb->hdma_source += 0x10;
+  cgb->hdma_destination = 0x8000 | ((cgb->hdma_destination + 0x10) & 0x1FF0);
+  cgb->hdma_blocks--;
+  cycles += HDMA_BLOCK_CYCLES << cgb->speed_shift;
+}
@@ -0,0 +1,367 @@
+#include "condition.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+struct BinaryOperator {
+    const char *token;
+    ConditionOp op;
+};
+
+//lowest precedence first, PARSE_BINARY(level) handles one row
+static const BinaryOperator OPERATORS[][4] = {
+    {{"||", COND_LOGICAL_OR}},
+    {{"&&", COND_LOGICAL_AND}},
+    {{"|", COND_OR}},
+    {{"^", COND_XOR}},
+    {{"&", COND_AND}},
+    {{"==", COND_EQ}, {"!=", COND_NE}},
+    {{"<=", COND_LE}, {">=", COND_GE}, {"<", COND_LT}, {">", COND_GT}},
+    {{"+", COND_ADD}, {"-", COND_SUB}},
+    {{"*", COND_MUL}, {"/", COND_DIV}, {"%", COND_MOD}}
+};
+#define OPERATOR_LEVELS ((int) (sizeof(OPERATORS) / sizeof(OPERATORS[0])))
+
+static const char *REGISTER_NAMES[] = {"A", "F", "B", "C", "D", "E", "H", "L", "AF", "BC", "DE", "HL", "SP", "PC"};
+
+static const struct {
+    const char *name;
+    BYTE bit;
+} FLAG_NAMES[] = {{"ZF", ZERO_FLAG}, {"NF", SUBTRACT_FLAG}, {"HF", HALFCARRY_FLAG}, {"CF", CARRY_FLAG}};
+
+//32 bit two's complement, wrapping rather than overflowing. Dividing by 0 gives 0, and INT_MIN / -1
+//wraps back to INT_MIN instead of trapping
+static int32_t WRAP(uint32_t value)
+{
+  return (int32_t) value;
+}
+
+static int32_t APPLY(ConditionOp op, int32_t a, int32_t b)
+{
+  switch(op)
+  {
+    case COND_MUL: return WRAP((uint32_t) a * (uint32_t) b);
+    case COND_DIV: return !b ? 0 : b == -1 ? WRAP(0u - (uint32_t) a) : a / b;
+    case COND_MOD: return !b || b == -1 ? 0 : a % b;
+    case COND_ADD: return WRAP((uint32_t) a + (uint32_t) b);
+    case COND_SUB: return WRAP((uint32_t) a - (uint32_t) b);
+    case COND_LT: return a < b;
+    case COND_LE: return a <= b;
+    case COND_GT: return a > b;
+    case COND_GE: return a >= b;
+    case COND_EQ: return a == b;
+    case COND_NE: return a != b;
+    case COND_AND: return a & b;
+    case COND_XOR: return a ^ b;
+    case COND_OR: return a | b;
+    case COND_LOGICAL_AND: return a && b;
+    case COND_LOGICAL_OR: return a || b;
+    default: return 0;
+  }
+}
+
+void BreakCondition::SKIP_SPACE()
+{
+  while(isspace((unsigned char) *cursor))
+    cursor++;
+}
+
+bool BreakCondition::ACCEPT(const char *token)
+{
+  SKIP_SPACE();
+  size_t length = strlen(token);
+  if(strncmp(cursor, token, length))
+    return false;
+
+  //"&" mustn't eat half of "&&", same for "|" and "||"
+  if(length == 1 && (*token == '&' || *token == '|') && cursor[1] == *token)
+    return false;
+
+  cursor += length;
+  return true;
+}
+
+unique_ptr<BreakCondition::Node> BreakCondition::PARSE_BINARY(int level)
+{
+  if(level == OPERATOR_LEVELS)
+    return PARSE_UNARY();
+
+  unique_ptr<Node> left = PARSE_BINARY(level + 1);
+  while(left)
+  {
+    const BinaryOperator *match = nullptr;
+    for(const BinaryOperator &candidate : OPERATORS[level])
+    {
+      if(candidate.token && ACCEPT(candidate.token))
+      {
+        match = &candidate;
+        break;
+      }
+    }
+    if(!match)
+      break;
+
+    unique_ptr<Node> right = PARSE_BINARY(level + 1);
+    if(!right)
+      return nullptr;
+
+    //fold constant subexpressions now rather than on every hit
+    if(left->op == COND_CONST && right->op == COND_CONST)
+    {
+      left->value = APPLY(match->op, left->value, right->value);
+      continue;
+    }
+
+    unique_ptr<Node> node(new Node{match->op, 0, move(left), move(right)});
+    left = move(node);
+  }
+  return left;
+}
+
+unique_ptr<BreakCondition::Node> BreakCondition::PARSE_UNARY()
+{
+  ConditionOp op;
+  if(ACCEPT("!"))
+    op = COND_NOT;
+  else if(ACCEPT("~"))
+    op = COND_INVERT;
+  else if(ACCEPT("-"))
+    op = COND_NEGATE;
+  else
+    return PARSE_PRIMARY();
+
+  unique_ptr<Node> operand = PARSE_UNARY();
+  if(!operand)
+    return nullptr;
+
+  if(operand->op == COND_CONST)
+  {
+    if(op == COND_NOT)
+      operand->value = !operand->value;
+    else if(op == COND_INVERT)
+      operand->value = ~operand->value;
+    else
+      operand->value = WRAP(0u - (uint32_t) operand->value);
+    return operand;
+  }
+  return unique_ptr<Node>(new Node{op, 0, move(operand), nullptr});
+}
+
+unique_ptr<BreakCondition::Node> BreakCondition::PARSE_PRIMARY()
+{
+  SKIP_SPACE();
+
+  if(ACCEPT("("))
+  {
+    unique_ptr<Node> inner = PARSE_BINARY(0);
+    if(inner && !ACCEPT(")"))
+    {
+      error = "expected )";
+      return nullptr;
+    }
+    return inner;
+  }
+
+  if(ACCEPT("["))
+  {
+    unique_ptr<Node> address = PARSE_BINARY(0);
+    if(address && !ACCEPT("]"))
+    {
+      error = "expected ]";
+      return nullptr;
+    }
+    if(!address)
+      return nullptr;
+    return unique_ptr<Node>(new Node{COND_MEMORY, 0, move(address), nullptr});
+  }
+
+  if(*cursor == '$' || isdigit((unsigned char) *cursor))
+  {
+    bool hex = *cursor == '$' || (cursor[0] == '0' && (cursor[1] == 'x' || cursor[1] == 'X'));
+    cursor += *cursor == '$' ? 1 : hex ? 2 : 0;
+    char *end;
+    errno = 0;
+    long long value = strtoll(cursor, &end, hex ? 16 : 10);
+    if(!(hex ? isxdigit((unsigned char) *cursor) : isdigit((unsigned char) *cursor)))
+    {
+      error = "bad number";
+      return nullptr;
+    }
+    if(errno || value > INT32_MAX)
+    {
+      error = "number out of range";
+      return nullptr;
+    }
+    cursor = end;
+    return unique_ptr<Node>(new Node{COND_CONST, (int32_t) value, nullptr, nullptr});
+  }
+
+  string name;
+  while(isalpha((unsigned char) *cursor))
+    name += (char) toupper((unsigned char) *cursor++);
+
+  for(size_t i = 0; i < sizeof(REGISTER_NAMES) / sizeof(REGISTER_NAMES[0]); i++)
+  {
+    if(name == REGISTER_NAMES[i])
+      return unique_ptr<Node>(new Node{COND_REG, (int32_t) i, nullptr, nullptr});
+  }
+  for(const auto &flag : FLAG_NAMES)
+  {
+    if(name == flag.name)
+      return unique_ptr<Node>(new Node{COND_FLAG, flag.bit, nullptr, nullptr});
+  }
+
+  error = name.empty() ? "expected a value" : "unknown name " + name;
+  return nullptr;
+}
+
+void BreakCondition::EMIT(const Node *node, int &depth, int &max_depth)
+{
+  //post order, every operand leaves exactly one value on the stack
+  if(node->left)
+    EMIT(node->left.get(), depth, max_depth);
+  if(node->right)
+    EMIT(node->right.get(), depth, max_depth);
+
+  if(node->op == COND_CONST || node->op == COND_REG || node->op == COND_FLAG)
+    depth++;
+  else if(node->right)
+    depth--;
+  max_depth = max(max_depth, depth);
+
+  code.push_back({node->op, node->value});
+}
+
+void BreakCondition::FIND_ANCHOR(const Node *node)
+{
+  if(node->op == COND_LOGICAL_AND)
+  {
+    FIND_ANCHOR(node->left.get());
+    FIND_ANCHOR(node->right.get());
+    return;
+  }
+
+  if(node->op != COND_EQ)
+    return;
+
+  const Node *left = node->left.get();
+  const Node *right = node->right.get();
+  if(right->op == COND_REG)
+    swap(left, right);
+  if(left->op == COND_REG && left->value == REG_PC && right->op == COND_CONST)
+    pc_anchor = right->value & 0xFFFF;
+}
+
+bool BreakCondition::COMPILE(const string &expression, string &message)
+{
+  code.clear();
+  pc_anchor = -1;
+  text = expression;
+  error.clear();
+  cursor = text.c_str();
+
+  unique_ptr<Node> root = PARSE_BINARY(0);
+  if(root)
+  {
+    SKIP_SPACE();
+    if(*cursor)
+    {
+      error = string("unexpected ") + *cursor;
+      root = nullptr;
+    }
+  }
+  cursor = nullptr;
+
+  if(!root)
+  {
+    message = error;
+    return false;
+  }
+
+  int depth = 0;
+  int max_depth = 0;
+  EMIT(root.get(), depth, max_depth);
+  if(max_depth > CONDITION_MAX_STACK)
+  {
+    code.clear();
+    message = "expression too deep";
+    return false;
+  }
+
+  FIND_ANCHOR(root.get());
+  return true;
+}
+
+bool BreakCondition::EVALUATE(CPU_ &cpu) const
+{
+  int32_t stack[CONDITION_MAX_STACK];
+  int top = -1;
+  Registers regs = cpu.GET_REGISTERS();
+
+  for(const ConditionInstruction &instruction : code)
+  {
+    switch(instruction.op)
+    {
+      case COND_CONST:
+        stack[++top] = instruction.value;
+        break;
+      case COND_REG:
+      {
+        int32_t value = 0;
+        switch(instruction.value)
+        {
+          case REG_A: value = regs.AF >> 8; break;
+          case REG_F: value = regs.AF & 0xFF; break;
+          case REG_B: value = regs.BC >> 8; break;
+          case REG_C: value = regs.BC & 0xFF; break;
+          case REG_D: value = regs.DE >> 8; break;
+          case REG_E: value = regs.DE & 0xFF; break;
+          case REG_H: value = regs.HL >> 8; break;
+          case REG_L: value = regs.HL & 0xFF; break;
+          case REG_AF: value = regs.AF; break;
+          case REG_BC: value = regs.BC; break;
+          case REG_DE: value = regs.DE; break;
+          case REG_HL: value = regs.HL; break;
+          case REG_SP: value = regs.SP; break;
+          case REG_PC: value = regs.PC; break;
+        }
+        stack[++top] = value;
+        break;
+      }
+      case COND_FLAG:
+        stack[++top] = cpu.GET_FLAG(instruction.value);
+        break;
+      case COND_MEMORY:
+        stack[top] = cpu.PEEK((WORD) stack[top]);
+        break;
+      case COND_NOT:
+        stack[top] = !stack[top];
+        break;
+      case COND_INVERT:
+        stack[top] = ~stack[top];
+        break;
+      case COND_NEGATE:
+        stack[top] = WRAP(0u - (uint32_t) stack[top]);
+        break;
+      default:
+        top--;
+        stack[top] = APPLY(instruction.op, stack[top], stack[top + 1]);
+        break;
+    }
+  }
+
+  return top >= 0 && stack[top];
+}
+
+int BreakCondition::PC_ANCHOR() const
+{
+  return pc_anchor;
+}
+
+const string &BreakCondition::TEXT() const
+{
+  return text;
+}
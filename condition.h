@@ -0,0 +1,93 @@
+#ifndef _CONDITION_H_
+#define _CONDITION_H_
+
+#include "cpu.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Breakpoint conditions like "PC==0x0150 && A>0x10 && [0xC000]==3".
+ *
+ * Operands: numbers (decimal, 0x or $ hex), registers A F B C D E H L AF BC DE HL SP PC,
+ * flags ZF NF HF CF and [expr] for a byte of memory. Operators in C precedence:
+ * ! ~ - (unary), * / %, + -, < <= > >=, == !=, &, ^, |, &&, ||, and parentheses.
+ *
+ * The text is parsed once into bytecode for a small stack machine, so a condition on a PC that
+ * runs 100k times a frame costs a few dozen nanoseconds per hit rather than a parse.
+ */
+
+enum ConditionOp : uint8_t {
+    COND_CONST,
+    COND_REG,
+    COND_FLAG,
+    COND_MEMORY,
+    COND_NOT,
+    COND_INVERT,
+    COND_NEGATE,
+    COND_MUL,
+    COND_DIV,
+    COND_MOD,
+    COND_ADD,
+    COND_SUB,
+    COND_LT,
+    COND_LE,
+    COND_GT,
+    COND_GE,
+    COND_EQ,
+    COND_NE,
+    COND_AND,
+    COND_XOR,
+    COND_OR,
+    COND_LOGICAL_AND,
+    COND_LOGICAL_OR
+};
+
+//register operands, COND_REG's argument
+enum ConditionRegister : uint8_t {
+    REG_A, REG_F, REG_B, REG_C, REG_D, REG_E, REG_H, REG_L,
+    REG_AF, REG_BC, REG_DE, REG_HL, REG_SP, REG_PC
+};
+
+struct ConditionInstruction {
+    ConditionOp op;
+    int32_t value;
+};
+
+#define CONDITION_MAX_STACK 32
+
+class BreakCondition {
+ private:
+  struct Node {
+      ConditionOp op;
+      int32_t value;
+      unique_ptr<Node> left;
+      unique_ptr<Node> right;
+  };
+
+  vector<ConditionInstruction> code;
+  int pc_anchor = -1; //PC from a top level "PC==n" term, -1 if there isn't one
+  string text;
+
+  //parser state
+  const char *cursor = nullptr;
+  string error;
+
+  unique_ptr<Node> PARSE_BINARY(int level);
+  unique_ptr<Node> PARSE_UNARY();
+  unique_ptr<Node> PARSE_PRIMARY();
+  void SKIP_SPACE();
+  bool ACCEPT(const char *token);
+  void EMIT(const Node *node, int &depth, int &max_depth);
+  void FIND_ANCHOR(const Node *node);
+
+ public:
+  bool COMPILE(const string &expression, string &message);
+  bool EVALUATE(CPU_ &cpu) const;
+
+  int PC_ANCHOR() const;
+  const string &TEXT() const;
+};
+
+#endif //_CONDITION_H_
@@ -0,0 +1,360 @@
+#include "cpu.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+#define DEFAULT_BUDGET (60ULL * CPU_FREQ) //one emulated minute
+#define STALL_FRAMES 120 //PC hasn't moved for two emulated seconds, the ROM is done or stuck
+
+/*
+ * Runs every ROM under a directory, each on its own machine, spread over a thread pool.
+ *
+ * A ROM passes if
+ *  - it prints "Passed" over serial (blargg)
+ *  - it loads the fibonacci sequence 3/5/8/13/21/34 into B/C/D/E/H/L (mooneye)
+ *  - or its final framebuffer matches the XXH64 in <rom>.hash, written by --update-hashes
+ * <rom>.cycles overrides the cycle budget for a single ROM.
+ */
+
+struct RomResult {
+    string name;
+    string status; //pass, fail, timeout, updated or error
+    string detail;
+    uint64_t cycles = 0;
+    double seconds = 0;
+    uint64_t hash = 0;
+    string serial;
+};
+
+//false without the sidecar, and with error set if it's there but isn't a number
+static bool READ_SIDECAR(const fs::path &rom, const string &extension, uint64_t &value, int base, string &error)
+{
+  fs::path sidecar = rom;
+  sidecar += extension;
+
+  ifstream file(sidecar);
+  string text;
+  if(!file.is_open() || !(file >> text))
+    return false;
+
+  char *end;
+  errno = 0;
+  unsigned long long parsed = strtoull(text.c_str(), &end, base);
+  if(*end || errno || text[0] == '-')
+  {
+    error = "malformed " + sidecar.filename().string() + ": " + text;
+    return false;
+  }
+  value = parsed;
+  return true;
+}
+
+static RomResult RUN_ROM(const fs::path &rom, const fs::path &root, uint64_t budget, bool update_hashes)
+{
+  RomResult result;
+  result.name = fs::relative(rom, root).string();
+
+  auto start = chrono::steady_clock::now();
+  auto machine = make_unique<CPU_>();
+
+  ifstream file(rom, ios::binary);
+  if(!file.is_open())
+  {
+    result.status = "error";
+    result.detail = "could not open ROM";
+    return result;
+  }
+  //the header picks the model, which picks the registers the boot ROM leaves
+  machine->LOAD_ROM(file, fs::file_size(rom));
+  machine->INIT_POST_BOOT();
+
+  uint64_t expected_hash = 0;
+  string error;
+  bool has_hash = !update_hashes && READ_SIDECAR(rom, ".hash", expected_hash, 16, error);
+  READ_SIDECAR(rom, ".cycles", budget, 10, error);
+  if(!error.empty())
+  {
+    result.status = "error";
+    result.detail = error;
+    return result;
+  }
+
+  WORD last_pc = 0;
+  int stalled = 0;
+
+  while(result.cycles < budget)
+  {
+    machine->RUN_FRAME();
+    result.cycles += FULL_FRAME_FREQ;
+
+    const string &serial = machine->SERIAL_OUTPUT();
+    if(serial.find("Passed") != string::npos)
+    {
+      result.status = "pass";
+      break;
+    }
+    if(serial.find("Failed") != string::npos)
+    {
+      result.status = "fail";
+      result.detail = "reported failure over serial";
+      break;
+    }
+
+    Registers regs = machine->GET_REGISTERS();
+    if(regs.BC == 0x0305 && regs.DE == 0x080D && regs.HL == 0x1522)
+    {
+      result.status = "pass";
+      break;
+    }
+    if(regs.BC == 0x4242 && regs.DE == 0x4242 && regs.HL == 0x4242)
+    {
+      result.status = "fail";
+      result.detail = "mooneye failure registers";
+      break;
+    }
+
+    stalled = regs.PC == last_pc ? stalled + 1 : 0;
+    last_pc = regs.PC;
+    if(stalled >= STALL_FRAMES)
+      break;
+  }
+
+  result.serial = machine->SERIAL_OUTPUT();
+  result.hash = HASH64(machine->FRAMEBUFFER(), LCD_WIDTH * LCD_HEIGHT);
+
+  if(result.status.empty())
+  {
+    char detail[64];
+
+    if(update_hashes)
+    {
+      fs::path sidecar = rom;
+      sidecar += ".hash";
+      ofstream(sidecar) << hex << result.hash << endl;
+      result.status = "updated";
+    }
+    else if(has_hash)
+    {
+      result.status = result.hash == expected_hash ? "pass" : "fail";
+      if(result.hash != expected_hash)
+      {
+        snprintf(detail, sizeof(detail), "framebuffer hash %016" PRIx64 " expected %016" PRIx64, result.hash, expected_hash);
+        result.detail = detail;
+      }
+    }
+    else if(stalled >= STALL_FRAMES)
+    {
+      result.status = "fail";
+      snprintf(detail, sizeof(detail), "stalled at PC=0x%04X", last_pc);
+      result.detail = detail;
+    }
+    else
+    {
+      result.status = "timeout";
+      result.detail = "cycle budget exhausted";
+    }
+  }
+
+  result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  return result;
+}
+
+static string ESCAPE_JSON(const string &text)
+{
+  string out;
+  for(unsigned char c : text)
+  {
+    if(c == '"' || c == '\\')
+    {
+      out += '\\';
+      out += c;
+    }
+    else if(c < 0x20 || c >= 0x7F)
+    {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      out += code;
+    }
+    else
+      out += c;
+  }
+  return out;
+}
+
+static string ESCAPE_XML(const string &text)
+{
+  string out;
+  for(unsigned char c : text)
+  {
+    if(c == '<')
+      out += "&lt;";
+    else if(c == '>')
+      out += "&gt;";
+    else if(c == '&')
+      out += "&amp;";
+    else if(c == '"')
+      out += "&quot;";
+    else if((c < 0x20 && c != '\n' && c != '\t') || c >= 0x7F)
+      out += '?'; //not allowed in XML 1.0
+    else
+      out += c;
+  }
+  return out;
+}
+
+static void WRITE_JSON(const string &path, const vector<RomResult> &results, double seconds)
+{
+  ofstream out(path);
+  out << "{\n  \"seconds\": " << seconds << ",\n  \"roms\": [\n";
+  for(size_t i = 0; i < results.size(); i++)
+  {
+    const RomResult &r = results[i];
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016" PRIx64, r.hash);
+    out << "    {\"name\": \"" << ESCAPE_JSON(r.name) << "\", \"status\": \"" << r.status
+        << "\", \"detail\": \"" << ESCAPE_JSON(r.detail) << "\", \"cycles\": " << r.cycles
+        << ", \"seconds\": " << r.seconds << ", \"framebuffer_hash\": \"" << hash
+        << "\", \"serial\": \"" << ESCAPE_JSON(r.serial) << "\"}"
+        << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  out << "  ]\n}\n";
+}
+
+static void WRITE_JUNIT(const string &path, const vector<RomResult> &results, double seconds)
+{
+  size_t failures = count_if(results.begin(), results.end(), [](const RomResult &r) {
+    return r.status == "fail" || r.status == "timeout";
+  });
+  size_t errors = count_if(results.begin(), results.end(), [](const RomResult &r) { return r.status == "error"; });
+
+  ofstream out(path);
+  out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+  out << "<testsuite name=\"gb++-conformance\" tests=\"" << results.size() << "\" failures=\"" << failures
+      << "\" errors=\"" << errors << "\" time=\"" << seconds << "\">\n";
+  for(const RomResult &r : results)
+  {
+    out << "  <testcase classname=\"roms\" name=\"" << ESCAPE_XML(r.name) << "\" time=\"" << r.seconds << "\">";
+    if(r.status == "fail" || r.status == "timeout")
+      out << "<failure message=\"" << ESCAPE_XML(r.status + ": " + r.detail) << "\"/>";
+    else if(r.status == "error")
+      out << "<error message=\"" << ESCAPE_XML(r.detail) << "\"/>";
+    if(!r.serial.empty())
+      out << "<system-out>" << ESCAPE_XML(r.serial) << "</system-out>";
+    out << "</testcase>\n";
+  }
+  out << "</testsuite>\n";
+}
+
+//a whole decimal number no bigger than max
+static bool PARSE_NUMBER(const char *text, uint64_t max, uint64_t &value)
+{
+  char *end;
+  errno = 0;
+  unsigned long long parsed = strtoull(text, &end, 10);
+  if(!isdigit((unsigned char) *text) || *end || errno || parsed > max)
+    return false;
+  value = parsed;
+  return true;
+}
+
+static int USAGE()
+{
+  cout << "usage: gb++-conformance DIR [--jobs N] [--cycles N] [--json FILE] [--junit FILE] [--update-hashes]" << endl;
+  return 2;
+}
+
+int main(int argc, char **argv)
+{
+  string directory;
+  string json;
+  string junit;
+  unsigned jobs = max(1u, thread::hardware_concurrency());
+  uint64_t budget = DEFAULT_BUDGET;
+  bool update_hashes = false;
+  uint64_t number;
+
+  for(int i = 1; i < argc; i++)
+  {
+    string arg = argv[i];
+    if(arg == "--jobs" && i + 1 < argc && PARSE_NUMBER(argv[i + 1], 1024, number))
+    {
+      jobs = max<unsigned>(1, number);
+      i++;
+    }
+    else if(arg == "--cycles" && i + 1 < argc && PARSE_NUMBER(argv[i + 1], UINT64_MAX, budget))
+      i++;
+    else if(arg == "--json" && i + 1 < argc)
+      json = argv[++i];
+    else if(arg == "--junit" && i + 1 < argc)
+      junit = argv[++i];
+    else if(arg == "--update-hashes")
+      update_hashes = true;
+    else if(directory.empty() && arg[0] != '-')
+      directory = arg;
+    else
+      return USAGE();
+  }
+
+  if(directory.empty() || !fs::is_directory(directory))
+    return USAGE();
+
+  vector<fs::path> roms;
+  for(auto &entry : fs::recursive_directory_iterator(directory))
+  {
+    string extension = entry.path().extension().string();
+    if(entry.is_regular_file() && (extension == ".gb" || extension == ".gbc"))
+      roms.push_back(entry.path());
+  }
+  sort(roms.begin(), roms.end());
+
+  vector<RomResult> results(roms.size());
+  atomic<size_t> next{0};
+  auto start = chrono::steady_clock::now();
+
+  //every machine is independent, workers just pull the next ROM off the list
+  vector<thread> workers;
+  for(unsigned i = 0; i < min<size_t>(jobs, roms.size()); i++)
+  {
+    workers.emplace_back([&]() {
+      for(size_t rom = next++; rom < roms.size(); rom = next++)
+        results[rom] = RUN_ROM(roms[rom], directory, budget, update_hashes);
+    });
+  }
+  for(auto &worker : workers)
+    worker.join();
+
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  size_t passed = 0;
+  for(const RomResult &r : results)
+  {
+    printf("%-8s %s%s%s\n", r.status.c_str(), r.name.c_str(), r.detail.empty() ? "" : " - ", r.detail.c_str());
+    if(r.status == "pass" || r.status == "updated")
+      passed++;
+  }
+  printf("%zu/%zu passed in %.2fs on %u threads\n", passed, results.size(), seconds, jobs);
+
+  if(!json.empty())
+    WRITE_JSON(json, results, seconds);
+  if(!junit.empty())
+    WRITE_JUNIT(junit, results, seconds);
+
+  return passed == results.size() ? 0 : 1;
+}
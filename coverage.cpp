@@ -0,0 +1,48 @@
+#include "cpu.h"
+#include "aot.h"
+
+#include <cstdio>
+
+//ROM coverage is recorded where the work already happens rather than by decoding every
+//instruction again: ENABLE_COVERAGE switches RUN_FRAME to its coverage loop, which marks where
+//each instruction starts, the loads in OPCODE_HANDLER mark what they read, and the fused idioms
+//mark whole loops at once. Compiled code is left off so nothing runs unmarked
+
+void CPU_::ENABLE_COVERAGE()
+{
+  if(!coverage)
+    coverage = make_unique<CoverageState>();
+}
+
+//length bytes from address up, wrapping like the pointer that read them
+void CPU_::COVER_DATA(WORD address, int length)
+{
+  for(int i = 0; i < length; i++, address++)
+    coverage->read[address] = 1;
+}
+
+//the record so far, for gb++-aot --coverage and anything else that wants to know what ran
+bool CPU_::WRITE_COVERAGE(const string &path)
+{
+  if(!coverage)
+    return false;
+
+  CoverageHeader header;
+  const BYTE *pages[0x80];
+  for(int page = 0; page < 0x80; page++)
+    pages[page] = memory[page]->data;
+  header.rom_hash = AOT_ROM_HASH(pages);
+
+  vector<BYTE> bits(2 * ROM_BANKS * ROM_BANK_SIZE / 8);
+  for(int address = 0; address < ROM_BANKS * ROM_BANK_SIZE; address++)
+  {
+    bits[address >> 3] |= coverage->executed[address] << (address & 7);
+    bits[(ROM_BANKS * ROM_BANK_SIZE + address) >> 3] |= coverage->read[address] << (address & 7);
+  }
+
+  FILE *file = fopen(path.c_str(), "wb");
+  if(!file)
+    return false;
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(bits.data(), bits.size(), 1, file) == 1;
+  return fclose(file) == 0 && ok;
+}
@@ -1,37 +1,382 @@
 #include "cpu.h"
+#include "debugger.h"
 #include <iostream>
+#include <algorithm>
 #include <bitset>
 #include <iomanip>
 #include <cstdio>
+#include <cstring>
 
-extern CPU_ Z80;
+void CPU_::MAP_PAGES()
+{
+  for(int page = 0; page < PAGE_COUNT; page++)
+  {
+    int source = page;
+    if(page >= 0xE0 && page < 0xFE)
+      source = page - 0x20; //echo of 0xC000 - 0xDDFF
+
+    BYTE *backing = PAGED(source) ? memory[source]->data : UNPAGED(source);
+
+    read_map[page] = backing;
+    write_map[page] = page < 0x80 ? nullptr : backing; //ROM, no MBC to catch the writes yet
+    UPDATE_PAGE(page);
+  }
+
+  SHARE_TRAPS();
+  SET_PAGE_TRAP(0xFF, TRAP_IO, true);
+}
+
+void CPU_::UPDATE_PAGE(int page)
+{
+  read_pages[page] = (page_traps[page] & TRAP_READ) ? nullptr : read_map[page];
+  write_pages[page] = (page_traps[page] & TRAP_WRITE) ? nullptr : write_map[page];
+}
+
+void CPU_::SET_PAGE_TRAP(int page, BYTE trap, bool enabled)
+{
+  if(enabled)
+    page_traps[page] |= trap;
+  else
+    page_traps[page] &= ~trap;
+  UPDATE_PAGE(page);
+}
+
+BYTE CPU_::READ_SLOW(WORD address, bool fetch)
+{
+  if(!fetch && (page_traps[address >> 8] & TRAP_WATCH_READ) && debugger)
+    debugger->ON_ACCESS(address, WATCH_READ);
+
+  if(page_traps[address >> 8] & TRAP_DMA)
+    return 0xFF;
+
+  if(page_traps[address >> 8] & TRAP_IO)
+    return IO_READ(address);
+
+  BYTE *page = read_map[address >> 8];
+  return page ? page[address & 0xFF] : 0xFF;
+}
+
+void CPU_::WRITE_SLOW(WORD address, BYTE value)
+{
+  if((page_traps[address >> 8] & TRAP_WATCH_WRITE) && debugger)
+    debugger->ON_ACCESS(address, WATCH_WRITE);
+
+  if(page_traps[address >> 8] & TRAP_DMA)
+    return;
+
+  if(page_traps[address >> 8] & TRAP_IO)
+  {
+    IO_WRITE(address, value);
+    return;
+  }
+
+  if(page_traps[address >> 8] & TRAP_SHARED)
+    OWN_PAGE(address >> 8);
+  if(page_traps[address >> 8] & TRAP_HASH)
+    DIRTY_PAGE(address >> 8);
+
+  BYTE *page = write_map[address >> 8];
+  if(page)
+    page[address & 0xFF] = value;
+}
+
+BYTE CPU_::PEEK(WORD address)
+{
+  //register reads have no side effects, so tools see what the CPU would
+  if(page_traps[address >> 8] & TRAP_IO)
+    return IO_READ(address);
+
+  BYTE *page = read_map[address >> 8];
+  return page ? page[address & 0xFF] : 0xFF;
+}
+
+//PEEK over a range, whole pages at a time where no trap is in the way
+void CPU_::PEEK_BLOCK(WORD address, BYTE *out, size_t length)
+{
+  while(length)
+  {
+    size_t chunk = min<size_t>(length, 0x100 - (address & 0xFF));
+    BYTE *page = read_map[address >> 8];
+
+    if(!page || (page_traps[address >> 8] & TRAP_IO))
+    {
+      for(size_t i = 0; i < chunk; i++)
+        out[i] = PEEK(address + i);
+    }
+    else
+      memcpy(out, &page[address & 0xFF], chunk);
+
+    address += chunk;
+    out += chunk;
+    length -= chunk;
+  }
+}
+
+void CPU_::ATTACH_DEBUGGER(Debugger *attached)
+{
+  debugger = attached;
+}
 
 void CPU_::INIT_PC()
 {
   PC = 0x0000;
 }
 
+//state the DMG boot ROM leaves behind, for running cartridges without one
+void CPU_::INIT_POST_BOOT()
+{
+  AF.reg = 0x01B0;
+  BC.reg = 0x0013;
+  DE.reg = 0x00D8;
+  HL.reg = 0x014D;
+
+  //A is how games tell the hardware apart, 0x11 for anything with a CGB CPU
+  if(model == MODEL_MGB)
+    AF.reg = 0xFFB0;
+  else if(model == MODEL_CGB)
+  {
+    AF.reg = 0x1180;
+    BC.reg = 0x0000;
+    DE.reg = 0xFF56;
+    HL.reg = 0x000D;
+  }
+  else if(model == MODEL_CGB_DMG)
+  {
+    AF.reg = 0x1180;
+    BC.reg = 0x0000;
+    DE.reg = 0x0008;
+    HL.reg = 0x007C;
+  }
+  SP = 0xFFFE;
+  PC = 0x0100;
+
+  IO(STAT) = 0x85;
+  WRITE(0xFF40, 0x91);
+
+  //DIV reads 0xAB when the boot ROM hands over
+  div_base = tima_sync = cycles - 0xABCC;
+  IO(BGP) = 0xFC;
+  IO(OBP0) = 0xFF;
+  IO(OBP1) = 0xFF;
+}
+
 void CPU_::LOAD_BOOTROM(ifstream &FILE, int FILE_SIZE)
 {
-  FILE.read(reinterpret_cast<char *>(Z80.Space.ROM_BANK1), FILE_SIZE);
+  vector<BYTE> data(FILE_SIZE < 0x4000 ? FILE_SIZE : 0x4000);
+  FILE.read(reinterpret_cast<char *>(data.data()), data.size());
+  for(size_t offset = 0; offset < data.size(); offset += 0x100)
+    memcpy(OWN_PAGE(offset >> 8), &data[offset], min<size_t>(data.size() - offset, 0x100));
+  FIND_AOT();
+}
+
+void CPU_::LOAD_ROM(ifstream &FILE, int FILE_SIZE)
+{
+  vector<BYTE> data(FILE_SIZE < 0x8000 ? FILE_SIZE : 0x8000);
+  FILE.read(reinterpret_cast<char *>(data.data()), data.size());
+  LOAD_ROM(data.data(), data.size());
+}
+
+//no MBC yet, only the two fixed banks are mapped. The image goes away straight after, leaving
+//this machine the only holder of its pages
+void CPU_::LOAD_ROM(const BYTE *data, size_t size)
+{
+  LOAD_ROM(RomImage(data, size));
 }
 
 void CPU_::RUN()
 {
   for(int i = 0; i < 24604; i++)
+    STEP();
+  for(int i = 0; i < 30000; i++)
+    STEP();
+}
+
+template<typename MODEL>
+void CPU_::STEP_T()
+{
+  OPCODE_HANDLER();
+  INTERRUPT_HANDLER();
+  instructions++;
+
+  //catch the LCD up on everything since last time, HDMA stalls included
+  int elapsed = cycles - lcd_sync;
+  if constexpr(MODEL::CGB)
+    elapsed >>= cgb->speed_shift;
+  lcd_sync = cycles;
+  frame_cycles += elapsed;
+  LCD_STEP_T<MODEL>(elapsed);
+
+  if(cycles >= next_event)
+    RUN_EVENTS();
+}
+
+void CPU_::STEP()
+{
+  switch(model)
   {
-    OPCODE_HANDLER();
-    INTERRUPT_HANDLER();
-    TIMING();
+    case MODEL_CGB: STEP_T<CgbModel>(); break;
+    case MODEL_MGB: STEP_T<MgbModel>(); break;
+    case MODEL_CGB_DMG: STEP_T<CgbDmgModel>(); break;
+    default: STEP_T<DmgModel>(); break;
   }
-  for(int i = 0; i < 30000; i++)
+}
+
+void CPU_::SCHEDULE(Event event, uint64_t at)
+{
+  event_at[event] = at;
+
+  next_event = NEVER;
+  for(uint64_t when : event_at)
+    next_event = min(next_event, when);
+}
+
+void CPU_::RUN_EVENTS()
+{
+  while(cycles >= next_event)
   {
-    OPCODE_HANDLER();
-    INTERRUPT_HANDLER();
-    TIMING();
+    int event = 0;
+    for(int i = 1; i < EVENT_COUNT; i++)
+    {
+      if(event_at[i] < event_at[event])
+        event = i;
+    }
+    SCHEDULE((Event) event, NEVER);
+
+    switch(event)
+    {
+      case EVENT_TIMER:
+        SYNC_TIMER();
+        SCHEDULE_TIMER();
+        break;
+      case EVENT_DMA:
+        FINISH_DMA();
+        break;
+    }
   }
 }
 
+//cycles the machine can run from here before STEP's LCD catch up, events or the end of the frame
+//could change anything, 0 when an interrupt is pending. Lockstep lanes and compiled code run an
+//instruction outside STEP only if it ends within this, and leave the rest to STEP
+uint64_t CPU_::HORIZON()
+{
+#ifdef PROFILE
+  return 0; //the profiler counts every instruction in OPCODE_HANDLER
+#endif
+  if(debugger || (IO(IF) & IO(IE) & 0x1F) || next_event <= cycles)
+    return 0;
+
+  //the LCD and the frame count in base clocks, catching up shifts everything since lcd_sync
+  int shift = cgb ? cgb->speed_shift : 0;
+  uint64_t unsynced = cycles - lcd_sync;
+  auto BEFORE = [&](uint64_t at, uint64_t position) -> uint64_t {
+    if(at <= position || ((at - position) << shift) <= unsynced)
+      return 0;
+    return ((at - position) << shift) - unsynced;
+  };
+
+  uint64_t horizon = min(next_event - cycles, BEFORE(FULL_FRAME_FREQ, frame_cycles));
+  if(lcd_enabled)
+  {
+    //the next transition LCD_STEP_T would make
+    uint64_t at = 0;
+    if(IO(LY) >= LCD_HEIGHT)
+      at = ONELINE_FREQ;
+    else if((IO(STAT) & 0x03) == 2)
+      at = SCANLINE_OAM_FREQ;
+    else if((IO(STAT) & 0x03) == 3)
+      at = SCANLINE_OAM_FREQ + SCANLINE_VRAM_FREQ;
+    else if((IO(STAT) & 0x03) == 0)
+      at = ONELINE_FREQ;
+    horizon = min(horizon, BEFORE(at, lcd_cycles));
+  }
+  return horizon;
+}
+
+//STEP's catch up for cycles run outside it, short of the horizon so only the counters move. The
+//instruction STEP runs next may touch the LCD and has to see it where the interpreter would
+void CPU_::SYNC_LCD()
+{
+  int elapsed = cycles - lcd_sync;
+  if(cgb)
+    elapsed >>= cgb->speed_shift;
+  lcd_sync = cycles;
+  frame_cycles += elapsed;
+  if(lcd_enabled)
+    lcd_cycles += elapsed;
+}
+
+template<typename MODEL, typename POLICY>
+bool CPU_::RUN_FRAME_T()
+{
+  while(frame_cycles < FULL_FRAME_FREQ)
+  {
+    if constexpr(POLICY::DEBUG)
+    {
+      if(debugger->SHOULD_BREAK(PC))
+        return false;
+    }
+
+    //where the next instruction starts, the loads mark what they read themselves
+    if constexpr(POLICY::COVERAGE)
+    {
+      if(coverage)
+        COVER_CODE(PC);
+    }
+
+    //compiled code gets the machine first, the instruction it stops at is STEP's. It marks no
+    //coverage, so machines recording it stay on STEP
+    if constexpr(!POLICY::DEBUG && !POLICY::COVERAGE)
+    {
+      if(aot)
+        RUN_COMPILED();
+    }
+
+    STEP_T<MODEL>();
+
+    if constexpr(POLICY::DEBUG)
+    {
+      if(debugger->HIT())
+        return false;
+    }
+  }
+
+  //carry the overshoot of the last instruction into the next frame
+  frame_cycles -= FULL_FRAME_FREQ;
+  return true;
+}
+
+template<typename MODEL>
+bool CPU_::RUN_FRAME_MODEL()
+{
+  //the checks are only compiled into the debug loop, the normal one pays nothing for them
+  if(debugger && debugger->ARMED())
+    return RUN_FRAME_T<MODEL, DebugPolicy>();
+  if(coverage)
+    return RUN_FRAME_T<MODEL, CoveragePolicy>();
+  return RUN_FRAME_T<MODEL, RunPolicy>();
+}
+
+bool CPU_::RUN_FRAME()
+{
+  //one switch a frame picks the loop built for this hardware, DMG loops have no CGB paths in them
+  switch(model)
+  {
+    case MODEL_CGB: return RUN_FRAME_MODEL<CgbModel>();
+    case MODEL_MGB: return RUN_FRAME_MODEL<MgbModel>();
+    case MODEL_CGB_DMG: return RUN_FRAME_MODEL<CgbDmgModel>();
+    default: return RUN_FRAME_MODEL<DmgModel>();
+  }
+}
+
+//for callers that need a frame to be a frame. SHOULD_BREAK would stop on the same PC again
+//without the CONTINUE
+void CPU_::RUN_WHOLE_FRAME()
+{
+  while(!RUN_FRAME())
+    debugger->CONTINUE();
+}
+
 void CPU_::SET_FLAG(BYTE bit)
 {
   AF.lo |= (1 << bit);
@@ -53,8 +398,8 @@ WORD CPU_::GET_WORD()
   RegisterPair WORD_TO_RETURN;
 
   //remember little endianness
-  WORD_TO_RETURN.lo = Space.Space[PC + 1];
-  WORD_TO_RETURN.hi = Space.Space[PC + 2];
+  WORD_TO_RETURN.lo = FETCH(PC + 1);
+  WORD_TO_RETURN.hi = FETCH(PC + 2);
 
   return WORD_TO_RETURN.reg;
 
@@ -62,7 +407,7 @@ WORD CPU_::GET_WORD()
 
 BYTE CPU_::GET_BYTE()
 {
-  return Space.Space[PC + 1];
+  return FETCH(PC + 1);
 }
 
 void CPU_::INTERRUPT_HANDLER()
@@ -70,19 +415,19 @@ void CPU_::INTERRUPT_HANDLER()
   if(!IME)
     return;
 
-  if(*IF & (BYTE) (1 << VBLANK_INTERRUPT)
+  if(IO(IF) & (BYTE) (1 << VBLANK_INTERRUPT)
     && TEST_INTERRUPT_ENABLED(VBLANK_INTERRUPT))
       VBLANK_HANDLE();
-  if(*IF & (BYTE) (1 << LCD_STAT_INTERRUPT)
+  if(IO(IF) & (BYTE) (1 << LCD_STAT_INTERRUPT)
     && TEST_INTERRUPT_ENABLED(LCD_STAT_INTERRUPT))
       LCD_STAT_HANDLE();
-  if(*IF & (BYTE) (1 << TIMER_INTERRUPT)
+  if(IO(IF) & (BYTE) (1 << TIMER_INTERRUPT)
     && TEST_INTERRUPT_ENABLED(TIMER_INTERRUPT))
       TIMER_HANDLE();
-  if(*IF & (BYTE) (1 << SERIAL_INTERRUPT)
+  if(IO(IF) & (BYTE) (1 << SERIAL_INTERRUPT)
     && TEST_INTERRUPT_ENABLED(SERIAL_INTERRUPT))
       SERIAL_HANDLE();
-  if(*IF & (BYTE) (1 << JOYPAD_INTERRUPT)
+  if(IO(IF) & (BYTE) (1 << JOYPAD_INTERRUPT)
     && TEST_INTERRUPT_ENABLED(JOYPAD_INTERRUPT))
       JOYPAD_HANDLE();
 
@@ -110,29 +455,45 @@ void CPU_::JOYPAD_HANDLE()
 
 }
 
-bool CPU_::TEST_INTERRUPT_ENABLED(BYTE INTERRUPT)
+const string &CPU_::SERIAL_OUTPUT()
 {
-  return Space.INTERUPT_ENABLE_REG & (BYTE) (1 << INTERRUPT);
+  return serial_output;
 }
 
-void CPU_::RESET_INTERRUPT(BYTE INTERRUPT)
+uint64_t CPU_::CYCLE_COUNT()
 {
-  *IF &= ~(1 << INTERRUPT);
+  return cycles;
 }
 
-void CPU_::TIMING()
+uint64_t CPU_::INSTRUCTION_COUNT()
 {
-  div_count = cycles - previous_cycle_count;
+  return instructions;
+}
 
-  if(div_count >= (CPU_FREQ / DIV_FREQ))
-  {
-    *DIV_REGISTER += 1;
-    previous_cycle_count = div_count;
-  }
+Registers CPU_::GET_REGISTERS()
+{
+  return {AF.reg, BC.reg, DE.reg, HL.reg, SP, PC};
+}
 
-  if(cycles >= CPU_FREQ)
-  {
-    cycles = 0;
-    previous_cycle_count = 0;
-  }
+//ROM bank mapped at an address, there is no MBC yet so 0x4000 - 0x7FFF is always bank 1
+BYTE CPU_::BANK_OF(WORD address)
+{
+  return address < 0x4000 ? 0 : 1;
+}
+
+#ifdef PROFILE
+Profiler &CPU_::PROFILER()
+{
+  return profiler;
+}
+#endif
+
+bool CPU_::TEST_INTERRUPT_ENABLED(BYTE INTERRUPT)
+{
+  return IO(IE) & (BYTE) (1 << INTERRUPT);
+}
+
+void CPU_::RESET_INTERRUPT(BYTE INTERRUPT)
+{
+  IO(IF) &= ~(1 << INTERRUPT);
 }
@@ -2,7 +2,15 @@
 #define CPU
 
 #include <stdint.h>
+#include <atomic>
 #include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef PROFILE
+#include "profiler.h"
+#endif
 
 #define CARRY_FLAG 4 //'C'
 #define HALFCARRY_FLAG 5 //'H'
@@ -15,6 +23,16 @@
 #define SERIAL_INTERRUPT 3
 #define JOYPAD_INTERRUPT 4
 
+//SET_BUTTONS bits, the low nibble is the direction row and the high one the button row of JOYP
+#define BUTTON_RIGHT 0x01
+#define BUTTON_LEFT 0x02
+#define BUTTON_UP 0x04
+#define BUTTON_DOWN 0x08
+#define BUTTON_A 0x10
+#define BUTTON_B 0x20
+#define BUTTON_SELECT 0x40
+#define BUTTON_START 0x80
+
 using namespace std;
 
 #define WORD uint16_t
@@ -23,29 +41,46 @@ using namespace std;
 #define CPU_FREQ 4194304
 #define DIV_FREQ 16384
 
+//the LCD and frame constants below are in base clock cycles. cycles counts CPU clocks, which a
+//CGB in double speed runs twice as fast, so STEP shifts them down before they reach the LCD
+#define DOUBLE_SPEED_SHIFT 1
+
 #define HBlank_FREQ 204 //GPU_MODE 0
 #define SCANLINE_OAM_FREQ 80 //GPU_MODE 2
-#define SCANLINE_VRAM_FREQ 80 //GPU_MODE 3
+#define SCANLINE_VRAM_FREQ 172 //GPU_MODE 3
 #define ONELINE_FREQ 456
 #define VBlank_FREQ 4560 //GPU_MODE 1
 #define FULL_FRAME_FREQ 70224
 
-union AddressSpace {
-    BYTE Space[0x10000];
+#define LCD_WIDTH 160
+#define LCD_HEIGHT 144
+#define LCD_LINES 154 //including the 10 VBlank lines
 
-    struct {
-        BYTE ROM_BANK1[0x4000];//mapped to 0x0000
-        BYTE ROM_BANK_SWITCH[0x4000]; //mapped to 0x4000
-        BYTE VRAM[0x2000]; //mapped to 0x8000
-        BYTE RAM_BANK_SWITCH[0x2000]; //mapped to 0xA000
-        BYTE MB1[0x1000]; //mapped to 0xC000
-        BYTE MB2[0x1000]; //mapped to 0xD000
-        BYTE EMPTY[0x1E00]; //mapped to 0xE000 NOT USED
-        BYTE SPRITE_ATTRIBUTE_TABLE[0x100]; //mapped to 0xFE00
-        BYTE IO[0x80]; //mapped to 0xFF00, 0xFF0F is interrupt flag
-        BYTE SPECIAL_RAM[0x7F]; //mapped to 0xFF80
-        BYTE INTERUPT_ENABLE_REG; //mapped to 0xFFFF
-    };
+#define PAGE_COUNT 0x100 //the bus is mapped in 256 byte pages
+
+//why a page is kept off the fast path, see UPDATE_PAGE
+#define TRAP_WATCH_READ 0x01
+#define TRAP_WATCH_WRITE 0x02
+#define TRAP_IO 0x04 //page 0xFF, registers with side effects go through the IO handler tables
+#define TRAP_DMA 0x08 //OAM DMA is using the bus, the CPU only reaches the 0xFF page
+#define TRAP_SHARED 0x10 //backed by a MemoryPage another machine also holds, written on a copy
+#define TRAP_HASH 0x20 //STATE_HASH has an up to date hash of the page, a write makes it stale
+#define TRAP_READ (TRAP_WATCH_READ | TRAP_IO | TRAP_DMA)
+#define TRAP_WRITE (TRAP_WATCH_WRITE | TRAP_IO | TRAP_DMA | TRAP_SHARED | TRAP_HASH)
+
+#define DMA_CYCLES 644 //a startup M-cycle, then 160 bytes at one per M-cycle
+
+#define NEVER UINT64_MAX //event_at for events that aren't scheduled
+
+#define CGB_FLAG_ADDRESS 0x0143 //cartridge header, bit 7 set for CGB aware games
+#define WRAM_BANKS 8
+#define HDMA_BLOCK_CYCLES 32 //CPU stall per 16 bytes, doubled in double speed
+
+//a page of ROM, cartridge RAM or WRAM, shared between a machine and its forks until one of them
+//writes to it, see memory.cpp
+struct MemoryPage {
+    atomic<int> refs{1};
+    BYTE data[0x100] = {};
 };
 
 union RegisterPair {
@@ -57,60 +92,390 @@ union RegisterPair {
     };
 };
 
-class CPU_ {
- private:
+struct Registers {
+    WORD AF;
+    WORD BC;
+    WORD DE;
+    WORD HL;
+    WORD SP;
+    WORD PC;
+};
 
-  int cycles;
+class Debugger;
+struct AotProgram;
 
-  WORD address_bus;
-  BYTE data_bus;
+//things that happen at a known future cycle rather than being polled every instruction
+enum Event {
+    EVENT_TIMER, //TIMA overflow
+    EVENT_DMA, //OAM DMA completion
+    EVENT_COUNT
+};
 
-  RegisterPair AF;
+//run loop policies, the debugger checks only exist in the DebugPolicy instantiation and ROM
+//coverage is only recorded by the loops that can have it on
+struct RunPolicy {
+    static constexpr bool DEBUG = false;
+    static constexpr bool COVERAGE = false;
+};
 
-  //general purpose registers
-  RegisterPair BC;
-  RegisterPair DE;
-  RegisterPair HL;
+struct CoveragePolicy {
+    static constexpr bool DEBUG = false;
+    static constexpr bool COVERAGE = true;
+};
+
+struct DebugPolicy {
+    static constexpr bool DEBUG = true;
+    static constexpr bool COVERAGE = true;
+};
+
+enum Model {
+    MODEL_DMG,
+    MODEL_MGB, //Game Boy Pocket, a DMG with different boot state
+    MODEL_CGB,
+    MODEL_CGB_DMG, //CGB hardware running a DMG game in compatibility mode
+    MODEL_AUTO //DMG or CGB from the cartridge header
+};
 
-  WORD SP; //stack pointer
-  WORD PC; //program counter
+//hardware models the core is specialised on, CGB decides whether the CGB paths exist at all
+struct DmgModel {
+    static constexpr Model MODEL = MODEL_DMG;
+    static constexpr bool CGB = false;
+};
 
-  AddressSpace Space;
+struct MgbModel {
+    static constexpr Model MODEL = MODEL_MGB;
+    static constexpr bool CGB = false;
+};
 
-  BYTE* IF = &Space.Space[0xFF0F];
-  BYTE* LCD_CONTROL = &Space.Space[0xFF40];
-  BYTE* TIMER_COUNTER = &Space.Space[0xFF05];
-  BYTE* TIMER_MODULO = &Space.Space[0xFF06];
-  BYTE* TIMER_CONTROL = &Space.Space[0xFF07];
+struct CgbModel {
+    static constexpr Model MODEL = MODEL_CGB;
+    static constexpr bool CGB = true;
+};
 
-  BYTE* DIV_REGISTER = &Space.Space[0xFF04];
-  int previous_cycle_count = 0;
-  int div_count = 0;
+struct CgbDmgModel {
+    static constexpr Model MODEL = MODEL_CGB_DMG;
+    static constexpr bool CGB = false;
+};
 
-  bool IME = true;
+//STATE_HASH's per page hashes, slots 0x80 - 0xDF by bus page then CGB VRAM bank 1 and WRAM
+//banks 2 - 7. Only allocated once something asks for a hash
+#define HASH_SLOTS 0x180
 
-  //PPU stuff
-  BYTE* LCDC = &Space.Space[0xFF40];
-  BYTE* STAT = &Space.Space[0xFF41];
-  BYTE* SCY = &Space.Space[0xFF42];
-  BYTE* LY = &Space.Space[0xFF44];
-  BYTE* LYC = &Space.Space[0xFF45];
-  BYTE* WY = &Space.Space[0xFF4A];
-  BYTE* WX = &Space.Space[0xFF4B];
-  BYTE* BGP = &Space.Space[0xFF47];
-  BYTE* OBP0 = &Space.Space[0xFF48];
-  BYTE* OBP1 = &Space.Space[0xFF49];
-  BYTE* DMA = &Space.Space[0xFF46];
+struct HashState {
+    uint64_t pages[HASH_SLOTS] = {};
+    bool dirty[HASH_SLOTS] = {};
+    WORD dirty_slots[HASH_SLOTS] = {}; //the slots with dirty set, in no particular order
+    int dirty_count = 0;
+    uint64_t combined = 0; //XOR of pages
+};
+
+//ENABLE_COVERAGE's record by bus address, where instructions started and what the loads read. A
+//byte each so marking is a plain store, setting a bit costs the tightest loops several percent.
+//The first 0x8000 are the fixed ROM banks byte for byte, there is no MBC yet. Only allocated for
+//machines recording it
+#define ROM_BANK_SIZE 0x4000
+#define ROM_BANKS 2
+
+struct CoverageState {
+    BYTE executed[0x10000] = {};
+    BYTE read[0x10000] = {};
+};
+
+//WRITE_COVERAGE's file is this header, then a bit per byte of every ROM bank (bit n & 7 of byte
+//n >> 3) for where instructions started, then the same for what was read
+#define COVERAGE_MAGIC 0x56434247 //"GBCV"
+#define COVERAGE_VERSION 1
+
+struct CoverageHeader {
+    uint32_t magic = COVERAGE_MAGIC;
+    uint32_t version = COVERAGE_VERSION;
+    uint64_t rom_hash = 0; //AOT_ROM_HASH of the ROM it was recorded on, see aot.h
+    uint32_t banks = ROM_BANKS;
+    uint32_t bank_size = ROM_BANK_SIZE;
+};
+
+//state only a machine in CGB mode has, DMG instances don't allocate it
+struct CgbState {
+    int speed_shift = 0; //DOUBLE_SPEED_SHIFT in double speed
+    BYTE vram_bank1[0x2000] = {};
+    BYTE wram_banks[WRAM_BANKS - 2][0x1000] = {}; //2 - 7, banks 0 and 1 are MB1 and MB2
+    BYTE bg_palettes[64] = {}; //8 palettes of 4 RGB555 colours
+    BYTE obj_palettes[64] = {};
+    WORD hdma_source = 0;
+    WORD hdma_destination = 0;
+    int hdma_blocks = 0; //16 byte blocks left of an HBlank transfer, 0 if none
+    BYTE hdma_status = 0xFF; //HDMA5 with no transfer running, 0x80 | blocks left - 1 after a cancel
+    WORD colour_framebuffer[LCD_HEIGHT][LCD_WIDTH] = {}; //RGB555
+};
+
+//ROM pages loaded once and inserted into any number of machines, which all hold the same pages
+//instead of a copy each, see memory.cpp
+class RomImage {
+ friend class CPU_;
+
+ private:
+  MemoryPage *pages[0x80] = {};
 
  public:
+  RomImage(const BYTE *data, size_t size); //the two fixed banks, anything past 0x8000 is ignored
+  RomImage(const RomImage &) = delete;
+  RomImage &operator=(const RomImage &) = delete;
+  ~RomImage();
+};
+
+/*
+ * Per instance layout, in order of how often the hot loop touches it:
+ *
+ *   first cache line     registers, cycle counters and next_event, everything STEP looks at
+ *   bus tables           read_pages/write_pages (4 KB) then the slow path's maps and traps (4.3 KB)
+ *   memory               page pointers (2 KB), VRAM (8 KB), 0xFE00 - 0xFFFF (512 B)
+ *   framebuffer          23 KB, the biggest single part
+ *
+ * which is about 42 KB. ROM, cartridge RAM and WRAM are MemoryPages outside the instance: ROM
+ * inserted from a RomImage and everything held by a fork are shared, so a machine only adds the
+ * 256 byte pages it has written to. IO handlers are per model tables shared by every machine,
+ * and CGB only state is allocated for CGB machines. RESIDENT_BYTES counts it all for one machine.
+ *
+ * IO registers are plain bytes in high, IO(LY) and friends are constant offsets from this.
+ */
+class alignas(64) CPU_ {
+ friend class Debugger;
+ friend class Lockstep;
+
+ private:
+
+  RegisterPair AF = {};
+
+  //general purpose registers
+  RegisterPair BC = {};
+  RegisterPair DE = {};
+  RegisterPair HL = {};
+
+  WORD SP = 0; //stack pointer
+  WORD PC = 0; //program counter
+
+  bool IME = true;
+  int frame_cycles = 0; //cycles run into the current frame
+
+  uint64_t cycles = 0; //since power on, never wraps
+  uint64_t instructions = 0;
+  uint64_t next_event = NEVER; //earliest of event_at, the only thing STEP checks
+  uint64_t lcd_sync = 0; //cycle the LCD has been run up to
+  int lcd_cycles = 0; //cycles into the current scanline
+
+  //memory bus, a null page sends the access to READ_SLOW/WRITE_SLOW
+  BYTE* read_pages[PAGE_COUNT] = {};
+  BYTE* write_pages[PAGE_COUNT] = {};
+  BYTE* read_map[PAGE_COUNT] = {}; //what backs each page when it isn't trapped
+  BYTE* write_map[PAGE_COUNT] = {};
+  BYTE page_traps[PAGE_COUNT] = {};
+
+  MemoryPage *memory[PAGE_COUNT] = {}; //ROM, cartridge RAM and WRAM pages, null for the others
+  BYTE vram[0x2000] = {}; //0x8000, bank 0 on a CGB
+  BYTE high[0x200] = {}; //0xFE00 - 0xFFFF: OAM, unused, IO registers, HRAM and IE
+
+  Debugger *debugger = nullptr;
+  const AotProgram *aot = nullptr; //compiled from the ROM this machine holds
+
+  //IO page handlers by low address byte, a null entry is plain memory (HRAM, most registers)
+  typedef BYTE (CPU_::*IoRead)(WORD address);
+  typedef void (CPU_::*IoWrite)(WORD address, BYTE value);
+  struct IoHandlers {
+      IoRead read[0x100] = {};
+      IoWrite write[0x100] = {};
+  };
+  const IoHandlers *io = nullptr; //DMG_IO or CGB_IO
+  static const IoHandlers &DMG_IO();
+  static const IoHandlers &CGB_IO();
+
+  //addresses of the registers the core reads directly, for IO()
+  enum IoRegister : WORD {
+      JOYP = 0xFF00,
+      SB = 0xFF01,
+      SC = 0xFF02,
+      DIV_REGISTER = 0xFF04,
+      TIMER_COUNTER = 0xFF05,
+      TIMER_MODULO = 0xFF06,
+      TIMER_CONTROL = 0xFF07,
+      IF = 0xFF0F,
+      LCDC = 0xFF40,
+      STAT = 0xFF41,
+      SCY = 0xFF42,
+      SCX = 0xFF43,
+      LY = 0xFF44,
+      LYC = 0xFF45,
+      DMA = 0xFF46,
+      BGP = 0xFF47,
+      OBP0 = 0xFF48,
+      OBP1 = 0xFF49,
+      WY = 0xFF4A,
+      WX = 0xFF4B,
+      //CGB, all of these stay unused on a DMG
+      KEY1 = 0xFF4D,
+      VBK = 0xFF4F,
+      HDMA1 = 0xFF51,
+      HDMA2 = 0xFF52,
+      HDMA3 = 0xFF53,
+      HDMA4 = 0xFF54,
+      HDMA5 = 0xFF55,
+      BCPS = 0xFF68,
+      OCPS = 0xFF6A,
+      SVBK = 0xFF70,
+      IE = 0xFFFF
+  };
+  BYTE &IO(WORD address) { return high[address - 0xFE00]; }
+
+  void MAP_PAGES();
+  static bool PAGED(int page); //backed by a MemoryPage rather than vram/high
+  BYTE *UNPAGED(int page);
+  void SHARE_TRAPS();
+  void SHARE_PAGES(CPU_ &other);
+  BYTE *OWN_PAGE(int page);
+  void REBUILD_BUS();
+  int HASH_SLOT(int page);
+  const BYTE *SLOT_DATA(int slot);
+  void DIRTY_SLOT(int slot);
+  void DIRTY_PAGE(int page);
+  void ARM_HASH_TRAPS();
+  void MAP_IO();
+  BYTE IO_READ(WORD address);
+  void IO_WRITE(WORD address, BYTE value);
+  void UPDATE_PAGE(int page);
+  BYTE READ_SLOW(WORD address, bool fetch);
+  void WRITE_SLOW(WORD address, BYTE value);
+
+  template<typename MODEL, typename POLICY>
+  bool RUN_FRAME_T();
+  template<typename MODEL>
+  bool RUN_FRAME_MODEL();
+  template<typename MODEL>
+  void STEP_T();
+  template<typename MODEL>
+  void LCD_STEP_T(int elapsed);
+
+  BYTE buttons = 0; //held, BUTTON_* bits
+
+  Model requested_model = MODEL_AUTO;
+  Model model = MODEL_DMG;
+  unique_ptr<CgbState> cgb; //only in MODEL_CGB
+  unique_ptr<HashState> hashing; //from the first STATE_HASH on
+  unique_ptr<CoverageState> coverage; //from ENABLE_COVERAGE on
+
+  uint64_t event_at[EVENT_COUNT] = {NEVER, NEVER};
+
+  //DIV is the top of a 16 bit counter that runs from div_base, TIMA is caught up on access
+  uint64_t div_base = 0;
+  uint64_t tima_sync = 0; //cycle TIMER_COUNTER was last brought up to date
+
+  bool lcd_enabled = false;
+  int window_line = 0;
+  uint64_t frame_count = 0;
+  string serial_output; //every byte shifted out over the link cable
+
+#ifdef PROFILE
+  Profiler profiler;
+#endif
+  BYTE framebuffer[LCD_HEIGHT][LCD_WIDTH] = {}; //shades 0 (white) - 3 (black), colour indexes on a CGB
+
+  void RENDER_SCANLINE_CGB(); //RENDER_SCANLINE is the DMG one
+  const BYTE *TILE_DATA(WORD tile_address, int bank);
+
+  void NEXT_LINE();
+  void SET_LCD_MODE(BYTE mode);
+  void COMPARE_LY();
+
+  //IO registers with side effects
+  BYTE READ_JOYP(WORD address);
+  void WRITE_JOYP(WORD address, BYTE value);
+  void WRITE_SC(WORD address, BYTE value);
+  void WRITE_DIV(WORD address, BYTE value);
+  BYTE READ_IF(WORD address);
+  void WRITE_LCDC(WORD address, BYTE value);
+  void WRITE_STAT(WORD address, BYTE value);
+  void WRITE_LY(WORD address, BYTE value);
+  void WRITE_LYC(WORD address, BYTE value);
+  void WRITE_DMA(WORD address, BYTE value);
+  void FINISH_DMA();
+
+  //CGB registers
+  void DETECT_MODEL();
+  void ENABLE_CGB();
+  void MAP_BANKS();
+  BYTE READ_KEY1(WORD address);
+  void WRITE_KEY1(WORD address, BYTE value);
+  BYTE READ_VBK(WORD address);
+  void WRITE_VBK(WORD address, BYTE value);
+  BYTE READ_SVBK(WORD address);
+  void WRITE_SVBK(WORD address, BYTE value);
+  BYTE READ_PALETTE(WORD address);
+  void WRITE_PALETTE(WORD address, BYTE value);
+  void WRITE_HDMA_ADDRESS(WORD address, BYTE value);
+  BYTE READ_HDMA5(WORD address);
+  void WRITE_HDMA5(WORD address, BYTE value);
+  void COPY_HDMA_BLOCK();
+  void SWITCH_SPEED();
+
+  void SCHEDULE(Event event, uint64_t at);
+  void RUN_EVENTS();
+  uint64_t HORIZON();
+  void SYNC_LCD();
+
+  //superinstructions, see opcode.cpp
+  bool MATCH_IDIOM(const BYTE *idiom);
+  bool FUSED_COPY(bool from_hl);
+  bool FUSED_POLL();
+
+  //ROM coverage, see coverage.cpp
+  BYTE READ_DATA(WORD address); //READ for the loads, the reads coverage records
+  void COVER_CODE(WORD address);
+  void COVER_DATA(WORD address, int length);
+
+  //compiled ROM code, see aot.cpp
+  void FIND_AOT();
+  void RUN_COMPILED();
+
+  //timer
+  void SYNC_TIMER();
+  void TICK_TIMA(uint64_t ticks);
+  void SCHEDULE_TIMER();
+  BYTE READ_DIV(WORD address);
+  BYTE READ_TIMA(WORD address);
+  void WRITE_TIMA(WORD address, BYTE value);
+  void WRITE_TMA(WORD address, BYTE value);
+  BYTE READ_TAC(WORD address);
+  void WRITE_TAC(WORD address, BYTE value);
+
+ public:
+  CPU_();
+  CPU_(const CPU_ &) = delete; //the bus tables point into this instance
+  CPU_ &operator=(const CPU_ &) = delete;
+  ~CPU_();
 
   void INIT_PC();
+  void INIT_POST_BOOT();
+  void SET_MODEL(Model hardware); //before LOAD_ROM, MODEL_AUTO goes by the cartridge header
+  Model GET_MODEL();
 
   void OPCODE_HANDLER();
 
-  static void LOAD_BOOTROM(ifstream &FILE, int FILE_SIZE);
+  void LOAD_BOOTROM(ifstream &FILE, int FILE_SIZE);
+  void LOAD_ROM(ifstream &FILE, int FILE_SIZE);
+  void LOAD_ROM(const BYTE *data, size_t size);
+  void LOAD_ROM(const RomImage &rom); //shares the image's pages rather than copying them
 
   void RUN();
+  bool RUN_FRAME(); //false if the debugger stopped it part way, call again to resume
+  void RUN_WHOLE_FRAME(); //to the end of the frame, resuming past anything the debugger stops on
+  void STEP(); //one instruction, or one fused idiom when nothing could happen part way through
+
+  BYTE READ(WORD address);
+  void WRITE(WORD address, BYTE value);
+  BYTE FETCH(WORD address); //opcodes and operands, doesn't trigger read watchpoints
+  BYTE PEEK(WORD address); //no side effects at all, for tools
+  void PEEK_BLOCK(WORD address, BYTE *out, size_t length);
+  void SET_PAGE_TRAP(int page, BYTE trap, bool enabled);
+
+  void ATTACH_DEBUGGER(Debugger *attached);
 
   void INTERRUPT_HANDLER();
 
@@ -171,10 +536,81 @@ class CPU_ {
 
   bool TEST_INTERRUPT_ENABLED(BYTE INTERRUPT);
 
-  void TIMING();
+  const string &SERIAL_OUTPUT();
+
+  Registers GET_REGISTERS();
+  BYTE BANK_OF(WORD address);
+
+#ifdef PROFILE
+  Profiler &PROFILER();
+#endif
+
+  //LCD
+  void RENDER_SCANLINE();
+  WORD TILE_ADDRESS(BYTE index);
+  BYTE TILE_PIXEL(const BYTE *tile, int row, int column);
+  const BYTE *FRAMEBUFFER();
+  const WORD *COLOUR_FRAMEBUFFER();
+  bool IS_CGB();
+  uint64_t FRAME_COUNT();
+  uint64_t CYCLE_COUNT();
+  uint64_t INSTRUCTION_COUNT();
+
+  void SET_BUTTONS(BYTE pressed);
+
+  //everything needed to resume, see state.cpp
+  void SAVE_STATE(vector<BYTE> &state);
+  bool LOAD_STATE(const vector<BYTE> &state);
+  //a machine in the same state sharing this one's memory pages until either writes to them
+  unique_ptr<CPU_> FORK();
+  //equal for machines that will run identically from here, only rehashes pages written since
+  //the last call. Counters that only ever grow (cycles, frames) aren't part of it
+  uint64_t STATE_HASH();
+  //the instance, CGB, hash and coverage state, and memory pages nobody else holds
+  size_t RESIDENT_BYTES();
+
+  //records which ROM bytes RUN_FRAME executes and reads from here on, see coverage.cpp
+  void ENABLE_COVERAGE();
+  bool WRITE_COVERAGE(const string &path);
 
   void RESET_INTERRUPT(BYTE INTERRUPT);
 };
 
+inline BYTE CPU_::READ(WORD address)
+{
+  BYTE *page = read_pages[address >> 8];
+  if(page)
+    return page[address & 0xFF];
+  return READ_SLOW(address, false);
+}
+
+inline void CPU_::WRITE(WORD address, BYTE value)
+{
+  BYTE *page = write_pages[address >> 8];
+  if(page)
+    page[address & 0xFF] = value;
+  else
+    WRITE_SLOW(address, value);
+}
+
+inline BYTE CPU_::READ_DATA(WORD address)
+{
+  if(coverage)
+    coverage->read[address] = 1;
+  return READ(address);
+}
+
+inline void CPU_::COVER_CODE(WORD address)
+{
+  coverage->executed[address] = 1;
+}
+
+inline BYTE CPU_::FETCH(WORD address)
+{
+  BYTE *page = read_pages[address >> 8];
+  if(page)
+    return page[address & 0xFF];
+  return READ_SLOW(address, true);
+}
 
 #endif //CPU
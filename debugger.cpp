@@ -0,0 +1,417 @@
+#include "debugger.h"
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+Debugger::~Debugger()
+{
+  DETACH();
+}
+
+void Debugger::ATTACH(CPU_ *machine)
+{
+  DETACH();
+  cpu = machine;
+  cpu->ATTACH_DEBUGGER(this);
+  REFRESH_TRAPS();
+}
+
+void Debugger::DETACH()
+{
+  if(!cpu)
+    return;
+
+  for(int page = 0; page < PAGE_COUNT; page++)
+    cpu->SET_PAGE_TRAP(page, TRAP_WATCH_READ | TRAP_WATCH_WRITE, false);
+  cpu->ATTACH_DEBUGGER(nullptr);
+  cpu = nullptr;
+}
+
+bool Debugger::ARMED()
+{
+  return breakpoint_count || !watchpoints.empty() || temporary_breakpoint >= 0;
+}
+
+void Debugger::ADD_BREAKPOINT(WORD address)
+{
+  if(!(exec_flags[address] & EXEC_BREAKPOINT))
+    breakpoint_count++;
+  exec_flags[address] |= EXEC_BREAKPOINT;
+  exec_flags[address] &= ~EXEC_CONDITION;
+  conditions.erase(address);
+}
+
+bool Debugger::ADD_BREAKPOINT(WORD address, const string &condition, string &error)
+{
+  BreakCondition compiled;
+  if(!compiled.COMPILE(condition, error))
+    return false;
+
+  ADD_BREAKPOINT(address);
+  conditions[address] = compiled;
+  exec_flags[address] |= EXEC_CONDITION;
+  return true;
+}
+
+bool Debugger::ADD_BREAKPOINT(const string &condition, string &error)
+{
+  BreakCondition compiled;
+  if(!compiled.COMPILE(condition, error))
+    return false;
+
+  //the PC term decides where the check goes, everywhere else costs nothing
+  if(compiled.PC_ANCHOR() < 0)
+  {
+    error = "condition needs a PC==ADDR term joined with &&";
+    return false;
+  }
+  return ADD_BREAKPOINT(compiled.PC_ANCHOR(), condition, error);
+}
+
+void Debugger::REMOVE_BREAKPOINT(WORD address)
+{
+  if(exec_flags[address] & EXEC_BREAKPOINT)
+    breakpoint_count--;
+  exec_flags[address] &= ~(EXEC_BREAKPOINT | EXEC_CONDITION);
+  conditions.erase(address);
+}
+
+void Debugger::ADD_WATCHPOINT(WORD start, WORD end, BYTE kinds)
+{
+  watchpoints.push_back({start, end, kinds, false, {}});
+  REFRESH_TRAPS();
+}
+
+bool Debugger::ADD_WATCHPOINT(WORD start, WORD end, BYTE kinds, const string &condition, string &error)
+{
+  Watchpoint watch = {start, end, kinds, true, {}};
+  if(!watch.condition.COMPILE(condition, error))
+    return false;
+
+  watchpoints.push_back(watch);
+  REFRESH_TRAPS();
+  return true;
+}
+
+void Debugger::REMOVE_WATCHPOINT(WORD start)
+{
+  for(size_t i = 0; i < watchpoints.size(); i++)
+  {
+    if(watchpoints[i].start == start)
+    {
+      watchpoints.erase(watchpoints.begin() + i);
+      break;
+    }
+  }
+  REFRESH_TRAPS();
+}
+
+void Debugger::CLEAR()
+{
+  for(auto &flags : exec_flags)
+    flags = 0;
+  breakpoint_count = 0;
+  watchpoints.clear();
+  conditions.clear();
+  temporary_breakpoint = -1;
+  REFRESH_TRAPS();
+}
+
+void Debugger::REFRESH_TRAPS()
+{
+  BYTE page_traps[PAGE_COUNT] = {};
+
+  for(int address = 0; address < 0x10000; address++)
+    exec_flags[address] &= ~EXEC_WATCH;
+
+  for(const Watchpoint &watch : watchpoints)
+  {
+    for(int page = watch.start >> 8; page <= watch.end >> 8; page++)
+    {
+      if(watch.kinds & WATCH_READ)
+        page_traps[page] |= TRAP_WATCH_READ;
+      if(watch.kinds & WATCH_WRITE)
+        page_traps[page] |= TRAP_WATCH_WRITE;
+    }
+
+    if(watch.kinds & WATCH_EXECUTE)
+    {
+      for(int address = watch.start; address <= watch.end; address++)
+        exec_flags[address] |= EXEC_WATCH;
+    }
+  }
+
+  if(!cpu)
+    return;
+
+  for(int page = 0; page < PAGE_COUNT; page++)
+  {
+    cpu->SET_PAGE_TRAP(page, TRAP_WATCH_READ, page_traps[page] & TRAP_WATCH_READ);
+    cpu->SET_PAGE_TRAP(page, TRAP_WATCH_WRITE, page_traps[page] & TRAP_WATCH_WRITE);
+  }
+}
+
+bool Debugger::SHOULD_BREAK(WORD pc)
+{
+  if(resuming)
+  {
+    resuming = false;
+    return false;
+  }
+
+  if(pc == temporary_breakpoint)
+  {
+    temporary_breakpoint = -1;
+    reason = BREAK_STEP;
+    return true;
+  }
+
+  BYTE flags = exec_flags[pc];
+  if(!flags)
+    return false;
+
+  if((flags & EXEC_BREAKPOINT) && (!(flags & EXEC_CONDITION) || conditions[pc].EVALUATE(*cpu)))
+  {
+    reason = BREAK_BREAKPOINT;
+    return true;
+  }
+
+  if(flags & EXEC_WATCH)
+  {
+    for(const Watchpoint &watch : watchpoints)
+    {
+      if((watch.kinds & WATCH_EXECUTE) && pc >= watch.start && pc <= watch.end &&
+         (!watch.conditional || watch.condition.EVALUATE(*cpu)))
+      {
+        reason = BREAK_WATCH_EXECUTE;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool Debugger::HIT()
+{
+  if(!watch_hit)
+    return false;
+
+  //stop after the instruction that did the access, resume from the next one
+  watch_hit = false;
+  return true;
+}
+
+void Debugger::ON_ACCESS(WORD address, BYTE kind)
+{
+  //the whole page is trapped, only stop for the watched bytes
+  for(const Watchpoint &watch : watchpoints)
+  {
+    if((watch.kinds & kind) && address >= watch.start && address <= watch.end &&
+       (!watch.conditional || watch.condition.EVALUATE(*cpu)))
+    {
+      watch_hit = true;
+      watch_address = address;
+      reason = kind == WATCH_READ ? BREAK_WATCH_READ : BREAK_WATCH_WRITE;
+      return;
+    }
+  }
+}
+
+void Debugger::STEP()
+{
+  cpu->STEP();
+  if(!watch_hit)
+    reason = BREAK_STEP;
+  watch_hit = false;
+}
+
+bool Debugger::STEP_OVER()
+{
+  Registers regs = cpu->GET_REGISTERS();
+  BYTE opcode = cpu->PEEK(regs.PC);
+
+  int length = 0;
+  if(opcode == 0xCD || (opcode & 0xE7) == 0xC4) //CALL nn and CALL cc,nn
+    length = 3;
+  else if((opcode & 0xC7) == 0xC7) //RST
+    length = 1;
+
+  if(!length)
+  {
+    STEP();
+    return false;
+  }
+
+  temporary_breakpoint = (WORD) (regs.PC + length);
+  CONTINUE();
+  return true;
+}
+
+void Debugger::CONTINUE()
+{
+  resuming = true;
+}
+
+BreakReason Debugger::REASON()
+{
+  return reason;
+}
+
+WORD Debugger::WATCH_ADDRESS()
+{
+  return watch_address;
+}
+
+//the rest of the line after skipping some words, for conditions
+static string AFTER(const string &line, int words)
+{
+  size_t position = 0;
+  for(int i = 0; i < words; i++)
+  {
+    position = line.find_first_not_of(" \t", position);
+    position = line.find_first_of(" \t", position);
+  }
+  position = line.find_first_not_of(" \t", position);
+  return position == string::npos ? "" : line.substr(position);
+}
+
+static void PRINT_REGISTERS(ostream &out, CPU_ *cpu)
+{
+  Registers regs = cpu->GET_REGISTERS();
+  char line[96];
+  snprintf(line, sizeof(line), "AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X PC=%04X  [PC]=%02X",
+           regs.AF, regs.BC, regs.DE, regs.HL, regs.SP, regs.PC, cpu->PEEK(regs.PC));
+  out << line << endl;
+}
+
+void Debugger::CONSOLE(istream &in, ostream &out, long max_frames)
+{
+  static const char *REASONS[] = {"", "breakpoint", "step", "read watchpoint", "write watchpoint", "execute watchpoint"};
+  long frames = 0;
+  string line;
+
+  PRINT_REGISTERS(out, cpu);
+  out << "> " << flush;
+
+  while(getline(in, line))
+  {
+    istringstream args(line);
+    string command;
+    string first;
+    string second;
+    args >> command >> first >> second;
+
+    try
+    {
+      bool run = false;
+      string error;
+
+      if(command == "q")
+        break;
+      else if(command == "b")
+      {
+        //b ADDR [CONDITION]
+        string condition = AFTER(line, 2);
+        if(condition.empty())
+          ADD_BREAKPOINT(stoul(first, nullptr, 16));
+        else if(!ADD_BREAKPOINT(stoul(first, nullptr, 16), condition, error))
+          out << "bad condition: " << error << endl;
+      }
+      else if(command == "bc")
+      {
+        //bc PC==ADDR && ...
+        if(!ADD_BREAKPOINT(AFTER(line, 1), error))
+          out << "bad condition: " << error << endl;
+      }
+      else if(command == "d")
+        REMOVE_BREAKPOINT(stoul(first, nullptr, 16));
+      else if(command == "w")
+      {
+        //w START[-END] [rwx [CONDITION]]
+        size_t dash = first.find('-');
+        WORD start = stoul(first.substr(0, dash), nullptr, 16);
+        WORD end = dash == string::npos ? start : stoul(first.substr(dash + 1), nullptr, 16);
+        BYTE kinds = 0;
+        for(char kind : second.empty() ? string("w") : second)
+          kinds |= kind == 'r' ? WATCH_READ : kind == 'w' ? WATCH_WRITE : kind == 'x' ? WATCH_EXECUTE : 0;
+        string condition = AFTER(line, 3);
+        if(condition.empty())
+          ADD_WATCHPOINT(start, end, kinds);
+        else if(!ADD_WATCHPOINT(start, end, kinds, condition, error))
+          out << "bad condition: " << error << endl;
+      }
+      else if(command == "dw")
+        REMOVE_WATCHPOINT(stoul(first, nullptr, 16));
+      else if(command == "s")
+      {
+        STEP();
+        PRINT_REGISTERS(out, cpu);
+      }
+      else if(command == "n")
+      {
+        run = STEP_OVER();
+        if(!run)
+          PRINT_REGISTERS(out, cpu);
+      }
+      else if(command == "c")
+      {
+        CONTINUE();
+        run = true;
+      }
+      else if(command == "r")
+        PRINT_REGISTERS(out, cpu);
+      else if(command == "x")
+      {
+        WORD address = stoul(first, nullptr, 16);
+        int count = second.empty() ? 16 : stoi(second);
+        for(int i = 0; i < count; i++)
+        {
+          char text[16];
+          if(i % 16 == 0)
+          {
+            snprintf(text, sizeof(text), "%s%04X:", i ? "\n" : "", (WORD) (address + i));
+            out << text;
+          }
+          snprintf(text, sizeof(text), " %02X", cpu->PEEK(address + i));
+          out << text;
+        }
+        out << endl;
+      }
+      else if(!command.empty())
+        out << "b ADDR [COND], bc COND, d ADDR, w START[-END] [rwx [COND]], dw START, s, n, c, r, x ADDR [N], q" << endl;
+
+      if(run)
+      {
+        bool stopped = false;
+        while(frames < max_frames && !stopped)
+        {
+          stopped = !cpu->RUN_FRAME();
+          if(!stopped)
+            frames++;
+        }
+
+        if(stopped)
+        {
+          out << "stopped: " << REASONS[reason];
+          if(reason == BREAK_WATCH_READ || reason == BREAK_WATCH_WRITE)
+          {
+            char address[8];
+            snprintf(address, sizeof(address), " %04X", watch_address);
+            out << address;
+          }
+          out << endl;
+        }
+        else
+          out << "frame limit reached" << endl;
+        PRINT_REGISTERS(out, cpu);
+      }
+    }
+    catch(const exception &)
+    {
+      out << "bad argument" << endl;
+    }
+
+    out << "> " << flush;
+  }
+}
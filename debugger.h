@@ -0,0 +1,97 @@
+#ifndef _DEBUGGER_H_
+#define _DEBUGGER_H_
+
+#include "condition.h"
+#include "cpu.h"
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define WATCH_READ 0x01
+#define WATCH_WRITE 0x02
+#define WATCH_EXECUTE 0x04
+
+//per address flags for the PC check
+#define EXEC_BREAKPOINT 0x01
+#define EXEC_WATCH 0x02
+#define EXEC_CONDITION 0x04 //the breakpoint only stops when its condition holds
+
+enum BreakReason {
+    BREAK_NONE,
+    BREAK_BREAKPOINT,
+    BREAK_STEP,
+    BREAK_WATCH_READ,
+    BREAK_WATCH_WRITE,
+    BREAK_WATCH_EXECUTE
+};
+
+struct Watchpoint {
+    WORD start;
+    WORD end; //inclusive
+    BYTE kinds;
+    bool conditional = false;
+    BreakCondition condition;
+};
+
+/*
+ * Breakpoints, step/step over and read/write/execute watchpoints.
+ *
+ * Nothing is checked unless ARMED(), then CPU_::RUN_FRAME switches to the DebugPolicy loop.
+ * Read/write watchpoints don't add a check to every access either, the pages they cover are
+ * trapped so only accesses to those pages reach ON_ACCESS through the bus slow path.
+ * Conditions are compiled when set and only evaluated once the PC flag or page trap has fired.
+ */
+class Debugger {
+ private:
+  CPU_ *cpu = nullptr;
+
+  vector<BYTE> exec_flags = vector<BYTE>(0x10000);
+  int breakpoint_count = 0;
+  vector<Watchpoint> watchpoints;
+  unordered_map<WORD, BreakCondition> conditions;
+
+  int temporary_breakpoint = -1; //step over
+  bool resuming = false; //don't stop on the PC we are resuming from
+  bool watch_hit = false;
+
+  BreakReason reason = BREAK_NONE;
+  WORD watch_address = 0;
+
+  void REFRESH_TRAPS();
+
+ public:
+  ~Debugger();
+
+  void ATTACH(CPU_ *machine);
+  void DETACH();
+
+  bool ARMED();
+
+  void ADD_BREAKPOINT(WORD address);
+  bool ADD_BREAKPOINT(WORD address, const string &condition, string &error);
+  bool ADD_BREAKPOINT(const string &condition, string &error); //needs a top level PC==n term
+  void REMOVE_BREAKPOINT(WORD address);
+  void ADD_WATCHPOINT(WORD start, WORD end, BYTE kinds);
+  bool ADD_WATCHPOINT(WORD start, WORD end, BYTE kinds, const string &condition, string &error);
+  void REMOVE_WATCHPOINT(WORD start);
+  void CLEAR();
+
+  //run loop hooks
+  bool SHOULD_BREAK(WORD pc);
+  bool HIT();
+  void ON_ACCESS(WORD address, BYTE kind);
+
+  void STEP();
+  bool STEP_OVER(); //true if it set a temporary breakpoint and the machine needs to run on
+  void CONTINUE();
+
+  BreakReason REASON();
+  WORD WATCH_ADDRESS();
+
+  //interactive prompt, runs at most max_frames frames in total
+  void CONSOLE(istream &in, ostream &out, long max_frames);
+};
+
+#endif //_DEBUGGER_H_
@@ -0,0 +1,104 @@
+#include "hash.h"
+
+#include <cstring>
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t ROTL(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t READ64(const uint8_t *p)
+{
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint32_t READ32(const uint8_t *p)
+{
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint64_t ROUND(uint64_t acc, uint64_t input)
+{
+  acc += input * PRIME64_2;
+  acc = ROTL(acc, 31);
+  return acc * PRIME64_1;
+}
+
+static inline uint64_t MERGE_ROUND(uint64_t acc, uint64_t value)
+{
+  acc ^= ROUND(0, value);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t HASH64(const void *data, size_t length, uint64_t seed)
+{
+  const uint8_t *p = (const uint8_t *) data;
+  const uint8_t *end = p + length;
+  uint64_t h;
+
+  if(length >= 32)
+  {
+    uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+    uint64_t v2 = seed + PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME64_1;
+
+    for(; p + 32 <= end; p += 32)
+    {
+      v1 = ROUND(v1, READ64(p));
+      v2 = ROUND(v2, READ64(p + 8));
+      v3 = ROUND(v3, READ64(p + 16));
+      v4 = ROUND(v4, READ64(p + 24));
+    }
+
+    h = ROTL(v1, 1) + ROTL(v2, 7) + ROTL(v3, 12) + ROTL(v4, 18);
+    h = MERGE_ROUND(h, v1);
+    h = MERGE_ROUND(h, v2);
+    h = MERGE_ROUND(h, v3);
+    h = MERGE_ROUND(h, v4);
+  }
+  else
+  {
+    h = seed + PRIME64_5;
+  }
+
+  h += length;
+
+  for(; p + 8 <= end; p += 8)
+  {
+    h ^= ROUND(0, READ64(p));
+    h = ROTL(h, 27) * PRIME64_1 + PRIME64_4;
+  }
+
+  if(p + 4 <= end)
+  {
+    h ^= (uint64_t) READ32(p) * PRIME64_1;
+    h = ROTL(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+
+  for(; p < end; p++)
+  {
+    h ^= *p * PRIME64_5;
+    h = ROTL(h, 11) * PRIME64_1;
+  }
+
+  //avalanche
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+
+  return h;
+}
@@ -0,0 +1,10 @@
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stdint.h>
+#include <cstddef>
+
+//XXH64, used for framebuffer and state hashes that get compared across runs and builds
+uint64_t HASH64(const void *data, size_t length, uint64_t seed = 0);
+
+#endif //_HASH_H_
@@ -0,0 +1,164 @@
+#include "cpu.h"
+
+#include <cstring>
+
+//IO registers at 0xFF00 - 0xFF7F and IE at 0xFFFF. The whole 0xFF page is trapped, the handlers
+//only exist for registers with side effects, everything else (and HRAM) is a plain array access
+
+//the handler tables are the same for every machine, so there's one per model rather than 8 KB
+//of member function pointers in each instance. CGB_IO adds to these, see cgb.cpp
+const CPU_::IoHandlers &CPU_::DMG_IO()
+{
+  static const IoHandlers handlers = [] {
+    IoHandlers io;
+    io.read[0x00] = &CPU_::READ_JOYP;
+    io.write[0x00] = &CPU_::WRITE_JOYP;
+    io.write[0x02] = &CPU_::WRITE_SC;
+    io.read[0x04] = &CPU_::READ_DIV;
+    io.write[0x04] = &CPU_::WRITE_DIV;
+    io.read[0x05] = &CPU_::READ_TIMA;
+    io.write[0x05] = &CPU_::WRITE_TIMA;
+    io.write[0x06] = &CPU_::WRITE_TMA;
+    io.read[0x07] = &CPU_::READ_TAC;
+    io.write[0x07] = &CPU_::WRITE_TAC;
+    io.read[0x0F] = &CPU_::READ_IF;
+    io.write[0x40] = &CPU_::WRITE_LCDC;
+    io.write[0x41] = &CPU_::WRITE_STAT;
+    io.write[0x44] = &CPU_::WRITE_LY;
+    io.write[0x45] = &CPU_::WRITE_LYC;
+    io.write[0x46] = &CPU_::WRITE_DMA;
+    return io;
+  }();
+  return handlers;
+}
+
+void CPU_::MAP_IO()
+{
+  io = &DMG_IO();
+}
+
+BYTE CPU_::IO_READ(WORD address)
+{
+  IoRead handler = io->read[address & 0xFF];
+  if(handler)
+    return (this->*handler)(address);
+  return IO(address);
+}
+
+void CPU_::IO_WRITE(WORD address, BYTE value)
+{
+  IoWrite handler = io->write[address & 0xFF];
+  if(handler)
+    (this->*handler)(address, value);
+  else
+    IO(address) = value;
+}
+
+//bits 4 and 5 select the direction and button rows (active low), held buttons pull their line low
+BYTE CPU_::READ_JOYP(WORD)
+{
+  BYTE lines = 0x0F;
+  if(!(IO(JOYP) & 0x10))
+    lines &= ~(buttons & 0x0F);
+  if(!(IO(JOYP) & 0x20))
+    lines &= ~(buttons >> 4);
+  return 0xC0 | (IO(JOYP) & 0x30) | lines;
+}
+
+void CPU_::SET_BUTTONS(BYTE pressed)
+{
+  if(pressed & ~buttons)
+    IO(IF) |= (1 << JOYPAD_INTERRUPT);
+  buttons = pressed;
+}
+
+void CPU_::WRITE_JOYP(WORD, BYTE value)
+{
+  IO(JOYP) = value & 0x30;
+}
+
+//no link partner, a transfer on the internal clock finishes straight away and shifts in 0xFF
+void CPU_::WRITE_SC(WORD, BYTE value)
+{
+  IO(SC) = value;
+  if((value & 0x81) != 0x81)
+    return;
+
+  serial_output += (char) IO(SB);
+  IO(SB) = 0xFF;
+  IO(SC) &= ~0x80;
+  IO(IF) |= (1 << SERIAL_INTERRUPT);
+}
+
+//the top three bits aren't wired
+BYTE CPU_::READ_IF(WORD)
+{
+  return IO(IF) | 0xE0;
+}
+
+void CPU_::WRITE_LCDC(WORD, BYTE value)
+{
+  bool enable = value & 0x80;
+  IO(LCDC) = value;
+
+  if(enable == lcd_enabled)
+    return;
+  lcd_enabled = enable;
+
+  if(enable)
+  {
+    //switching the LCD on starts a fresh frame at the top
+    lcd_cycles = 0;
+    window_line = 0;
+    SET_LCD_MODE(2);
+    COMPARE_LY();
+  }
+  else
+  {
+    //LCD off, LY stays at 0 and STAT reports HBlank
+    IO(LY) = 0;
+    IO(STAT) &= ~0x03;
+  }
+}
+
+//the mode and coincidence bits belong to the LCD
+void CPU_::WRITE_STAT(WORD, BYTE value)
+{
+  IO(STAT) = 0x80 | (value & 0x78) | (IO(STAT) & 0x07);
+}
+
+void CPU_::WRITE_LY(WORD, BYTE)
+{
+}
+
+void CPU_::WRITE_LYC(WORD, BYTE value)
+{
+  IO(LYC) = value;
+  if(lcd_enabled)
+    COMPARE_LY();
+}
+
+//OAM DMA owns the bus for DMA_CYCLES. Rather than checking a flag on every access, every page
+//but 0xFF is trapped for the duration so the CPU reads 0xFF and loses its writes there
+void CPU_::WRITE_DMA(WORD, BYTE value)
+{
+  IO(DMA) = value;
+
+  if(event_at[EVENT_DMA] == NEVER)
+  {
+    for(int page = 0; page < 0xFF; page++)
+      SET_PAGE_TRAP(page, TRAP_DMA, true);
+  }
+  SCHEDULE(EVENT_DMA, cycles + DMA_CYCLES); //writing again restarts it
+}
+
+//the whole 160 bytes land at once, the source is read without watchpoints like the DMA unit would
+void CPU_::FINISH_DMA()
+{
+  BYTE *source = read_map[IO(DMA)];
+  if(source)
+    memcpy(high, source, 0xA0);
+
+  for(int page = 0; page < 0xFF; page++)
+    SET_PAGE_TRAP(page, TRAP_DMA, false);
+}
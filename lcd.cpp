@@ -0,0 +1,354 @@
+#include "cpu.h"
+
+#include <algorithm>
+#include <cstring>
+
+//LCD timing and the scanline renderer, the Vulkan side in ppu.cpp only presents the result
+
+template<typename MODEL>
+void CPU_::LCD_STEP_T(int elapsed)
+{
+  //LCDC writes switch it on and off, see WRITE_LCDC
+  if(!lcd_enabled)
+    return;
+
+  lcd_cycles += elapsed;
+
+  while(true)
+  {
+    if(IO(LY) >= LCD_HEIGHT)
+    {
+      if(lcd_cycles < ONELINE_FREQ)
+        return;
+      lcd_cycles -= ONELINE_FREQ;
+      NEXT_LINE();
+      continue;
+    }
+
+    switch(IO(STAT) & 0x03)
+    {
+      case 2:
+        if(lcd_cycles < SCANLINE_OAM_FREQ)
+          return;
+        SET_LCD_MODE(3);
+        break;
+
+      case 3:
+        if(lcd_cycles < SCANLINE_OAM_FREQ + SCANLINE_VRAM_FREQ)
+          return;
+        if constexpr(MODEL::CGB)
+        {
+          RENDER_SCANLINE_CGB();
+          SET_LCD_MODE(0);
+          if(cgb->hdma_blocks)
+            COPY_HDMA_BLOCK();
+        }
+        else
+        {
+          RENDER_SCANLINE();
+          SET_LCD_MODE(0);
+        }
+        break;
+
+      case 0:
+        if(lcd_cycles < ONELINE_FREQ)
+          return;
+        lcd_cycles -= ONELINE_FREQ;
+        NEXT_LINE();
+        break;
+
+      default:
+        SET_LCD_MODE(2);
+        break;
+    }
+  }
+}
+
+template void CPU_::LCD_STEP_T<DmgModel>(int elapsed);
+template void CPU_::LCD_STEP_T<MgbModel>(int elapsed);
+template void CPU_::LCD_STEP_T<CgbModel>(int elapsed);
+template void CPU_::LCD_STEP_T<CgbDmgModel>(int elapsed);
+
+void CPU_::NEXT_LINE()
+{
+  IO(LY) += 1;
+
+  if(IO(LY) == LCD_HEIGHT)
+  {
+    SET_LCD_MODE(1);
+    IO(IF) |= (1 << VBLANK_INTERRUPT);
+    frame_count++;
+  }
+  else if(IO(LY) == LCD_LINES)
+  {
+    IO(LY) = 0;
+    window_line = 0;
+    SET_LCD_MODE(2);
+  }
+  else if(IO(LY) < LCD_HEIGHT)
+  {
+    SET_LCD_MODE(2);
+  }
+
+  COMPARE_LY();
+}
+
+void CPU_::SET_LCD_MODE(BYTE mode)
+{
+  IO(STAT) = (IO(STAT) & ~0x03) | mode;
+
+  //STAT bits 3, 4 and 5 enable the interrupt for modes 0, 1 and 2
+  if(mode < 3 && (IO(STAT) & (1 << (mode + 3))))
+    IO(IF) |= (1 << LCD_STAT_INTERRUPT);
+}
+
+void CPU_::COMPARE_LY()
+{
+  if(IO(LY) == IO(LYC))
+  {
+    IO(STAT) |= 0x04;
+    if(IO(STAT) & 0x40)
+      IO(IF) |= (1 << LCD_STAT_INTERRUPT);
+  }
+  else
+  {
+    IO(STAT) &= ~0x04;
+  }
+}
+
+WORD CPU_::TILE_ADDRESS(BYTE index)
+{
+  //LCDC bit 4 picks unsigned indexes from 0x8000 or signed ones around 0x9000
+  if(IO(LCDC) & 0x10)
+    return 0x8000 + index * 16;
+  return 0x9000 + (int8_t) index * 16;
+}
+
+const BYTE *CPU_::TILE_DATA(WORD tile_address, int bank)
+{
+  return bank ? &cgb->vram_bank1[tile_address - 0x8000] : &vram[tile_address - 0x8000];
+}
+
+BYTE CPU_::TILE_PIXEL(const BYTE *tile, int row, int column)
+{
+  BYTE lo = tile[row * 2];
+  BYTE hi = tile[row * 2 + 1];
+  int bit = 7 - column;
+
+  return (((hi >> bit) & 1) << 1) | ((lo >> bit) & 1);
+}
+
+void CPU_::RENDER_SCANLINE()
+{
+  BYTE y = IO(LY);
+  BYTE *out = framebuffer[y];
+  BYTE colours[LCD_WIDTH]; //pre-palette colour, sprites need it for BG priority
+
+  memset(colours, 0, sizeof(colours));
+
+  if(IO(LCDC) & 0x01)
+  {
+    WORD map = (IO(LCDC) & 0x08) ? 0x9C00 : 0x9800;
+    BYTE map_y = IO(SCY) + y;
+
+    for(int x = 0; x < LCD_WIDTH; x++)
+    {
+      BYTE map_x = IO(SCX) + x;
+      BYTE index = vram[map - 0x8000 + (map_y / 8) * 32 + map_x / 8];
+      colours[x] = TILE_PIXEL(TILE_DATA(TILE_ADDRESS(index), 0), map_y % 8, map_x % 8);
+    }
+
+    //the window has its own line counter that only advances on lines it was drawn on
+    if((IO(LCDC) & 0x20) && IO(WY) <= y && IO(WX) <= 166)
+    {
+      WORD window_map = (IO(LCDC) & 0x40) ? 0x9C00 : 0x9800;
+      int start = IO(WX) - 7;
+
+      for(int x = max(start, 0); x < LCD_WIDTH; x++)
+      {
+        int window_x = x - start;
+        BYTE index = vram[window_map - 0x8000 + (window_line / 8) * 32 + window_x / 8];
+        colours[x] = TILE_PIXEL(TILE_DATA(TILE_ADDRESS(index), 0), window_line % 8, window_x % 8);
+      }
+      window_line++;
+    }
+  }
+
+  for(int x = 0; x < LCD_WIDTH; x++)
+    out[x] = (IO(BGP) >> (colours[x] * 2)) & 0x03;
+
+  if(IO(LCDC) & 0x02)
+  {
+    int height = (IO(LCDC) & 0x04) ? 16 : 8;
+    BYTE *oam = high; //0xFE00
+
+    //only the first 10 sprites on the line in OAM order are drawn
+    int visible[10];
+    int count = 0;
+    for(int i = 0; i < 40 && count < 10; i++)
+    {
+      int top = oam[i * 4] - 16;
+      if(y >= top && y < top + height)
+        visible[count++] = i;
+    }
+
+    //lower X wins, ties go to the earlier OAM entry, so draw the losers first
+    stable_sort(visible, visible + count, [oam](int a, int b) { return oam[a * 4 + 1] < oam[b * 4 + 1]; });
+
+    for(int s = count - 1; s >= 0; s--)
+    {
+      BYTE *sprite = &oam[visible[s] * 4];
+      int top = sprite[0] - 16;
+      int left = sprite[1] - 8;
+      BYTE tile = sprite[2];
+      BYTE flags = sprite[3];
+      BYTE palette = (flags & 0x10) ? IO(OBP1) : IO(OBP0);
+
+      int row = y - top;
+      if(flags & 0x40)
+        row = height - 1 - row;
+      if(height == 16)
+        tile &= 0xFE;
+
+      for(int column = 0; column < 8; column++)
+      {
+        int x = left + column;
+        if(x < 0 || x >= LCD_WIDTH)
+          continue;
+
+        BYTE colour = TILE_PIXEL(TILE_DATA(0x8000 + tile * 16, 0), row, (flags & 0x20) ? 7 - column : column);
+        if(colour == 0)
+          continue;
+        if((flags & 0x80) && colours[x] != 0)
+          continue;
+
+        out[x] = (palette >> (colour * 2)) & 0x03;
+      }
+    }
+  }
+}
+
+static WORD PALETTE_COLOUR(const BYTE *palettes, int palette, int colour)
+{
+  const BYTE *entry = &palettes[palette * 8 + colour * 2];
+  return (entry[0] | (entry[1] << 8)) & 0x7FFF;
+}
+
+//tile attributes from VRAM bank 1, colour palettes, OAM order sprite priority and LCDC bit 0 as
+//the BG master priority rather than a BG enable
+void CPU_::RENDER_SCANLINE_CGB()
+{
+  BYTE y = IO(LY);
+  BYTE *out = framebuffer[y];
+  WORD *colour_out = cgb->colour_framebuffer[y];
+  BYTE colours[LCD_WIDTH];
+  BYTE attributes[LCD_WIDTH];
+
+  auto fetch = [&](WORD entry, int row, int column, int x)
+  {
+    BYTE attribute = cgb->vram_bank1[entry - 0x8000];
+    if(attribute & 0x40)
+      row = 7 - row;
+    if(attribute & 0x20)
+      column = 7 - column;
+
+    colours[x] = TILE_PIXEL(TILE_DATA(TILE_ADDRESS(vram[entry - 0x8000]), (attribute >> 3) & 1), row, column);
+    attributes[x] = attribute;
+  };
+
+  WORD map = (IO(LCDC) & 0x08) ? 0x9C00 : 0x9800;
+  BYTE map_y = IO(SCY) + y;
+  for(int x = 0; x < LCD_WIDTH; x++)
+  {
+    BYTE map_x = IO(SCX) + x;
+    fetch(map + (map_y / 8) * 32 + map_x / 8, map_y % 8, map_x % 8, x);
+  }
+
+  if((IO(LCDC) & 0x20) && IO(WY) <= y && IO(WX) <= 166)
+  {
+    WORD window_map = (IO(LCDC) & 0x40) ? 0x9C00 : 0x9800;
+    int start = IO(WX) - 7;
+
+    for(int x = max(start, 0); x < LCD_WIDTH; x++)
+    {
+      int window_x = x - start;
+      fetch(window_map + (window_line / 8) * 32 + window_x / 8, window_line % 8, window_x % 8, x);
+    }
+    window_line++;
+  }
+
+  for(int x = 0; x < LCD_WIDTH; x++)
+  {
+    out[x] = colours[x];
+    colour_out[x] = PALETTE_COLOUR(cgb->bg_palettes, attributes[x] & 0x07, colours[x]);
+  }
+
+  if(!(IO(LCDC) & 0x02))
+    return;
+
+  int height = (IO(LCDC) & 0x04) ? 16 : 8;
+  BYTE *oam = high; //0xFE00
+
+  int visible[10];
+  int count = 0;
+  for(int i = 0; i < 40 && count < 10; i++)
+  {
+    int top = oam[i * 4] - 16;
+    if(y >= top && y < top + height)
+      visible[count++] = i;
+  }
+
+  //the earlier OAM entry wins regardless of X, so draw back to front
+  for(int s = count - 1; s >= 0; s--)
+  {
+    BYTE *sprite = &oam[visible[s] * 4];
+    int top = sprite[0] - 16;
+    int left = sprite[1] - 8;
+    BYTE tile = sprite[2];
+    BYTE flags = sprite[3];
+
+    int row = y - top;
+    if(flags & 0x40)
+      row = height - 1 - row;
+    if(height == 16)
+      tile &= 0xFE;
+    const BYTE *data = TILE_DATA(0x8000 + tile * 16, (flags >> 3) & 1);
+
+    for(int column = 0; column < 8; column++)
+    {
+      int x = left + column;
+      if(x < 0 || x >= LCD_WIDTH)
+        continue;
+
+      BYTE colour = TILE_PIXEL(data, row, (flags & 0x20) ? 7 - column : column);
+      if(colour == 0)
+        continue;
+      if((IO(LCDC) & 0x01) && colours[x] != 0 && ((flags & 0x80) || (attributes[x] & 0x80)))
+        continue;
+
+      out[x] = colour;
+      colour_out[x] = PALETTE_COLOUR(cgb->obj_palettes, flags & 0x07, colour);
+    }
+  }
+}
+
+const BYTE *CPU_::FRAMEBUFFER()
+{
+  return &framebuffer[0][0];
+}
+
+//null unless the machine is in CGB mode
+const WORD *CPU_::COLOUR_FRAMEBUFFER()
+{
+  return cgb ? &cgb->colour_framebuffer[0][0] : nullptr;
+}
+
+bool CPU_::IS_CGB()
+{
+  return model == MODEL_CGB;
+}
+
+uint64_t CPU_::FRAME_COUNT()
+{
+  return frame_count;
+}
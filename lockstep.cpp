@@ -0,0 +1,598 @@
+#include "lockstep.h"
+
+#include <cstring>
+
+//the word and cycle vectors are wider than the baseline SSE registers, these helpers are all
+//local to this file so how they would be passed between translation units doesn't matter
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_H 0x20
+#define FLAG_C 0x10
+
+#define REG_F 6 //regs[] index, the (HL) slot of the opcode encoding
+#define REG_A 7
+
+//what a lane does for an opcode, mirroring OPCODE_HANDLER including its quirks, so a machine
+//runs the same in a lane as it does on its own
+enum LaneKind : BYTE {
+    LANE_SCALAR, //hand the machine back to STEP
+    LANE_STALL, //not implemented by OPCODE_HANDLER either, 4 cycles without moving
+    LANE_NOP,
+    LANE_LD, //x = y
+    LANE_LD_N, //x = n
+    LANE_LD16, //pair x = nn
+    LANE_LOAD, //x = (pair y), pair y += z
+    LANE_STORE, //(pair y) = x, pair y += z
+    LANE_INC,
+    LANE_DEC,
+    LANE_INC16,
+    LANE_DEC16,
+    LANE_ADD, //A += y
+    LANE_ADD_HL, //HL += pair x
+    LANE_XOR_A,
+    LANE_CP_N,
+    LANE_RLA,
+    LANE_JR,
+    LANE_JR_NZ,
+    LANE_JR_Z,
+    LANE_JP,
+    LANE_JP_HL,
+    LANE_DI,
+    LANE_EI
+};
+
+//pairs by opcode encoding, SP has no bytes in regs
+#define PAIR_BC 0
+#define PAIR_DE 1
+#define PAIR_HL 2
+#define PAIR_SP 3
+
+struct LaneOp {
+    LaneKind kind = LANE_STALL;
+    BYTE x = 0;
+    BYTE y = 0;
+    int8_t z = 0;
+};
+
+static const LaneOp *LANE_OPS()
+{
+  static const vector<LaneOp> ops = [] {
+    vector<LaneOp> table(0x100);
+
+    //everything OPCODE_HANDLER has a case for is scalar until given a lane version below
+    const int scalar[] = {
+        0x08, 0x10, 0x34, 0x35, 0x36, 0x86, 0xC1, 0xC5, 0xC9, 0xCB, 0xCD, 0xD5, 0xE0, 0xE1, 0xE2, 0xEA, 0xF0
+    };
+    for(int opcode : scalar)
+      table[opcode].kind = LANE_SCALAR;
+
+    table[0x00].kind = LANE_NOP;
+    table[0x76].kind = LANE_NOP; //HALT doesn't halt yet
+
+    for(int pair = 0; pair < 4; pair++)
+    {
+      table[0x01 + pair * 0x10] = {LANE_LD16, (BYTE) pair};
+      table[0x03 + pair * 0x10] = {LANE_INC16, (BYTE) pair};
+    }
+    table[0x0B] = {LANE_DEC16, PAIR_BC};
+    table[0x1B] = {LANE_DEC16, PAIR_DE};
+    table[0x3B] = {LANE_DEC16, PAIR_SP};
+
+    table[0x02] = {LANE_STORE, REG_A, PAIR_BC, 0};
+    table[0x12] = {LANE_STORE, REG_A, PAIR_BC, 0}; //OPCODE_HANDLER writes through BC here too
+    table[0x22] = {LANE_STORE, REG_A, PAIR_HL, 1};
+    table[0x32] = {LANE_STORE, REG_A, PAIR_HL, -1};
+    table[0x0A] = {LANE_LOAD, REG_A, PAIR_BC, 0};
+    table[0x1A] = {LANE_LOAD, REG_A, PAIR_DE, 0};
+    table[0x2A] = {LANE_LOAD, REG_A, PAIR_HL, 1};
+    table[0x3A] = {LANE_LOAD, REG_A, PAIR_HL, -1};
+
+    for(int reg : {0, 1, 2, 3, 7})
+    {
+      table[0x04 + reg * 8] = {LANE_INC, (BYTE) reg};
+      table[0x05 + reg * 8] = {LANE_DEC, (BYTE) reg};
+    }
+    for(int reg : {0, 1, 2, 3, 5, 7})
+      table[0x06 + reg * 8] = {LANE_LD_N, (BYTE) reg};
+
+    table[0x09] = {LANE_ADD_HL, PAIR_BC};
+    table[0x19] = {LANE_ADD_HL, PAIR_BC}; //and adds BC here
+    table[0x39] = {LANE_ADD_HL, PAIR_SP};
+
+    table[0x17].kind = LANE_RLA;
+    table[0x18].kind = LANE_JR;
+    table[0x20].kind = LANE_JR_NZ;
+    table[0x28].kind = LANE_JR_Z;
+
+    for(int opcode = 0x40; opcode < 0x80; opcode++)
+    {
+      int destination = (opcode >> 3) & 7;
+      int source = opcode & 7;
+      if(opcode == 0x76 || opcode == 0x4B)
+        continue;
+      if(destination == 6)
+        table[opcode] = {LANE_STORE, (BYTE) source, PAIR_HL, 0};
+      else if(source == 6)
+        table[opcode] = {LANE_LOAD, (BYTE) destination, PAIR_HL, 0};
+      else
+        table[opcode] = {LANE_LD, (BYTE) destination, (BYTE) source};
+    }
+    table[0xBC] = {LANE_LD, 1, 3}; //LD C,E lives here rather than at 0x4B
+
+    for(int reg : {0, 1, 2, 3, 4, 5, 7})
+      table[0x80 + reg] = {LANE_ADD, 0, (BYTE) reg};
+
+    table[0xAF].kind = LANE_XOR_A;
+    table[0xC3].kind = LANE_JP;
+    table[0xE9].kind = LANE_JP_HL;
+    table[0xF3].kind = LANE_DI;
+    table[0xFB].kind = LANE_EI;
+    table[0xFE].kind = LANE_CP_N;
+    return table;
+  }();
+  return ops.data();
+}
+
+static LaneBytes SELECT(LaneBytes mask, LaneBytes yes, LaneBytes no)
+{
+  return (yes & mask) | (no & ~mask);
+}
+
+static LaneWords SELECT(const LaneWords &mask, const LaneWords &yes, const LaneWords &no)
+{
+  return (yes & mask) | (no & ~mask);
+}
+
+static LaneCycles SELECT(const LaneCycles &mask, const LaneCycles &yes, const LaneCycles &no)
+{
+  return (yes & mask) | (no & ~mask);
+}
+
+//masks are all ones or all zeros per lane, widening sign extends them
+static LaneWords WIDE_MASK(LaneBytes mask)
+{
+  return (LaneWords) __builtin_convertvector((LaneSignedBytes) mask, LaneSignedWords);
+}
+
+static LaneCycles CYCLE_MASK(LaneBytes mask)
+{
+  return (LaneCycles) __builtin_convertvector((LaneSignedBytes) mask, LaneSignedCycles);
+}
+
+static LaneBytes NARROW_MASK(const LaneWords &mask)
+{
+  return (LaneBytes) __builtin_convertvector((LaneSignedWords) mask, LaneSignedBytes);
+}
+
+static LaneWords JOIN(LaneBytes hi, LaneBytes lo)
+{
+  return (__builtin_convertvector(hi, LaneWords) << 8) | __builtin_convertvector(lo, LaneWords);
+}
+
+static bool ANY(LaneBytes mask)
+{
+  uint64_t halves[LOCKSTEP_LANES / 8];
+  memcpy(halves, &mask, sizeof(halves));
+  uint64_t any = 0;
+  for(uint64_t half : halves)
+    any |= half;
+  return any;
+}
+
+Lockstep::Lockstep(const vector<CPU_ *> &machines)
+{
+  for(size_t i = 0; i < machines.size(); i++)
+  {
+    if(i % LOCKSTEP_LANES == 0)
+      groups.emplace_back();
+    Group &group = groups.back();
+    group.machines[group.size++] = machines[i];
+  }
+}
+
+//loads a machine into a lane if it can run there, with the cycles it has before STEP must take over
+bool Lockstep::ENTER(Group &group, int lane)
+{
+  CPU_ &machine = *group.machines[lane];
+  if(machine.cgb || machine.debugger || machine.coverage)
+    return false;
+  uint64_t horizon = machine.HORIZON();
+  if(horizon <= 4)
+    return false;
+
+  group.regs[0][lane] = machine.BC.hi;
+  group.regs[1][lane] = machine.BC.lo;
+  group.regs[2][lane] = machine.DE.hi;
+  group.regs[3][lane] = machine.DE.lo;
+  group.regs[4][lane] = machine.HL.hi;
+  group.regs[5][lane] = machine.HL.lo;
+  group.regs[REG_F][lane] = machine.AF.lo;
+  group.regs[REG_A][lane] = machine.AF.hi;
+  group.sp[lane] = machine.SP;
+  group.pc[lane] = machine.PC;
+  group.ime[lane] = machine.IME;
+  group.left[lane] = horizon;
+  group.spent[lane] = 0;
+  group.count[lane] = 0;
+  group.active[lane] = 0xFF;
+  group.active_count++;
+  stats.entries++;
+  return true;
+}
+
+void Lockstep::LEAVE(Group &group, int lane)
+{
+  CPU_ &machine = *group.machines[lane];
+  machine.BC.hi = group.regs[0][lane];
+  machine.BC.lo = group.regs[1][lane];
+  machine.DE.hi = group.regs[2][lane];
+  machine.DE.lo = group.regs[3][lane];
+  machine.HL.hi = group.regs[4][lane];
+  machine.HL.lo = group.regs[5][lane];
+  machine.AF.lo = group.regs[REG_F][lane];
+  machine.AF.hi = group.regs[REG_A][lane];
+  machine.SP = group.sp[lane];
+  machine.PC = group.pc[lane];
+  machine.IME = group.ime[lane];
+  machine.cycles += group.spent[lane];
+  machine.instructions += group.count[lane];
+  machine.SYNC_LCD();
+  stats.vector_instructions += group.count[lane];
+
+  group.active[lane] = 0;
+  group.active_count--;
+  group.handed_back[lane] = true;
+}
+
+//every lane runs one instruction, or leaves
+void Lockstep::ROUND(Group &group)
+{
+  LaneBytes opcodes = {};
+  for(int lane = 0; lane < group.size; lane++)
+  {
+    if(!group.active[lane])
+      continue;
+    WORD pc = group.pc[lane];
+    const BYTE *page = group.machines[lane]->read_pages[pc >> 8];
+    if(!page)
+    {
+      LEAVE(group, lane);
+      continue;
+    }
+    opcodes[lane] = page[pc & 0xFF];
+  }
+
+  LaneBytes pending = group.active;
+  while(ANY(pending))
+  {
+    int first = 0;
+    while(!pending[first])
+      first++;
+    BYTE opcode = opcodes[first];
+    LaneBytes mask = (LaneBytes) (opcodes == opcode) & pending;
+    pending &= ~mask;
+    EXECUTE(group, opcode, mask);
+    stats.dispatches++;
+  }
+}
+
+void Lockstep::EXECUTE(Group &group, BYTE opcode, LaneBytes mask)
+{
+  const LaneOp &op = LANE_OPS()[opcode];
+  LaneBytes *regs = group.regs;
+  LaneBytes &a = regs[REG_A];
+  LaneBytes &f = regs[REG_F];
+
+  auto DROP = [&](int lane) {
+    mask[lane] = 0;
+    LEAVE(group, lane);
+  };
+
+  if(op.kind == LANE_SCALAR)
+  {
+    for(int lane = 0; lane < group.size; lane++)
+    {
+      if(mask[lane])
+        DROP(lane);
+    }
+    return;
+  }
+
+  //immediate operands, per lane since every lane has its own PC and pages
+  int operands = 0;
+  switch(op.kind)
+  {
+    case LANE_LD_N: case LANE_CP_N: case LANE_JR: case LANE_JR_NZ: case LANE_JR_Z: operands = 1; break;
+    case LANE_LD16: case LANE_JP: operands = 2; break;
+    default: break;
+  }
+  LaneBytes n1 = {};
+  LaneBytes n2 = {};
+  for(int lane = 0; operands && lane < group.size; lane++)
+  {
+    if(!mask[lane])
+      continue;
+    BYTE *const *pages = group.machines[lane]->read_pages;
+    WORD pc = group.pc[lane];
+    const BYTE *first = pages[(WORD) (pc + 1) >> 8];
+    const BYTE *second = operands == 2 ? pages[(WORD) (pc + 2) >> 8] : first;
+    if(!first || !second)
+    {
+      DROP(lane);
+      continue;
+    }
+    n1[lane] = first[(pc + 1) & 0xFF];
+    if(operands == 2)
+      n2[lane] = second[(pc + 2) & 0xFF];
+  }
+
+  //cycles and where PC goes, the only per lane difference is whether a JR is taken
+  LaneCycles cost = {};
+  LaneWords next = group.pc;
+  LaneBytes taken = {};
+  switch(op.kind)
+  {
+    case LANE_STALL: cost += 4; break;
+    case LANE_NOP: case LANE_LD: case LANE_INC: case LANE_DEC: case LANE_ADD: case LANE_XOR_A: case LANE_RLA:
+    case LANE_DI: case LANE_EI:
+      cost += 4;
+      next += 1;
+      break;
+    case LANE_LD_N: case LANE_CP_N:
+      cost += 8;
+      next += 2;
+      break;
+    case LANE_LD16:
+      cost += 12;
+      next += 3;
+      break;
+    case LANE_LOAD: case LANE_STORE: case LANE_INC16: case LANE_DEC16: case LANE_ADD_HL:
+      cost += 8;
+      next += 1;
+      break;
+    case LANE_JR:
+      //OPCODE_HANDLER adds one more after the jump and only charges 4
+      cost += 4;
+      next += (LaneWords) __builtin_convertvector((LaneSignedBytes) n1, LaneSignedWords) + 3;
+      break;
+    case LANE_JR_NZ: case LANE_JR_Z:
+    {
+      LaneBytes zero = (LaneBytes) ((f & FLAG_Z) != 0);
+      taken = op.kind == LANE_JR_Z ? zero : ~zero;
+      LaneWords wide = WIDE_MASK(taken);
+      LaneWords offset = (LaneWords) __builtin_convertvector((LaneSignedBytes) n1, LaneSignedWords);
+      next = SELECT(wide, next + offset + 2, next + 2);
+      cost = SELECT(CYCLE_MASK(taken), cost + 12, cost + 8);
+      break;
+    }
+    case LANE_JP:
+      cost += 16;
+      next = JOIN(n2, n1);
+      break;
+    case LANE_JP_HL:
+      cost += 16;
+      next = JOIN(regs[4], regs[5]);
+      break;
+    default:
+      break;
+  }
+
+  //a lane that would reach its horizon hands the instruction to STEP instead
+  LaneBytes over = NARROW_MASK((LaneWords) __builtin_convertvector((LaneSignedCycles) (cost >= group.left), LaneSignedWords));
+  if(ANY(over & mask))
+  {
+    for(int lane = 0; lane < group.size; lane++)
+    {
+      if(mask[lane] && over[lane])
+        DROP(lane);
+    }
+  }
+
+  //memory, per lane through the bus fast tables, a trapped page leaves for READ_SLOW/WRITE_SLOW
+  if(op.kind == LANE_LOAD || op.kind == LANE_STORE)
+  {
+    LaneBytes hi = op.y == PAIR_BC ? regs[0] : op.y == PAIR_DE ? regs[2] : regs[4];
+    LaneBytes lo = op.y == PAIR_BC ? regs[1] : op.y == PAIR_DE ? regs[3] : regs[5];
+    LaneBytes loaded = {};
+    for(int lane = 0; lane < group.size; lane++)
+    {
+      if(!mask[lane])
+        continue;
+      WORD address = (hi[lane] << 8) | lo[lane];
+      CPU_ &machine = *group.machines[lane];
+      BYTE *page = op.kind == LANE_LOAD ? machine.read_pages[address >> 8] : machine.write_pages[address >> 8];
+      if(!page)
+      {
+        DROP(lane);
+        continue;
+      }
+      if(op.kind == LANE_LOAD)
+        loaded[lane] = page[address & 0xFF];
+      else
+        page[address & 0xFF] = regs[op.x][lane];
+    }
+    if(op.kind == LANE_LOAD)
+      regs[op.x] = SELECT(mask, loaded, regs[op.x]);
+    if(op.z)
+    {
+      LaneWords pair = JOIN(regs[4], regs[5]) + (WORD) op.z;
+      regs[4] = SELECT(mask, __builtin_convertvector(pair >> 8, LaneBytes), regs[4]);
+      regs[5] = SELECT(mask, __builtin_convertvector(pair & 0xFF, LaneBytes), regs[5]);
+    }
+  }
+
+  switch(op.kind)
+  {
+    case LANE_LD:
+      regs[op.x] = SELECT(mask, regs[op.y], regs[op.x]);
+      break;
+
+    case LANE_LD_N:
+      regs[op.x] = SELECT(mask, n1, regs[op.x]);
+      break;
+
+    case LANE_LD16:
+      if(op.x == PAIR_SP)
+        group.sp = SELECT(WIDE_MASK(mask), JOIN(n2, n1), group.sp);
+      else
+      {
+        regs[op.x * 2] = SELECT(mask, n2, regs[op.x * 2]);
+        regs[op.x * 2 + 1] = SELECT(mask, n1, regs[op.x * 2 + 1]);
+      }
+      break;
+
+    case LANE_INC: case LANE_DEC:
+    {
+      LaneBytes old = regs[op.x];
+      LaneBytes value = op.kind == LANE_INC ? old + 1 : old - 1;
+      LaneBytes flags = (f & (FLAG_C | 0x0F)) | ((LaneBytes) (value == 0) & FLAG_Z);
+      if(op.kind == LANE_INC)
+        flags |= (LaneBytes) ((((old & 0x0F) + (value & 0x0F)) & 0x10) != 0) & FLAG_H;
+      else
+        flags |= FLAG_N | ((LaneBytes) ((old & 0x0F) < (value & 0x0F)) & FLAG_H);
+      regs[op.x] = SELECT(mask, value, old);
+      f = SELECT(mask, flags, f);
+      break;
+    }
+
+    case LANE_INC16: case LANE_DEC16:
+      if(op.x == PAIR_SP)
+      {
+        WORD step = op.kind == LANE_INC16 ? 1 : 0xFFFF;
+        group.sp = SELECT(WIDE_MASK(mask), group.sp + step, group.sp);
+      }
+      else
+      {
+        LaneBytes &hi = regs[op.x * 2];
+        LaneBytes &lo = regs[op.x * 2 + 1];
+        LaneBytes low = op.kind == LANE_INC16 ? lo + 1 : lo - 1;
+        //comparisons are -1 where true, so subtracting one carries and adding one borrows
+        LaneBytes high = op.kind == LANE_INC16 ? hi - (LaneBytes) (low == 0) : hi + (LaneBytes) (lo == 0);
+        hi = SELECT(mask, high, hi);
+        lo = SELECT(mask, low, lo);
+      }
+      break;
+
+    case LANE_ADD:
+    {
+      LaneBytes value = regs[op.y];
+      LaneBytes sum = a + value;
+      LaneBytes flags = (f & 0x0F) | ((LaneBytes) (sum == 0) & FLAG_Z) |
+                        ((LaneBytes) ((((value & 0x0F) + (a & 0x0F)) & 0x10) != 0) & FLAG_H) |
+                        ((LaneBytes) (sum < a) & FLAG_C);
+      a = SELECT(mask, sum, a);
+      f = SELECT(mask, flags, f);
+      break;
+    }
+
+    case LANE_ADD_HL:
+    {
+      LaneWords hl = JOIN(regs[4], regs[5]);
+      LaneWords value = op.x == PAIR_SP ? group.sp : JOIN(regs[0], regs[1]);
+      LaneWords sum = hl + value;
+      LaneBytes zero = NARROW_MASK((LaneWords) (sum == 0));
+      LaneBytes half = NARROW_MASK((LaneWords) ((((value & 0x0FFF) + (hl & 0x0FFF)) & 0x1000) != 0));
+      LaneBytes carry = NARROW_MASK((LaneWords) (sum < hl));
+      LaneBytes flags = (f & 0x0F) | (zero & FLAG_Z) | (half & FLAG_H) | (carry & FLAG_C);
+      regs[4] = SELECT(mask, __builtin_convertvector(sum >> 8, LaneBytes), regs[4]);
+      regs[5] = SELECT(mask, __builtin_convertvector(sum & 0xFF, LaneBytes), regs[5]);
+      f = SELECT(mask, flags, f);
+      break;
+    }
+
+    case LANE_XOR_A:
+      a = SELECT(mask, (LaneBytes) {}, a);
+      f = SELECT(mask, (f & 0x0F) | FLAG_Z, f);
+      break;
+
+    case LANE_CP_N:
+    {
+      //like CP, a greater A leaves Z and C as they were
+      LaneBytes less = (LaneBytes) (a < n1);
+      LaneBytes equal = (LaneBytes) (a == n1);
+      LaneBytes flags = SELECT(less, (f | FLAG_C) & ~FLAG_Z, f);
+      flags = SELECT(equal, (flags | FLAG_Z) & ~FLAG_C, flags);
+      flags = (flags & ~FLAG_H) | FLAG_N | ((LaneBytes) ((a & 0x0F) < (n1 & 0x0F)) & FLAG_H);
+      f = SELECT(mask, flags, f);
+      break;
+    }
+
+    case LANE_RLA:
+    {
+      LaneBytes rotated = (a << 1) | ((f >> 4) & 1);
+      LaneBytes flags = (f & 0x0F) | ((a >> 7) << 4);
+      a = SELECT(mask, rotated, a);
+      f = SELECT(mask, flags, f);
+      break;
+    }
+
+    case LANE_DI:
+      group.ime = SELECT(mask, (LaneBytes) {}, group.ime);
+      break;
+
+    case LANE_EI:
+      group.ime = SELECT(mask, group.ime | 1, group.ime);
+      break;
+
+    default:
+      break;
+  }
+
+  LaneWords wide = WIDE_MASK(mask);
+  LaneCycles cycle_mask = CYCLE_MASK(mask);
+  group.pc = SELECT(wide, next, group.pc);
+  group.left -= cost & cycle_mask;
+  group.spent += cost & cycle_mask;
+  group.count -= cycle_mask; //all ones is -1
+}
+
+//one frame on up to LOCKSTEP_LANES machines, each one in a lane while it can be and STEP otherwise
+void Lockstep::RUN_GROUP(Group &group)
+{
+  bool done[LOCKSTEP_LANES] = {};
+  int running = group.size;
+
+  while(running)
+  {
+    for(int lane = 0; lane < group.size; lane++)
+    {
+      if(done[lane] || group.active[lane])
+        continue;
+      CPU_ &machine = *group.machines[lane];
+      if(machine.frame_cycles >= FULL_FRAME_FREQ)
+      {
+        //where RUN_FRAME_T ends
+        machine.frame_cycles -= FULL_FRAME_FREQ;
+        done[lane] = true;
+        running--;
+        continue;
+      }
+      //a lane that just left did so because STEP has to run its next instruction
+      if(group.handed_back[lane] || !ENTER(group, lane))
+      {
+        group.handed_back[lane] = false;
+        if(machine.coverage)
+          machine.COVER_CODE(machine.PC); //as RUN_FRAME_T would
+        machine.STEP();
+        stats.scalar_instructions++;
+      }
+    }
+
+    //keep going while at least half of the machines still running share the rounds
+    while(group.active_count && group.active_count * 2 >= running)
+      ROUND(group);
+  }
+}
+
+void Lockstep::RUN_FRAME()
+{
+  for(Group &group : groups)
+    RUN_GROUP(group);
+}
+
+LockstepStats Lockstep::STATS()
+{
+  return stats;
+}
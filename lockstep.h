@@ -0,0 +1,73 @@
+#ifndef _LOCKSTEP_H_
+#define _LOCKSTEP_H_
+
+#include "cpu.h"
+
+#include <vector>
+
+#define LOCKSTEP_LANES 16
+
+//one byte, word or cycle count per lane. GCC vector extensions, so the same code is SSE2 by
+//default and AVX2/AVX-512 with -march to match
+typedef uint8_t LaneBytes __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef int8_t LaneSignedBytes __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef uint16_t LaneWords __attribute__((vector_size(LOCKSTEP_LANES * 2)));
+typedef int16_t LaneSignedWords __attribute__((vector_size(LOCKSTEP_LANES * 2)));
+typedef uint32_t LaneCycles __attribute__((vector_size(LOCKSTEP_LANES * 4)));
+typedef int32_t LaneSignedCycles __attribute__((vector_size(LOCKSTEP_LANES * 4)));
+
+struct LockstepStats {
+    uint64_t vector_instructions; //run in lanes
+    uint64_t scalar_instructions; //run by STEP, because a lane couldn't or had to hand back
+    uint64_t dispatches; //opcode groups executed, vector_instructions / dispatches is the lane use
+    uint64_t entries; //times a machine was loaded into a lane
+};
+
+/*
+ * Experimental: runs machines LOCKSTEP_LANES at a time with their registers in vectors, one
+ * lane per machine. Every round each lane fetches its own opcode, lanes are grouped by opcode
+ * and each group is executed once for all of its lanes under a mask, so machines running the
+ * same code from similar states share every dispatch.
+ *
+ * Only DMG machines without a debugger or coverage run in lanes, and only the instructions that
+ * touch nothing but registers and plain memory pages. A lane is handed back to STEP for anything
+ * else (a trapped page, IO, the stack, an unimplemented lane op) and before the cycle the LCD, an
+ * event or the end of the frame would need it, so no interrupt can become pending while a
+ * machine is in a lane. Each machine ends up exactly where its own RUN_FRAME would leave it.
+ */
+class Lockstep {
+ private:
+  struct Group {
+      CPU_ *machines[LOCKSTEP_LANES] = {};
+      int size = 0;
+      int active_count = 0;
+
+      LaneBytes regs[8] = {}; //B C D E H L F A, in opcode encoding order with F in the (HL) slot
+      LaneWords sp = {};
+      LaneWords pc = {};
+      LaneBytes ime = {};
+      LaneBytes active = {}; //0xFF for lanes holding a machine
+      bool handed_back[LOCKSTEP_LANES] = {}; //left a lane, STEP runs the next instruction
+      LaneCycles left = {}; //cycles a lane may still run before its machine needs STEP
+      LaneCycles spent = {};
+      LaneCycles count = {}; //instructions
+  };
+
+  vector<Group> groups;
+  LockstepStats stats = {};
+
+  bool ENTER(Group &group, int lane);
+  void LEAVE(Group &group, int lane);
+  void ROUND(Group &group);
+  void EXECUTE(Group &group, BYTE opcode, LaneBytes mask);
+  void RUN_GROUP(Group &group);
+
+ public:
+  explicit Lockstep(const vector<CPU_ *> &machines);
+
+  void RUN_FRAME(); //one frame on every machine
+
+  LockstepStats STATS();
+};
+
+#endif //_LOCKSTEP_H_
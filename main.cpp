@@ -1,9 +1,27 @@
 #include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
 #include <filesystem>
 #include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #include "cpu.h"
+#include "debugger.h"
+#include "movie.h"
+#include "pacer.h"
 #include "ppu.h"
+#include "recorder.h"
+#include "resampler.h"
+#include "shmexport.h"
 
 using namespace std;
 namespace fs = std::filesystem;
@@ -11,10 +29,376 @@ namespace fs = std::filesystem;
 string path;
 CPU_ Z80;
 PPU SCREEN;
+SharedExport EXPORT; //only publishes after START, see --shm
+
+static bool LOAD_CARTRIDGE(const string &rom)
+{
+  ifstream Rom;
+  Rom.open(rom, ios::binary);
+  if(!Rom.is_open())
+  {
+    cout << "Could not open " << rom << "!\nQuitting!" << endl;
+    return false;
+  }
+
+  Z80.LOAD_ROM(Rom, fs::file_size(rom));
+  Rom.close();
+  return true;
+}
+
+static bool MODEL_NAME(const string &name, Model &model)
+{
+  static const struct {
+    const char *name;
+    Model model;
+  } MODELS[] = {{"dmg", MODEL_DMG}, {"mgb", MODEL_MGB}, {"cgb", MODEL_CGB}, {"auto", MODEL_AUTO}};
+
+  for(const auto &entry : MODELS)
+  {
+    if(name == entry.name)
+    {
+      model = entry.model;
+      return true;
+    }
+  }
+  return false;
+}
+
+struct HeadlessOptions {
+    long frames = -1; //3600, or the rest of a --movie
+    string record;
+    string profile;
+    string coverage;
+    string input;
+    string movie; //played instead of --input, from frame seek
+    uint64_t seek = 0;
+    string record_movie;
+    string report = "text";
+    bool debug = false;
+};
+
+//the whole of text as a number no bigger than max, false for anything else
+static bool PARSE_NUMBER(const string &text, int base, uint64_t max, uint64_t &value)
+{
+  if(text.empty() || text.find('-') != string::npos)
+    return false;
+
+  char *end;
+  errno = 0;
+  unsigned long long parsed = strtoull(text.c_str(), &end, base);
+  if(*end || errno || parsed > max)
+    return false;
+  value = parsed;
+  return true;
+}
+
+//buttons held on each frame, one hex BUTTON_* mask per line, '#' starts a comment
+static bool LOAD_INPUT(const string &path, vector<BYTE> &input)
+{
+  ifstream file(path);
+  if(!file.is_open())
+    return false;
+
+  string line;
+  for(int number = 1; getline(file, line); number++)
+  {
+    line = line.substr(0, line.find('#'));
+    size_t first = line.find_first_not_of(" \t\r");
+    if(first == string::npos)
+      continue;
+
+    string mask = line.substr(first, line.find_last_not_of(" \t\r") + 1 - first);
+    uint64_t value;
+    if(!PARSE_NUMBER(mask, 16, 0xFF, value))
+    {
+      cout << path << ":" << number << ": " << mask << " isn't a hex button mask" << endl;
+      return false;
+    }
+    input.push_back(value);
+  }
+  return true;
+}
+
+static uint64_t HOST_CYCLES()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static bool REPORT_FORMAT(const string &format)
+{
+  return format == "text" || format == "json" || format == "none";
+}
+
+//what the ops harness reads to size hardware and compare builds
+static void REPORT(const string &format, long frames, double seconds, uint64_t instructions, uint64_t cycles,
+                   uint64_t host_cycles)
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  long peak_rss_kb = usage.ru_maxrss; //kilobytes on Linux
+
+  double fps = frames / seconds;
+  double ips = instructions / seconds;
+  double host_per_cycle = cycles && host_cycles ? (double) host_cycles / cycles : 0;
+
+  if(format == "json")
+  {
+    printf("{\"frames\": %ld, \"seconds\": %.6f, \"frames_per_second\": %.2f, \"realtime\": %.2f, "
+           "\"instructions_per_second\": %.0f, \"emulated_cycles\": %llu, \"host_cycles_per_cycle\": %.3f, "
+           "\"peak_rss_kb\": %ld}\n",
+           frames, seconds, fps, fps / FRAME_RATE, ips, (unsigned long long) cycles, host_per_cycle, peak_rss_kb);
+    return;
+  }
+
+  printf("%ld frames in %.3f s\n", frames, seconds);
+  printf("%.1f frames/s (%.1fx realtime)\n", fps, fps / FRAME_RATE);
+  printf("%.2f M instructions/s\n", ips / 1e6);
+  if(host_per_cycle)
+    printf("%.2f host cycles per emulated cycle\n", host_per_cycle);
+  printf("peak RSS %ld KB\n", peak_rss_kb);
+}
+
+//no window, run as fast as possible and optionally stream everything to disk
+static int RUN_HEADLESS(const HeadlessOptions &options)
+{
+  long frames = options.frames < 0 ? 3600 : options.frames;
+  const string &record = options.record;
+  const string &profile = options.profile;
+
+  if(options.debug)
+  {
+    Debugger debugger;
+    debugger.ATTACH(&Z80);
+    debugger.CONSOLE(cin, cout, frames);
+    return 0;
+  }
+
+  vector<BYTE> input;
+  if(!options.input.empty() && !LOAD_INPUT(options.input, input))
+  {
+    cout << "Could not read input from " << options.input << "!\nQuitting!" << endl;
+    return 1;
+  }
+
+  //the movie's start state holds the ROM, so playing one doesn't need --rom
+  Movie movie;
+  if(!options.movie.empty())
+  {
+    if(!options.record_movie.empty())
+    {
+      cout << "--movie and --record-movie don't go together!\nQuitting!" << endl;
+      return 1;
+    }
+    if(!movie.LOAD(options.movie))
+    {
+      cout << "Could not read the movie " << options.movie << "!\nQuitting!" << endl;
+      return 1;
+    }
+    if(!movie.SEEK(Z80, options.seek))
+    {
+      cout << "Could not seek the movie to frame " << options.seek << "!\nQuitting!" << endl;
+      return 1;
+    }
+    long rest = movie.FRAMES() - options.seek;
+    frames = options.frames < 0 ? rest : min(frames, rest);
+  }
+  else if(!options.record_movie.empty())
+    movie.START(Z80);
+
+  Recorder recorder;
+  //a CGB session records the palette output in colour, a DMG one the four shades
+  if(!record.empty() && !recorder.START(record, OUTPUT_FREQ, Z80.COLOUR_FRAMEBUFFER() != nullptr))
+  {
+    cout << "Could not open " << record << " for recording!\nQuitting!" << endl;
+    return 1;
+  }
+
+  if(!options.coverage.empty())
+    Z80.ENABLE_COVERAGE();
+
+  //there is no APU yet, the resampler is fed silence at the APU rate so the recorder's ring
+  //still steers the output rate the way a sound device draining it would
+  const size_t apu_frames = FULL_FRAME_FREQ / 4; //APU_FREQ / FRAME_RATE
+  vector<float> apu_silence(apu_frames * RESAMPLER_CHANNELS, 0.0f);
+  vector<float> resampled;
+  vector<int16_t> samples;
+  Resampler resampler;
+  Pacer audio_control;
+
+  uint64_t start_instructions = Z80.INSTRUCTION_COUNT();
+  uint64_t start_cycles = Z80.CYCLE_COUNT();
+  uint64_t start_host_cycles = HOST_CYCLES();
+  auto start = chrono::steady_clock::now();
+
+  BYTE held = 0;
+  for(long i = 0; i < frames; i++)
+  {
+    if(!options.movie.empty())
+    {
+      if(!movie.PLAY_FRAME(Z80))
+      {
+        cout << "Movie desynced by frame " << movie.POSITION() << "!" << endl;
+        return 1;
+      }
+    }
+    else
+    {
+      if(i < (long) input.size())
+        held = input[i];
+      if(!options.record_movie.empty())
+        movie.RECORD_FRAME(Z80, held);
+      else
+      {
+        Z80.SET_BUTTONS(held);
+        Z80.RUN_FRAME();
+      }
+    }
+    EXPORT.PUBLISH(Z80);
+
+    if(!record.empty())
+    {
+      if(const WORD *colours = Z80.COLOUR_FRAMEBUFFER())
+        recorder.PUSH_FRAME(colours);
+      else
+        recorder.PUSH_FRAME(Z80.FRAMEBUFFER());
+
+      resampler.SET_RATIO(audio_control.UPDATE_AUDIO(recorder.QUEUED(), RECORDER_SLOTS));
+      resampled.resize(resampler.MAX_OUTPUT(apu_frames) * RESAMPLER_CHANNELS);
+      size_t written = resampler.PROCESS(apu_silence.data(), apu_frames, resampled.data());
+
+      samples.resize(written * RESAMPLER_CHANNELS);
+      for(size_t j = 0; j < samples.size(); j++)
+        samples[j] = (int16_t) clamp(resampled[j] * 32767.0f, -32768.0f, 32767.0f);
+      recorder.PUSH_AUDIO(samples.data(), written);
+    }
+  }
+
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  uint64_t host_cycles = HOST_CYCLES() - start_host_cycles;
+
+  if(!record.empty())
+  {
+    recorder.STOP();
+    RecorderStats stats = recorder.STATS();
+    cout << "Recorded " << stats.frames_written << " frames, dropped " << stats.frames_dropped
+         << " frames and " << stats.audio_blocks_dropped << " audio blocks ("
+         << stats.bytes_written << " bytes)" << endl;
+
+    PacerStats audio = audio_control.STATS();
+    cout << "Audio ring " << (int) (audio.buffer_fill * 100 + 0.5) << "% full, resampling ratio " << audio.resample_ratio
+         << endl;
+  }
+
+  if(!profile.empty())
+  {
+#ifdef PROFILE
+    if(!Z80.PROFILER().WRITE_FOLDED(profile + ".folded") || !Z80.PROFILER().WRITE_OPCODES(profile + ".opcodes.csv")
+       || !Z80.PROFILER().WRITE_SEQUENCES(profile + ".sequences.csv"))
+    {
+      cout << "Could not write the profile to " << profile << "!" << endl;
+      return 1;
+    }
+#else
+    cout << "--profile needs a build configured with -DPROFILE=ON" << endl;
+    return 1;
+#endif
+  }
+
+  if(!options.record_movie.empty() && !movie.SAVE(options.record_movie))
+  {
+    cout << "Could not write the movie to " << options.record_movie << "!" << endl;
+    return 1;
+  }
+
+  if(!options.coverage.empty() && !Z80.WRITE_COVERAGE(options.coverage))
+  {
+    cout << "Could not write the coverage to " << options.coverage << "!" << endl;
+    return 1;
+  }
+
+  if(options.report != "none")
+    REPORT(options.report, frames, seconds, Z80.INSTRUCTION_COUNT() - start_instructions,
+           Z80.CYCLE_COUNT() - start_cycles, host_cycles);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  bool headless = false;
+  HeadlessOptions options;
+  string rom;
+  string shm;
+  Model model = MODEL_AUTO;
+  uint64_t number;
+
+  for(int i = 1; i < argc; i++)
+  {
+    string arg = argv[i];
+    if(arg == "--headless")
+      headless = true;
+    else if(arg == "--rom" && i + 1 < argc)
+      rom = argv[++i];
+    else if(arg == "--frames" && i + 1 < argc && PARSE_NUMBER(argv[i + 1], 10, LONG_MAX, number))
+    {
+      options.frames = number;
+      i++;
+    }
+    else if(arg == "--record" && i + 1 < argc)
+      options.record = argv[++i];
+    else if(arg == "--profile" && i + 1 < argc)
+      options.profile = argv[++i];
+    else if(arg == "--coverage" && i + 1 < argc)
+      options.coverage = argv[++i];
+    else if(arg == "--input" && i + 1 < argc)
+      options.input = argv[++i];
+    else if(arg == "--movie" && i + 1 < argc)
+      options.movie = argv[++i];
+    else if(arg == "--seek" && i + 1 < argc && PARSE_NUMBER(argv[i + 1], 10, UINT64_MAX, options.seek))
+      i++;
+    else if(arg == "--record-movie" && i + 1 < argc)
+      options.record_movie = argv[++i];
+    else if(arg == "--report" && i + 1 < argc && REPORT_FORMAT(argv[i + 1]))
+      options.report = argv[++i];
+    else if(arg == "--debug")
+      options.debug = true;
+    else if(arg == "--shm" && i + 1 < argc)
+      shm = argv[++i];
+    else if(arg == "--model" && i + 1 < argc && MODEL_NAME(argv[i + 1], model))
+      i++;
+    else
+    {
+      cout << "usage: gb++ [--rom FILE] [--model dmg|mgb|cgb|auto] [--shm NAME] [--headless [--frames N] [--input FILE | --movie FILE [--seek FRAME]] [--record-movie FILE] [--report text|json|none] [--record PREFIX] [--profile PREFIX] [--coverage FILE] [--debug]]" << endl;
+      return 1;
+    }
+  }
 
-int main() {
   Z80.INIT_PC();
+  Z80.SET_MODEL(model);
+  if(!rom.empty())
+  {
+    if(!LOAD_CARTRIDGE(rom))
+      exit(1);
+    Z80.INIT_POST_BOOT();
+  }
+
+  if(!shm.empty() && !EXPORT.START(shm))
+  {
+    cout << "Could not create shared memory " << shm << "!\nQuitting!" << endl;
+    return 1;
+  }
+
+  if(headless)
+    return RUN_HEADLESS(options);
+
   SCREEN.RUN();
+
+  PacerStats pacing = SCREEN.PACING_STATS();
+  cout << "Paced " << pacing.frames << " frames, dropped " << pacing.dropped_frames << ", duplicated "
+       << pacing.duplicated_frames << ", " << pacing.resyncs << " resyncs, " << pacing.drift * 1000
+       << " ms behind at exit" << endl;
 /*
   //path = "../games/tetris.gb";
   path = "../bootroms/dmg_boot.bin";
@@ -0,0 +1,175 @@
+#include "cpu.h"
+
+#include <cstring>
+
+//ROM, cartridge RAM and WRAM live in reference counted 256 byte pages, the same granularity as
+//the bus tables. A fork takes a reference to every page instead of copying, and writable pages
+//held by more than one machine are trapped with TRAP_SHARED so the first write through the bus
+//copies just that page. Everything starts out on one all zero page nobody ever owns
+
+static MemoryPage ZERO_PAGE; //its own reference keeps it alive
+
+static MemoryPage *ACQUIRE(MemoryPage *page)
+{
+  page->refs.fetch_add(1, memory_order_relaxed);
+  return page;
+}
+
+static void RELEASE(MemoryPage *page)
+{
+  if(page->refs.fetch_sub(1, memory_order_acq_rel) == 1)
+    delete page;
+}
+
+bool CPU_::PAGED(int page)
+{
+  return page < 0x80 || (page >= 0xA0 && page < 0xE0);
+}
+
+//VRAM or the 0xFE00 - 0xFFFF page, everything else on the bus is PAGED or an echo
+BYTE *CPU_::UNPAGED(int page)
+{
+  if(page >= 0xFE)
+    return &high[(page - 0xFE) << 8];
+  return &vram[(page - 0x80) << 8];
+}
+
+RomImage::RomImage(const BYTE *data, size_t size)
+{
+  if(size > 0x8000)
+    size = 0x8000;
+  for(int page = 0; page < 0x80; page++)
+  {
+    size_t offset = page << 8;
+    if(offset >= size)
+    {
+      pages[page] = ACQUIRE(&ZERO_PAGE);
+      continue;
+    }
+    pages[page] = new MemoryPage;
+    memcpy(pages[page]->data, &data[offset], min<size_t>(size - offset, 0x100));
+  }
+}
+
+RomImage::~RomImage()
+{
+  for(MemoryPage *page : pages)
+    RELEASE(page);
+}
+
+//ROM is never written through the bus, so the pages stay shared for as long as anyone holds them
+void CPU_::LOAD_ROM(const RomImage &rom)
+{
+  for(int page = 0; page < 0x80; page++)
+  {
+    RELEASE(memory[page]);
+    memory[page] = ACQUIRE(rom.pages[page]);
+    read_map[page] = memory[page]->data;
+    UPDATE_PAGE(page);
+  }
+  DETECT_MODEL();
+  FIND_AOT();
+
+  if(coverage)
+    coverage = make_unique<CoverageState>(); //a record of the old ROM says nothing about this one
+}
+
+size_t CPU_::RESIDENT_BYTES()
+{
+  size_t bytes = sizeof(CPU_);
+  if(cgb)
+    bytes += sizeof(CgbState);
+  if(hashing)
+    bytes += sizeof(HashState);
+  if(coverage)
+    bytes += sizeof(CoverageState);
+  for(MemoryPage *page : memory)
+  {
+    if(page && page != &ZERO_PAGE && page->refs.load(memory_order_relaxed) == 1)
+      bytes += sizeof(MemoryPage);
+  }
+  return bytes;
+}
+
+CPU_::CPU_()
+{
+  for(int page = 0; page < PAGE_COUNT; page++)
+  {
+    if(PAGED(page))
+      memory[page] = ACQUIRE(&ZERO_PAGE);
+  }
+
+  MAP_PAGES();
+  MAP_IO();
+}
+
+CPU_::~CPU_()
+{
+  for(MemoryPage *page : memory)
+  {
+    if(page)
+      RELEASE(page);
+  }
+}
+
+//ROM has no write mapping, so only RAM pages need trapping, in WRAM along with their echo
+void CPU_::SHARE_TRAPS()
+{
+  for(int page = 0xA0; page < 0xE0; page++)
+  {
+    bool shared = memory[page]->refs.load(memory_order_acquire) > 1;
+    SET_PAGE_TRAP(page, TRAP_SHARED, shared);
+    if(page >= 0xC0 && page + 0x20 < 0xFE)
+      SET_PAGE_TRAP(page + 0x20, TRAP_SHARED, shared);
+  }
+}
+
+//hands every page to another machine as well, both of them copy on their next write
+void CPU_::SHARE_PAGES(CPU_ &other)
+{
+  for(int page = 0; page < PAGE_COUNT; page++)
+  {
+    if(!PAGED(page))
+      continue;
+    RELEASE(other.memory[page]);
+    other.memory[page] = ACQUIRE(memory[page]);
+  }
+  SHARE_TRAPS();
+}
+
+//makes a page this machine's alone, copying it if anyone else still holds it. Takes the bus
+//page, an echo page means the WRAM page it mirrors
+BYTE *CPU_::OWN_PAGE(int page)
+{
+  if(page >= 0xE0 && page < 0xFE)
+    page -= 0x20;
+
+  MemoryPage *shared = memory[page];
+  if(shared->refs.load(memory_order_acquire) > 1)
+  {
+    MemoryPage *copy = new MemoryPage;
+    memcpy(copy->data, shared->data, sizeof(copy->data));
+    memory[page] = copy;
+
+    //a CGB WRAM bank mapped over the page keeps its mapping
+    for(int bus : {page, page + 0x20})
+    {
+      if(bus > 0xFD || (bus != page && page < 0xC0))
+        continue;
+      if(read_map[bus] == shared->data)
+        read_map[bus] = copy->data;
+      if(write_map[bus] == shared->data)
+        write_map[bus] = copy->data;
+      UPDATE_PAGE(bus);
+    }
+    RELEASE(shared);
+  }
+
+  if(page >= 0xA0)
+  {
+    SET_PAGE_TRAP(page, TRAP_SHARED, false);
+    if(page >= 0xC0 && page + 0x20 < 0xFE)
+      SET_PAGE_TRAP(page + 0x20, TRAP_SHARED, false);
+  }
+  return memory[page]->data;
+}
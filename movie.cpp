@@ -0,0 +1,231 @@
+#include "movie.h"
+
+#include <algorithm>
+#include <fstream>
+
+template<typename T>
+static void PUT(ofstream &file, const T *values, size_t count)
+{
+  file.write(reinterpret_cast<const char *>(values), count * sizeof(T));
+}
+
+template<typename T>
+static bool GET(ifstream &file, vector<T> &values, uint64_t count)
+{
+  values.resize(count);
+  file.read(reinterpret_cast<char *>(values.data()), count * sizeof(T));
+  return (bool) file;
+}
+
+Movie::Movie(uint32_t hash_interval, uint32_t keyframe_interval)
+{
+  this->hash_interval = max<uint32_t>(hash_interval, 1);
+  this->keyframe_interval = max<uint32_t>(keyframe_interval, 1);
+}
+
+void Movie::START(CPU_ &machine)
+{
+  machine.SAVE_STATE(start);
+  buttons.clear();
+  hashes.clear();
+  index.clear();
+  keyframes.clear();
+  path.clear();
+  position = 0;
+}
+
+void Movie::RECORD_FRAME(CPU_ &machine, BYTE pressed)
+{
+  if(position < buttons.size())
+  {
+    //a state after position frames is still this movie's, anything later isn't
+    buttons.resize(position);
+    hashes.resize(position / hash_interval);
+    while(!index.empty() && index.back().frame > position)
+    {
+      index.pop_back();
+      keyframes.pop_back();
+    }
+  }
+
+  buttons.push_back(pressed);
+  machine.SET_BUTTONS(pressed);
+  machine.RUN_WHOLE_FRAME(); //a breakpoint doesn't split a movie frame
+  FINISH_FRAME(machine, true);
+}
+
+bool Movie::PLAY_FRAME(CPU_ &machine)
+{
+  if(position >= buttons.size())
+    return false;
+
+  machine.SET_BUTTONS(buttons[position]);
+  machine.RUN_WHOLE_FRAME();
+  return FINISH_FRAME(machine, false);
+}
+
+//the hash and keyframe due after the frame that just ran, recorded or checked against the recording
+bool Movie::FINISH_FRAME(CPU_ &machine, bool recording)
+{
+  position++;
+
+  if(position % hash_interval == 0)
+  {
+    uint64_t hash = machine.STATE_HASH();
+    size_t check = position / hash_interval - 1;
+    if(recording)
+      hashes.push_back(hash);
+    else if(check < hashes.size() && hashes[check] != hash)
+      return false;
+  }
+
+  if(recording && position % keyframe_interval == 0)
+  {
+    keyframes.emplace_back();
+    machine.SAVE_STATE(keyframes.back());
+    index.push_back({position, 0, keyframes.back().size()});
+  }
+  return true;
+}
+
+bool Movie::SEEK(CPU_ &machine, uint64_t frame)
+{
+  if(frame > buttons.size())
+    return false;
+
+  //the last keyframe at or before frame, or the start state
+  auto after = upper_bound(index.begin(), index.end(), frame,
+                           [](uint64_t at, const MovieKeyframe &keyframe) { return at < keyframe.frame; });
+  const vector<BYTE> *state = &start;
+  uint64_t from = 0;
+  if(after != index.begin())
+  {
+    size_t entry = after - index.begin() - 1;
+    if(!KEYFRAME(entry))
+      return false;
+    state = &keyframes[entry];
+    from = index[entry].frame;
+  }
+
+  if(!machine.LOAD_STATE(*state))
+    return false;
+  position = from;
+  while(position < frame)
+  {
+    if(!PLAY_FRAME(machine))
+      return false;
+  }
+  return true;
+}
+
+bool Movie::KEYFRAME(size_t entry)
+{
+  if(!keyframes[entry].empty())
+    return true;
+
+  ifstream file(path, ios::binary);
+  file.seekg(index[entry].offset);
+  return GET(file, keyframes[entry], index[entry].size);
+}
+
+bool Movie::SAVE(const string &file)
+{
+  //every keyframe in memory first, file may be the one they would be read from
+  for(size_t entry = 0; entry < index.size(); entry++)
+  {
+    if(!KEYFRAME(entry))
+      return false;
+  }
+
+  MovieHeader header;
+  header.hash_interval = hash_interval;
+  header.keyframe_interval = keyframe_interval;
+  header.frames = buttons.size();
+  header.start_size = start.size();
+  header.hashes = hashes.size();
+  header.keyframes = index.size();
+
+  uint64_t offset = sizeof(header) + start.size() + buttons.size() + hashes.size() * sizeof(uint64_t)
+                    + index.size() * sizeof(MovieKeyframe);
+  for(MovieKeyframe &keyframe : index)
+  {
+    keyframe.offset = offset;
+    offset += keyframe.size;
+  }
+
+  ofstream out(file, ios::binary | ios::trunc);
+  PUT(out, &header, 1);
+  PUT(out, start.data(), start.size());
+  PUT(out, buttons.data(), buttons.size());
+  PUT(out, hashes.data(), hashes.size());
+  PUT(out, index.data(), index.size());
+  for(const vector<BYTE> &state : keyframes)
+    PUT(out, state.data(), state.size());
+  out.close();
+  if(!out)
+    return false;
+
+  path = file;
+  return true;
+}
+
+//reads everything but the keyframe states, which SEEK reads one at a time. A file that doesn't
+//make sense leaves the movie as it was
+bool Movie::LOAD(const string &file)
+{
+  ifstream in(file, ios::binary | ios::ate);
+  uint64_t size = in.tellg();
+  in.seekg(0);
+  MovieHeader header;
+  in.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if(!in || header.magic != MOVIE_MAGIC || header.version != MOVIE_VERSION || !header.hash_interval
+     || !header.keyframe_interval)
+    return false;
+
+  //sizes checked against the file before anything is allocated for them
+  const uint64_t sections[][2] = {{header.start_size, 1}, {header.frames, 1}, {header.hashes, sizeof(uint64_t)},
+                                  {header.keyframes, sizeof(MovieKeyframe)}};
+  uint64_t left = size - sizeof(header);
+  for(const auto &section : sections)
+  {
+    if(section[0] > left / section[1])
+      return false;
+    left -= section[0] * section[1];
+  }
+
+  vector<BYTE> loaded_start;
+  vector<BYTE> loaded_buttons;
+  vector<uint64_t> loaded_hashes;
+  vector<MovieKeyframe> loaded_index;
+  if(!GET(in, loaded_start, header.start_size) || !GET(in, loaded_buttons, header.frames)
+     || !GET(in, loaded_hashes, header.hashes) || !GET(in, loaded_index, header.keyframes))
+    return false;
+  for(size_t entry = 0; entry < loaded_index.size(); entry++)
+  {
+    const MovieKeyframe &keyframe = loaded_index[entry];
+    if(keyframe.frame > header.frames || (entry && keyframe.frame <= loaded_index[entry - 1].frame)
+       || keyframe.offset > size || keyframe.size > size - keyframe.offset)
+      return false;
+  }
+
+  hash_interval = header.hash_interval;
+  keyframe_interval = header.keyframe_interval;
+  start.swap(loaded_start);
+  buttons.swap(loaded_buttons);
+  hashes.swap(loaded_hashes);
+  index.swap(loaded_index);
+  keyframes.assign(index.size(), {});
+  path = file;
+  position = 0;
+  return true;
+}
+
+uint64_t Movie::FRAMES()
+{
+  return buttons.size();
+}
+
+uint64_t Movie::POSITION()
+{
+  return position;
+}
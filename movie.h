@@ -0,0 +1,89 @@
+#ifndef _MOVIE_H_
+#define _MOVIE_H_
+
+#include "cpu.h"
+
+#include <string>
+#include <vector>
+
+#define MOVIE_HASH_INTERVAL 60 //frames between desync checks, about a second
+#define MOVIE_KEYFRAME_INTERVAL 600 //frames between embedded save states, the most a seek replays
+
+/*
+ * Input movies, for replaying a run bit for bit. A movie is the save state it started from, the
+ * SET_BUTTONS mask held for each frame after it (what the game sees through JOYP), a STATE_HASH
+ * every hash_interval frames and a save state every keyframe_interval frames. The start state
+ * holds the ROM, so a movie plays without one.
+ *
+ * File layout, all little endian:
+ *
+ *   MovieHeader
+ *   start state          header.start_size bytes
+ *   buttons              header.frames bytes, one per frame
+ *   hashes               header.hashes uint64_t, after frame (i + 1) * hash_interval
+ *   index                header.keyframes MovieKeyframe, ascending by frame
+ *   keyframe states      where the index says
+ *
+ * Everything up to the index is read by LOAD, keyframe states only when SEEK needs one, so
+ * seeking costs one keyframe and at most keyframe_interval frames however long the movie is.
+ */
+
+#define MOVIE_MAGIC 0x564D4247 //"GBMV"
+#define MOVIE_VERSION 1
+
+struct MovieHeader {
+    uint32_t magic = MOVIE_MAGIC;
+    uint32_t version = MOVIE_VERSION;
+    uint32_t hash_interval = MOVIE_HASH_INTERVAL;
+    uint32_t keyframe_interval = MOVIE_KEYFRAME_INTERVAL;
+    uint64_t frames = 0;
+    uint64_t start_size = 0;
+    uint64_t hashes = 0;
+    uint64_t keyframes = 0;
+};
+
+struct MovieKeyframe {
+    uint64_t frame; //the state after this many frames, a multiple of keyframe_interval
+    uint64_t offset; //from the start of the file
+    uint64_t size;
+};
+
+class Movie {
+ private:
+  uint32_t hash_interval;
+  uint32_t keyframe_interval;
+
+  vector<BYTE> start;
+  vector<BYTE> buttons;
+  vector<uint64_t> hashes;
+  vector<MovieKeyframe> index;
+  vector<vector<BYTE>> keyframes; //by index entry, empty until recorded or read from path
+  string path; //the file LOAD read, where the other keyframes are
+
+  uint64_t position = 0; //frames from the start state, the next one to record or play
+
+  bool KEYFRAME(size_t entry); //reads an index entry's state from path unless it's in memory
+  bool FINISH_FRAME(CPU_ &machine, bool recording);
+
+ public:
+  Movie(uint32_t hash_interval = MOVIE_HASH_INTERVAL, uint32_t keyframe_interval = MOVIE_KEYFRAME_INTERVAL);
+
+  //starts a new movie from where the machine is
+  void START(CPU_ &machine);
+  //runs a frame with pressed held and appends it. Recording anywhere but the end, after a SEEK,
+  //drops the rest of the movie first
+  void RECORD_FRAME(CPU_ &machine, BYTE pressed);
+  bool SAVE(const string &file);
+
+  bool LOAD(const string &file);
+  //puts the machine where it was after frame frames, from the nearest keyframe before it. False
+  //if that's past the end, a state doesn't load or the frames on the way desync
+  bool SEEK(CPU_ &machine, uint64_t frame);
+  //runs the next frame as recorded, false past the end or if the machine no longer matches
+  bool PLAY_FRAME(CPU_ &machine);
+
+  uint64_t FRAMES();
+  uint64_t POSITION();
+};
+
+#endif //_MOVIE_H_
@@ -1,15 +1,25 @@
 #include "cpu.h"
 #include <cstdio>
+#include <cstring>
 
 void CPU_::OPCODE_HANDLER()
 {
   bool jumped;
+  BYTE operand; //read-modify-write on (HL)
 
-  if(Space.Space[PC] != 0xCB)
+#ifdef PROFILE
+  WORD profiled_pc = PC;
+  WORD profiled_opcode = FETCH(PC) == 0xCB ? 0x100 | FETCH(PC + 1) : FETCH(PC);
+  uint64_t profiled_cycles = cycles;
+#endif
+
+  if(FETCH(PC) != 0xCB)
   {
-    printf("0x%.2x\n", Space.Space[PC]);
+#ifdef TRACE_OPCODES
+    printf("0x%.2x\n", FETCH(PC));
+#endif
 
-    switch(Space.Space[PC])
+    switch(FETCH(PC))
     {
       case 0x00:
         //NOP
@@ -24,7 +34,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x02:
-        LD(Space.Space[BC.reg], AF.hi);
+        WRITE(BC.reg, AF.hi);
         PC += 1;
         cycles += 8;
         break;
@@ -66,7 +76,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x0A:
-        LD(AF.hi, Space.Space[BC.reg]);
+        LD(AF.hi, READ_DATA(BC.reg));
         PC += 1;
         cycles += 8;
         break;
@@ -108,7 +118,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x12:
-        LD(Space.Space[BC.reg], AF.hi);
+        WRITE(BC.reg, AF.hi);
         PC += 1;
         cycles += 8;
         break;
@@ -156,7 +166,9 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x1A:
-        LD(AF.hi, Space.Space[DE.reg]);
+        if(FUSED_COPY(false))
+          break;
+        LD(AF.hi, READ_DATA(DE.reg));
         PC += 1;
         cycles += 8;
         break;
@@ -205,7 +217,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x22:
-        LD(Space.Space[HL.reg], AF.hi);
+        WRITE(HL.reg, AF.hi);
         HL.reg++;
         PC += 1;
         cycles += 8;
@@ -231,7 +243,9 @@ void CPU_::OPCODE_HANDLER()
           break;
 
       case 0x2A:
-        LD(AF.hi, Space.Space[HL.reg]);
+        if(FUSED_COPY(true))
+          break;
+        LD(AF.hi, READ_DATA(HL.reg));
         HL.reg += 1;
         PC += 1;
         cycles += 8;
@@ -250,7 +264,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x32:
-        LD(Space.Space[HL.reg], AF.hi);
+        WRITE(HL.reg, AF.hi);
         HL.reg--;
         PC += 1;
         cycles += 8;
@@ -263,19 +277,23 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x34:
-        INC(Space.Space[HL.reg]);
+        operand = READ_DATA(HL.reg);
+        INC(operand);
+        WRITE(HL.reg, operand);
         PC += 1;
         cycles += 12;
         break;
 
       case 0x35:
-        DEC(Space.Space[HL.reg]);
+        operand = READ_DATA(HL.reg);
+        DEC(operand);
+        WRITE(HL.reg, operand);
         PC += 1;
         cycles += 12;
         break;
 
       case 0x36:
-        LD(Space.Space[HL.reg], GET_BYTE());
+        WRITE(HL.reg, GET_BYTE());
         PC += 2;
         cycles += 12;
         break;
@@ -287,7 +305,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x3A:
-        LD(AF.hi, Space.Space[HL.reg]);
+        LD(AF.hi, READ_DATA(HL.reg));
         HL.reg -= 1;
         PC += 1;
         cycles += 8;
@@ -354,7 +372,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x46:
-        LD(BC.hi, Space.Space[HL.reg]);
+        LD(BC.hi, READ_DATA(HL.reg));
         PC += 1;
         cycles += 8;
         break;
@@ -402,7 +420,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x4E:
-        LD(BC.lo, Space.Space[HL.reg]);
+        LD(BC.lo, READ_DATA(HL.reg));
         PC += 1;
         cycles += 8;
         break;
@@ -450,7 +468,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x56:
-        LD(DE.hi, Space.Space[HL.reg]);
+        LD(DE.hi, READ_DATA(HL.reg));
         PC += 1;
         cycles += 8;
         break;
@@ -498,7 +516,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x5E:
-        LD(DE.lo, Space.Space[HL.reg]);
+        LD(DE.lo, READ_DATA(HL.reg));
         PC += 1;
         cycles += 8;
         break;
@@ -546,7 +564,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x66:
-        LD(HL.hi, Space.Space[HL.reg]);
+        LD(HL.hi, READ_DATA(HL.reg));
         PC += 1;
         cycles += 8;
         break;
@@ -594,7 +612,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x6E:
-        LD(HL.lo, Space.Space[HL.reg]);
+        LD(HL.lo, READ_DATA(HL.reg));
         PC += 1;
         cycles += 8;
         break;
@@ -606,37 +624,37 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x70:
-        LD(Space.Space[HL.reg], BC.hi);
+        WRITE(HL.reg, BC.hi);
         PC += 1;
         cycles += 8;
         break;
 
       case 0x71:
-        LD(Space.Space[HL.reg], BC.lo);
+        WRITE(HL.reg, BC.lo);
         PC += 1;
         cycles += 8;
         break;
 
       case 0x72:
-        LD(Space.Space[HL.reg], DE.hi);
+        WRITE(HL.reg, DE.hi);
         PC += 1;
         cycles += 8;
         break;
 
       case 0x73:
-        LD(Space.Space[HL.reg], DE.lo);
+        WRITE(HL.reg, DE.lo);
         PC += 1;
         cycles += 8;
         break;
 
       case 0x74:
-        LD(Space.Space[HL.reg], HL.hi);
+        WRITE(HL.reg, HL.hi);
         PC += 1;
         cycles += 8;
         break;
 
       case 0x75:
-        LD(Space.Space[HL.reg], HL.lo);
+        WRITE(HL.reg, HL.lo);
         PC += 1;
         cycles += 8;
         break;
@@ -648,7 +666,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x77:
-        LD(Space.Space[HL.reg], AF.hi);
+        WRITE(HL.reg, AF.hi);
         PC += 1;
         cycles += 8;
         break;
@@ -690,7 +708,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x7E:
-        LD(AF.hi, Space.Space[HL.reg]);
+        LD(AF.hi, READ_DATA(HL.reg));
         PC += 1;
         cycles += 8;
         break;
@@ -738,7 +756,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0x86:
-        ADD(AF.hi, Space.Space[HL.reg]);
+        ADD(AF.hi, READ_DATA(HL.reg));
         PC += 1;
         cycles += 8;
         break;
@@ -789,7 +807,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0xE0:
-        LD(Space.Space[0xFF00 + GET_BYTE()], AF.hi);
+        WRITE(0xFF00 + GET_BYTE(), AF.hi);
         PC += 2;
         cycles += 8;
         break;
@@ -801,7 +819,7 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0xE2:
-        LD(Space.Space[BC.lo + 0xFF00], AF.hi);
+        WRITE(BC.lo + 0xFF00, AF.hi);
         PC += 1;
         cycles += 8;
         break;
@@ -812,13 +830,15 @@ void CPU_::OPCODE_HANDLER()
         break;
 
       case 0xEA:
-        LD(Space.Space[GET_WORD()], AF.hi);
+        WRITE(GET_WORD(), AF.hi);
         PC += 3;
         cycles += 16;
         break;
 
       case 0xF0:
-        LD(AF.hi, Space.Space[0xFF00 + GET_BYTE()]);
+        if(FUSED_POLL())
+          break;
+        LD(AF.hi, READ(0xFF00 + GET_BYTE()));
         PC += 2;
         cycles += 12;
         break;
@@ -841,17 +861,23 @@ void CPU_::OPCODE_HANDLER()
         cycles += 8;
         break;
 
+      default:
+        //not implemented yet, stall on it but keep the clock running so frames still complete
+        cycles += 4;
+        break;
     }
 
   }
   else //extension
   {
-    printf("0x%x%.2x\n", Space.Space[PC], Space.Space[PC + 1]);
+#ifdef TRACE_OPCODES
+    printf("0x%x%.2x\n", FETCH(PC), FETCH(PC + 1));
+#endif
 
     PC += 1;
 
     //extension handler
-    switch(Space.Space[PC])
+    switch(FETCH(PC))
     {
       case 0x11:
         RL(BC.lo);
@@ -865,13 +891,141 @@ void CPU_::OPCODE_HANDLER()
         cycles += 8;
         break;
 
+      default:
+        PC -= 1; //stall on the 0xCB prefix like above
+        cycles += 8;
+        break;
     }
   }
+
+#ifdef PROFILE
+  profiler.OPCODE(profiled_opcode, cycles - profiled_cycles, BANK_OF(profiled_pc), profiled_pc);
+#endif
 };
 
+/*
+ * Superinstructions, for the idioms at the top of a --profile run's sequences.csv. Each runs a
+ * whole loop of the idiom in one dispatch, as many times around as fits before HORIZON, and adds
+ * the cycles and instructions the separate opcodes would have. Only while nothing can happen in
+ * between: HORIZON rules out a pending interrupt, the debugger and the profiler, and the loops
+ * stop at the first access to a trapped page. If not even one time around fits, the lead opcode
+ * runs on its own like any other and STEP gets to the rest one at a time.
+ */
+
+//the six bytes of an idiom at PC, straight from a plain page
+bool CPU_::MATCH_IDIOM(const BYTE *idiom)
+{
+  BYTE *code = read_pages[PC >> 8];
+  if(!code || (PC & 0xFF) > 0xFA)
+    return false;
+  return !memcmp(&code[PC & 0xFF], idiom, 6);
+}
+
+//LD A,(HL+) / LD (BC),A / INC DE / DEC C / JR NZ back, the memcpy loop as 0x12 runs it here, or
+//LD A,(DE) / LD (HL+),A / INC DE / DEC C / JR NZ back with from_hl false. 40 cycles a time
+//around, 36 the last
+bool CPU_::FUSED_COPY(bool from_hl)
+{
+  static const BYTE FROM_HL[] = {0x2A, 0x12, 0x13, 0x0D, 0x20, 0xFA};
+  static const BYTE FROM_DE[] = {0x1A, 0x22, 0x13, 0x0D, 0x20, 0xFA};
+  if(!MATCH_IDIOM(from_hl ? FROM_HL : FROM_DE))
+    return false;
+
+  WORD lead = PC;
+  WORD first = from_hl ? HL.reg : DE.reg;
+  uint64_t horizon = HORIZON();
+  uint64_t spent = 0;
+  int count = 0;
+  while(spent + 40 < horizon)
+  {
+    WORD source = from_hl ? HL.reg : DE.reg;
+    WORD destination = from_hl ? BC.reg : HL.reg;
+    BYTE *from = read_pages[source >> 8];
+    BYTE *to = write_pages[destination >> 8];
+    if(!from || !to || (WORD) (destination - PC) < 6)
+      break; //a trap, or the loop writing over itself
+
+    AF.hi = from[source & 0xFF];
+    to[destination & 0xFF] = AF.hi;
+    HL.reg++;
+    DE.reg++;
+    DEC(BC.lo);
+    count += 5;
+
+    if(GET_FLAG(ZERO_FLAG))
+    {
+      spent += 36;
+      PC += 6;
+      break;
+    }
+    spent += 40;
+  }
+  if(!count)
+    return false;
+
+  if(coverage)
+  {
+    for(int offset = 0; offset < 5; offset++)
+      COVER_CODE(lead + offset);
+    COVER_DATA(first, count / 5);
+  }
+
+  cycles += spent;
+  instructions += count - 1; //STEP counts the last
+  return true;
+}
+
+//LDH A,(n) / CP m / JR NZ back, waiting on a register. 32 cycles a time around, 28 the last.
+//The read goes through the IO handlers each time with the clock where it would be
+bool CPU_::FUSED_POLL()
+{
+  BYTE *code = read_pages[PC >> 8];
+  if(!code || (PC & 0xFF) > 0xFA)
+    return false;
+  const BYTE *at = &code[PC & 0xFF];
+  if(at[2] != 0xFE || at[4] != 0x20 || at[5] != 0xFA)
+    return false;
+  WORD address = 0xFF00 + at[1];
+  BYTE value = at[3];
+
+  WORD lead = PC;
+  uint64_t horizon = HORIZON();
+  uint64_t start = cycles;
+  int count = 0;
+  while(cycles - start + 32 < horizon)
+  {
+    LD(AF.hi, READ(address));
+    CP(value);
+    count += 3;
+
+    if(GET_FLAG(ZERO_FLAG))
+    {
+      cycles += 28;
+      PC += 6;
+      break;
+    }
+    cycles += 32;
+  }
+  if(!count)
+    return false;
+
+  if(coverage)
+  {
+    for(int offset = 0; offset < 6; offset += 2)
+      COVER_CODE(lead + offset);
+  }
+
+  instructions += count - 1;
+  return true;
+}
+
 void CPU_::RET()
 {
   POP(PC);
+
+#ifdef PROFILE
+  profiler.RET();
+#endif
 }
 
 template<typename T>
@@ -886,8 +1040,8 @@ void CPU_::LD_W(T DEST, T SRC)
 
   if(sizeof(SRC) == sizeof(WORD))
   {
-    Space.Space[DEST] = (BYTE) (SRC & 0xFF00) >> 8;
-    Space.Space[DEST + 1] = (BYTE) (SRC & 0xFF);
+    WRITE(DEST, (BYTE) (SRC & 0xFF00) >> 8);
+    WRITE(DEST + 1, (BYTE) (SRC & 0xFF));
   }
 }
 template<typename T>
@@ -1044,6 +1198,10 @@ void CPU_::CALL(T ADDR)
 {
   PUSH(PC + 3);
   PC = ADDR;
+
+#ifdef PROFILE
+  profiler.CALL(BANK_OF(ADDR), ADDR);
+#endif
 }
 
 template<typename T>
@@ -1186,8 +1344,8 @@ template<typename T>
 void CPU_::POP(T &REG)
 {
   RegisterPair temp;
-  temp.lo = Space.Space[SP++];
-  temp.hi = Space.Space[SP++];
+  temp.lo = READ(SP++);
+  temp.hi = READ(SP++);
 
   REG = temp.reg;
 }
@@ -1200,9 +1358,9 @@ void CPU_::PUSH(T REG)
   temp.lo = REG & 0xFF;
   temp.hi = REG >> 8;
   SP--;
-  Space.Space[SP] = temp.hi;
+  WRITE(SP, temp.hi);
   SP--;
-  Space.Space[SP] = temp.lo;
+  WRITE(SP, temp.lo);
 }
 
 template<typename T>
@@ -1213,5 +1371,6 @@ void CPU_::JP(T ADDR)
 
 void CPU_::STOP()
 {
-
+  if(cgb && (IO(KEY1) & 0x01))
+    SWITCH_SPEED();
 }
\ No newline at end of file
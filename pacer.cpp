@@ -0,0 +1,96 @@
+#include "pacer.h"
+
+#include <algorithm>
+#include <thread>
+
+void Pacer::START()
+{
+  start = clock::now();
+  frames_due = 0;
+  stats = PacerStats{};
+  stats.buffer_fill = fill;
+  stats.resample_ratio = 1.0;
+}
+
+double Pacer::ELAPSED()
+{
+  return chrono::duration<double>(clock::now() - start).count();
+}
+
+void Pacer::SLEEP_UNTIL(double deadline)
+{
+  double remaining = deadline - ELAPSED();
+
+  //sleep for the bulk of the wait, the OS wakes us up late by a varying amount
+  if(remaining > spin_margin)
+  {
+    double requested = remaining - spin_margin;
+    double before = ELAPSED();
+    this_thread::sleep_for(chrono::duration<double>(requested));
+    double overslept = ELAPSED() - before - requested;
+
+    //learn how late this machine wakes us so the spin window stays short
+    spin_margin = spin_margin * 0.9 + clamp(overslept * 1.5 + 0.0002, 0.0005, 0.004) * 0.1;
+  }
+
+  //spin the last stretch for an accurate deadline
+  while(ELAPSED() < deadline)
+    this_thread::yield();
+}
+
+int Pacer::NEXT_FRAME(bool block)
+{
+  const double period = 1.0 / FRAME_RATE;
+
+  if(block)
+    SLEEP_UNTIL((frames_due + 1) * period);
+
+  double now = ELAPSED();
+  int due = (int) ((int64_t) (now / period) - (int64_t) frames_due);
+
+  if(due > MAX_CATCHUP_FRAMES)
+  {
+    //too far behind to catch up (debugger pause, window drag, slow host), start over from here
+    start = clock::now() - chrono::duration_cast<clock::duration>(chrono::duration<double>(period));
+    frames_due = 0;
+    now = period;
+    due = 1;
+    stats.resyncs++;
+  }
+
+  if(due == 0)
+    stats.duplicated_frames++;
+  else
+    stats.dropped_frames += due - 1;
+
+  frames_due += due;
+  stats.frames += due;
+  stats.drift = now - frames_due * period;
+
+  return due;
+}
+
+double Pacer::UPDATE_AUDIO(size_t fill_level, size_t capacity)
+{
+  double level = capacity ? (double) fill_level / capacity : AUDIO_TARGET_FILL;
+
+  //smooth out the jitter of the ring draining in bursts
+  fill = fill * 0.95 + level * 0.05;
+
+  stats.buffer_fill = fill;
+  stats.resample_ratio = AUDIO_RATIO(fill);
+
+  return stats.resample_ratio;
+}
+
+double AUDIO_RATIO(double fill)
+{
+  //running dry -> produce slightly more samples, filling up -> slightly fewer
+  double error = (AUDIO_TARGET_FILL - fill) / AUDIO_TARGET_FILL;
+  return 1.0 + clamp(error, -1.0, 1.0) * RATE_ADJUST_MAX;
+}
+
+PacerStats Pacer::STATS()
+{
+  return stats;
+}
@@ -0,0 +1,56 @@
+#ifndef _PACER_H_
+#define _PACER_H_
+
+#include "cpu.h"
+
+#include <chrono>
+#include <cstddef>
+
+#define FRAME_RATE ((double) CPU_FREQ / FULL_FRAME_FREQ) //59.7275Hz
+#define RATE_ADJUST_MAX 0.005 //audio resampling ratio may move +-0.5%
+#define AUDIO_TARGET_FILL 0.5 //aim to keep the audio ring half full
+#define MAX_CATCHUP_FRAMES 4 //further behind than this and we resync instead
+
+struct PacerStats {
+    double buffer_fill; //smoothed audio ring fill level, 0.0 - 1.0
+    double drift; //seconds the emulation is behind (+) or ahead (-) of the wall clock
+    double resample_ratio;
+    uint64_t frames;
+    uint64_t dropped_frames; //emulated but never presented
+    uint64_t duplicated_frames; //presented again because no new frame was due, NEXT_FRAME(false) only
+    uint64_t resyncs;
+};
+
+class Pacer {
+ private:
+  using clock = std::chrono::steady_clock;
+
+  clock::time_point start;
+  uint64_t frames_due = 0; //frames handed out since start (or the last resync)
+
+  double spin_margin = 0.002; //seconds before a deadline we stop sleeping and spin
+  double fill = AUDIO_TARGET_FILL;
+
+  PacerStats stats{};
+
+  double ELAPSED();
+  void SLEEP_UNTIL(double deadline);
+
+ public:
+  void START();
+
+  //returns how many emulated frames should run before the next present
+  //0 means present the previous frame again, more than 1 means drop frames
+  //blocking waits for the next frame to be due, so only NEXT_FRAME(false) ever returns 0
+  int NEXT_FRAME(bool block = true);
+
+  //feed the audio ring fill level, returns the resampling ratio to use
+  double UPDATE_AUDIO(size_t fill_level, size_t capacity);
+
+  PacerStats STATS();
+};
+
+//resampling ratio for a smoothed ring fill level, above 1.0 when the ring is running dry
+double AUDIO_RATIO(double fill);
+
+#endif //_PACER_H_
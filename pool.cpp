@@ -0,0 +1,269 @@
+#include "pool.h"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//latency buckets are quarter powers of two, the exponent and the next two bits of the value
+static int LATENCY_BUCKET(uint64_t ns)
+{
+  if(ns < 4)
+    return 0;
+
+  int exponent = 63 - __builtin_clzll(ns);
+  int bucket = exponent * 4 + ((ns >> (exponent - 2)) & 0x03);
+  return bucket < POOL_LATENCY_BUCKETS ? bucket : POOL_LATENCY_BUCKETS - 1;
+}
+
+static double LATENCY_LIMIT_US(int bucket)
+{
+  return (double) (1ULL << (bucket / 4)) * (1 + (bucket % 4 + 1) / 4.0) / 1000;
+}
+
+static double PERCENTILE_US(const uint64_t *latency, uint64_t total, double fraction)
+{
+  uint64_t target = (uint64_t) (total * fraction);
+  uint64_t seen = 0;
+  for(int bucket = 0; bucket < POOL_LATENCY_BUCKETS; bucket++)
+  {
+    seen += latency[bucket];
+    if(seen > target)
+      return LATENCY_LIMIT_US(bucket);
+  }
+  return 0;
+}
+
+void MachinePool::Deque::RESET(const vector<int> &batch)
+{
+  items = batch;
+  top.store(0, memory_order_relaxed);
+  bottom.store(batch.size(), memory_order_relaxed);
+}
+
+//owner end, only the last item can race a thief
+bool MachinePool::Deque::POP(int &item)
+{
+  long b = bottom.load(memory_order_relaxed) - 1;
+  bottom.store(b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = top.load(memory_order_relaxed);
+
+  if(t > b)
+  {
+    bottom.store(b + 1, memory_order_relaxed);
+    return false;
+  }
+
+  item = items[b];
+  if(t < b)
+    return true;
+
+  bool won = top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+  bottom.store(b + 1, memory_order_relaxed);
+  return won;
+}
+
+bool MachinePool::Deque::STEAL(int &item)
+{
+  long t = top.load(memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = bottom.load(memory_order_acquire);
+  if(t >= b)
+    return false;
+
+  item = items[t];
+  return top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+MachinePool::MachinePool(int threads, bool pin)
+{
+  int cores = max(1u, thread::hardware_concurrency());
+  if(threads <= 0)
+    threads = cores;
+
+  for(int i = 0; i < threads; i++)
+  {
+    workers.push_back(make_unique<Worker>());
+    workers[i]->cpu = pin ? i % cores : -1;
+    workers[i]->seed = i * 2654435761u + 1;
+  }
+  for(int i = 0; i < threads; i++)
+    this->threads.emplace_back(&MachinePool::WORKER_LOOP, this, i);
+}
+
+MachinePool::~MachinePool()
+{
+  {
+    lock_guard<mutex> hold(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for(thread &worker : threads)
+    worker.join();
+}
+
+void MachinePool::PIN(int cpu)
+{
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void) cpu;
+#endif
+}
+
+void MachinePool::WORKER_LOOP(int index)
+{
+  if(workers[index]->cpu >= 0)
+    PIN(workers[index]->cpu);
+
+  uint64_t seen = 0;
+  while(true)
+  {
+    {
+      unique_lock<mutex> hold(lock);
+      wake.wait(hold, [&]() { return stopping || generation != seen; });
+      if(stopping)
+        return;
+      seen = generation;
+    }
+
+    job(index);
+
+    lock_guard<mutex> hold(lock);
+    if(--running == 0)
+      finished.notify_one();
+  }
+}
+
+void MachinePool::RUN_ON_ALL(const function<void(int worker)> &work)
+{
+  {
+    lock_guard<mutex> hold(lock);
+    job = work;
+    running = workers.size();
+    generation++;
+  }
+  wake.notify_all();
+
+  unique_lock<mutex> hold(lock);
+  finished.wait(hold, [&]() { return running == 0; });
+}
+
+//built on the worker that will run them, which is what puts them on its NUMA node
+void MachinePool::SPAWN(int count, const function<unique_ptr<CPU_>(int index)> &make)
+{
+  int first = machines.size();
+  int n = workers.size();
+  machines.resize(first + count);
+
+  RUN_ON_ALL([&](int worker) {
+    for(int i = first + worker; i < first + count; i += n)
+    {
+      machines[i] = make(i);
+      workers[worker]->home.push_back(i);
+    }
+  });
+}
+
+void MachinePool::RUN_BATCH(int index)
+{
+  Worker &self = *workers[index];
+  int n = workers.size();
+
+  while(remaining.load(memory_order_acquire) > 0)
+  {
+    int machine;
+    bool stolen = false;
+
+    if(!self.deque.POP(machine))
+    {
+      //everyone else once, starting somewhere random so thieves don't all pile onto one victim
+      self.seed = self.seed * 1103515245 + 12345;
+      int start = (self.seed >> 16) % n;
+      for(int i = 0; i < n && !stolen; i++)
+      {
+        int victim = (start + i) % n;
+        if(victim != index)
+          stolen = workers[victim]->deque.STEAL(machine);
+      }
+      if(!stolen)
+      {
+        this_thread::yield(); //the last few frames are still running elsewhere
+        continue;
+      }
+    }
+
+    auto start = chrono::steady_clock::now();
+    machines[machine]->RUN_WHOLE_FRAME();
+    uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+    self.frames++;
+    self.stolen += stolen;
+    self.busy_seconds += ns / 1e9;
+    self.latency[LATENCY_BUCKET(ns)]++;
+    remaining.fetch_sub(1, memory_order_release);
+  }
+}
+
+void MachinePool::STEP_ALL()
+{
+  for(auto &worker : workers)
+    worker->deque.RESET(worker->home);
+  remaining.store(machines.size(), memory_order_relaxed);
+
+  RUN_ON_ALL([this](int worker) { RUN_BATCH(worker); });
+}
+
+int MachinePool::SIZE()
+{
+  return machines.size();
+}
+
+CPU_ &MachinePool::MACHINE(int index)
+{
+  return *machines[index];
+}
+
+vector<PoolWorkerStats> MachinePool::STATS()
+{
+  vector<PoolWorkerStats> stats;
+  for(auto &worker : workers)
+  {
+    PoolWorkerStats entry = {};
+    entry.cpu = worker->cpu;
+    entry.frames = worker->frames;
+    entry.stolen = worker->stolen;
+    entry.busy_seconds = worker->busy_seconds;
+    entry.frames_per_second = worker->busy_seconds > 0 ? worker->frames / worker->busy_seconds : 0;
+    entry.p50_us = PERCENTILE_US(worker->latency, worker->frames, 0.50);
+    entry.p99_us = PERCENTILE_US(worker->latency, worker->frames, 0.99);
+    for(int bucket = POOL_LATENCY_BUCKETS - 1; bucket >= 0; bucket--)
+    {
+      if(worker->latency[bucket])
+      {
+        entry.max_us = LATENCY_LIMIT_US(bucket);
+        break;
+      }
+    }
+    stats.push_back(entry);
+  }
+  return stats;
+}
+
+void MachinePool::RESET_STATS()
+{
+  for(auto &worker : workers)
+  {
+    worker->frames = 0;
+    worker->stolen = 0;
+    worker->busy_seconds = 0;
+    fill(begin(worker->latency), end(worker->latency), 0);
+  }
+}
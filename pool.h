@@ -0,0 +1,97 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include "cpu.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define POOL_LATENCY_BUCKETS 128 //quarter powers of two of nanoseconds, up to ~2^32 ns
+
+struct PoolWorkerStats {
+    int cpu; //the core the worker is pinned to, -1 if it isn't
+    uint64_t frames;
+    uint64_t stolen; //frames it took from another worker's deque
+    double busy_seconds;
+    double frames_per_second; //while busy
+    double p50_us; //per frame wall time percentiles, bucket upper bounds
+    double p99_us;
+    double max_us;
+};
+
+/*
+ * Many machines, each advanced one frame per STEP_ALL by a fixed set of worker threads.
+ *
+ * Every machine has a home worker that built it (so with first touch its memory sits on that
+ * worker's NUMA node) and whose deque it starts each batch in. Workers pop their own deque from
+ * the bottom and, once it is empty, steal from the top of the others', so a worker stuck on a
+ * few expensive machines gets help instead of holding the batch up. The deques are Chase-Lev
+ * without the growing part, a batch is pushed before the workers start, so nothing during a
+ * batch takes a lock. The only lock is for waking the workers at the start of a batch.
+ */
+class MachinePool {
+ private:
+  //fixed capacity work stealing deque of machine indexes
+  struct Deque {
+      vector<int> items;
+      alignas(64) atomic<long> top{0};
+      alignas(64) atomic<long> bottom{0};
+
+      void RESET(const vector<int> &batch);
+      bool POP(int &item);
+      bool STEAL(int &item);
+  };
+
+  struct Worker {
+      Deque deque;
+      vector<int> home; //machines built by this worker
+      int cpu = -1;
+      uint64_t frames = 0;
+      uint64_t stolen = 0;
+      double busy_seconds = 0;
+      uint64_t latency[POOL_LATENCY_BUCKETS] = {};
+      unsigned seed = 0; //victim selection
+  };
+
+  vector<unique_ptr<CPU_>> machines;
+  vector<unique_ptr<Worker>> workers;
+  vector<thread> threads; //one per worker, the caller only waits for a batch
+
+  mutex lock;
+  condition_variable wake;
+  condition_variable finished;
+  uint64_t generation = 0;
+  int running = 0;
+  bool stopping = false;
+  atomic<int> remaining{0}; //frames left in the batch
+
+  function<void(int worker)> job; //what the workers run when woken
+
+  void WORKER_LOOP(int index);
+  void RUN_ON_ALL(const function<void(int worker)> &work);
+  void RUN_BATCH(int index);
+  static void PIN(int cpu);
+
+ public:
+  //threads 0 means one per core, pinning puts worker i on core i
+  MachinePool(int threads, bool pin);
+  ~MachinePool();
+
+  //count machines, made by make(index) on the worker that will be their home
+  void SPAWN(int count, const function<unique_ptr<CPU_>(int index)> &make);
+
+  void STEP_ALL(); //one frame on every machine
+
+  int SIZE();
+  CPU_ &MACHINE(int index);
+
+  vector<PoolWorkerStats> STATS();
+  void RESET_STATS();
+};
+
+#endif //_POOL_H_
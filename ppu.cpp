@@ -1,4 +1,5 @@
 #include "ppu.h"
+#include "shmexport.h"
 
 #include <iostream>
 
@@ -6,6 +7,9 @@
 
 using namespace std;
 
+extern CPU_ Z80;
+extern SharedExport EXPORT;
+
 void PPU::RUN()
 {
   initWindow();
@@ -16,14 +20,28 @@ void PPU::RUN()
 
 void PPU::mainLoop()
 {
-  double time = glfwGetTime();
+  pacer.START();
 
   while(!glfwWindowShouldClose(window))
   {
     // Keep running
     glfwPollEvents();
+
+    //behind -> run extra frames and only show the last one
+    int frames = pacer.NEXT_FRAME();
+    for(int i = 0; i < frames; i++)
+    {
+      Z80.RUN_FRAME();
+      EXPORT.PUBLISH(Z80);
+    }
+
     drawFrame();
   }
 
   vkDeviceWaitIdle(device);
 }
+
+PacerStats PPU::PACING_STATS()
+{
+  return pacer.STATS();
+}
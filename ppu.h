@@ -2,6 +2,7 @@
 #define _PPU_H_
 
 #include "cpu.h"
+#include "pacer.h"
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -97,6 +98,8 @@ class PPU {
 
   bool framebufferResized = false;
 
+  Pacer pacer;
+
   //vk boilerplate
   void setupDebugMessenger();
   bool checkValidationLayerSupport();
@@ -152,6 +155,7 @@ class PPU {
 
  public:
   void RUN();
+  PacerStats PACING_STATS();
 };
 
 static std::vector<char> readFile(const std::string& filename);
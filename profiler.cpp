@@ -0,0 +1,140 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+void Profiler::OPCODE(uint16_t opcode, int cycles, uint8_t bank, uint16_t pc)
+{
+  opcode_count[opcode]++;
+  opcode_cycles[opcode] += cycles;
+
+  recent = recent << 12 | opcode;
+  recent_count = min(recent_count + 1, PROFILE_SEQUENCE_LENGTH);
+  for(int length = 2; length <= recent_count; length++)
+    sequences[(uint64_t) length << 60 | (recent & ((1ULL << (12 * length)) - 1))]++;
+
+  //histogram by sampling every so many cycles rather than every instruction
+  sample_countdown -= cycles;
+  if(sample_countdown > 0)
+    return;
+  sample_countdown += PROFILE_SAMPLE_PERIOD;
+
+  vector<uint32_t> key = stack;
+  key.push_back((uint32_t) bank << 16 | pc);
+  samples[key]++;
+}
+
+void Profiler::CALL(uint8_t bank, uint16_t target)
+{
+  if(stack.size() >= PROFILE_MAX_DEPTH)
+  {
+    overflow++;
+    return;
+  }
+  stack.push_back((uint32_t) bank << 16 | target);
+}
+
+void Profiler::RET()
+{
+  //games pop return addresses by hand, so an unmatched RET is normal
+  if(overflow)
+    overflow--;
+  else if(!stack.empty())
+    stack.pop_back();
+}
+
+string Profiler::FRAME_NAME(uint32_t frame)
+{
+  uint16_t address = frame & 0xFFFF;
+  char name[16];
+
+  if(address < 0x8000)
+    snprintf(name, sizeof(name), "rom%02X:%04X", frame >> 16, address);
+  else if(address >= 0xFF80)
+    snprintf(name, sizeof(name), "hram:%04X", address);
+  else
+    snprintf(name, sizeof(name), "ram:%04X", address);
+
+  return name;
+}
+
+bool Profiler::WRITE_FOLDED(const string &path)
+{
+  FILE *out = fopen(path.c_str(), "w");
+  if(!out)
+    return false;
+
+  for(auto &sample : samples)
+  {
+    string line = "gb";
+    for(uint32_t frame : sample.first)
+      line += ";" + FRAME_NAME(frame);
+    fprintf(out, "%s %llu\n", line.c_str(), (unsigned long long) sample.second);
+  }
+
+  fclose(out);
+  return true;
+}
+
+bool Profiler::WRITE_OPCODES(const string &path)
+{
+  FILE *out = fopen(path.c_str(), "w");
+  if(!out)
+    return false;
+
+  vector<int> order;
+  uint64_t total = 0;
+  for(int i = 0; i < 0x200; i++)
+  {
+    if(opcode_count[i])
+      order.push_back(i);
+    total += opcode_cycles[i];
+  }
+  sort(order.begin(), order.end(), [this](int a, int b) { return opcode_cycles[a] > opcode_cycles[b]; });
+
+  fprintf(out, "opcode,count,cycles,percent\n");
+  for(int i : order)
+  {
+    fprintf(out, i < 0x100 ? "0x%02X,%llu,%llu,%.3f\n" : "0xCB%02X,%llu,%llu,%.3f\n", i & 0xFF,
+            (unsigned long long) opcode_count[i], (unsigned long long) opcode_cycles[i],
+            total ? 100.0 * opcode_cycles[i] / total : 0.0);
+  }
+
+  fclose(out);
+  return true;
+}
+
+bool Profiler::WRITE_SEQUENCES(const string &path)
+{
+  FILE *out = fopen(path.c_str(), "w");
+  if(!out)
+    return false;
+
+  //a fused handler for a sequence of length n saves n - 1 dispatches every time it runs
+  vector<pair<uint64_t, uint64_t>> order;
+  for(auto &sequence : sequences)
+    order.push_back({sequence.second * ((sequence.first >> 60) - 1), sequence.first});
+  sort(order.rbegin(), order.rend());
+
+  fprintf(out, "sequence,count,dispatches_saved\n");
+  for(size_t i = 0; i < order.size() && i < 100; i++)
+  {
+    uint64_t key = order[i].second;
+    int length = key >> 60;
+    string name;
+    for(int at = length - 1; at >= 0; at--)
+    {
+      int opcode = (key >> (12 * at)) & 0xFFF;
+      char hex[8];
+      snprintf(hex, sizeof(hex), opcode < 0x100 ? "%02X" : "CB%02X", opcode & 0xFF);
+      name += (name.empty() ? "" : " ") + string(hex);
+    }
+    fprintf(out, "%s,%llu,%llu\n", name.c_str(), (unsigned long long) sequences[key],
+            (unsigned long long) order[i].first);
+  }
+
+  fclose(out);
+  return true;
+}
@@ -0,0 +1,49 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define PROFILE_SAMPLE_PERIOD 1024 //cycles between PC samples
+#define PROFILE_MAX_DEPTH 64 //shadow call stack depth, deeper calls are folded into the top frame
+#define PROFILE_SEQUENCE_LENGTH 5 //longest run of opcodes counted, what fusion candidates come from
+
+//Only compiled into CPU_ when PROFILE is defined, see OPCODE_HANDLER.
+class Profiler {
+ private:
+  uint64_t opcode_count[0x200] = {}; //0x000 - 0x0FF base opcodes, 0x100 - 0x1FF 0xCB prefixed
+  uint64_t opcode_cycles[0x200] = {};
+
+  //the last PROFILE_SEQUENCE_LENGTH opcodes 12 bits each, newest lowest, and how often every
+  //run of 2 or more of them was executed back to back, keyed by length << 60 | opcodes
+  uint64_t recent = 0;
+  int recent_count = 0;
+  std::unordered_map<uint64_t, uint64_t> sequences;
+
+  int sample_countdown = PROFILE_SAMPLE_PERIOD;
+
+  //guest call stack built from CALL/RET, each entry is bank << 16 | address
+  std::vector<uint32_t> stack;
+  int overflow = 0; //calls past PROFILE_MAX_DEPTH
+
+  std::map<std::vector<uint32_t>, uint64_t> samples; //stack + leaf PC -> hits
+
+  static std::string FRAME_NAME(uint32_t frame);
+
+ public:
+  void OPCODE(uint16_t opcode, int cycles, uint8_t bank, uint16_t pc);
+  void CALL(uint8_t bank, uint16_t target);
+  void RET();
+
+  //flamegraph.pl / speedscope / pprof compatible folded stacks, one "a;b;c count" line per stack
+  bool WRITE_FOLDED(const std::string &path);
+  //per opcode executions and cycles, most expensive first
+  bool WRITE_OPCODES(const std::string &path);
+  //opcode sequences by the dispatches fusing them would save, see the fused handlers in opcode.cpp
+  bool WRITE_SEQUENCES(const std::string &path);
+};
+
+#endif //_PROFILER_H_
@@ -0,0 +1,536 @@
+#include "aot.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * gb++-aot ROM OUT.cpp [--entry ADDRESS]... [--coverage FILE]...
+ *
+ * Follows the ROM's control flow from 0x0100, the interrupt vectors and any --entry address,
+ * and writes every instruction it reaches as C++ for aot.h: one label each, direct jumps and
+ * calls as gotos, RET and JP (HL) through a switch on the PC. Compiling OUT.cpp into gb++
+ * (AOT_SOURCES in CMake) registers it, and machines holding this exact ROM run it from then on.
+ * Every instruction a gb++ --coverage run of the ROM executed is an entry too, which finds code
+ * only JP (HL) and jump tables reach.
+ *
+ * Each instruction does what its case in OPCODE_HANDLER does, quirks included, so the
+ * interpreter and the compiled code can hand a machine back and forth between any two
+ * instructions. Opcodes the interpreter doesn't implement yet end the path, the machine goes
+ * back to STEP there like it does for anything the generated code can't do exactly.
+ */
+
+struct Instruction {
+    int length = 1;
+    int cost = 4; //the most it can take, what AOT_BUDGET checks
+    int tick = 4; //what it always takes, a taken branch adds the rest itself
+    string name;
+    string checks; //leave before anything changes, a trapped page or an IO register
+    string effects;
+    string flow; //after the effects, nothing means it falls through
+    vector<WORD> next; //where control can go from here, for discovery
+    bool falls_through = true;
+    bool compiled = true; //false for what only STEP can run, its label just hands back
+};
+
+static const char *REGISTERS[8] = {"BC.hi", "BC.lo", "DE.hi", "DE.lo", "HL.hi", "HL.lo", nullptr, "AF.hi"};
+static const char *REGISTER_NAMES = "BCDEHL?A";
+
+static string FORMAT(const char *format, ...) __attribute__((format(printf, 1, 2)));
+static string FORMAT(const char *format, ...)
+{
+  char buffer[512];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  return buffer;
+}
+
+static string LABEL(WORD address)
+{
+  return FORMAT("i_%04X", address);
+}
+
+//control going to a fixed address, compiled if it's in ROM
+static string GOTO(WORD address)
+{
+  if(address >= 0x8000)
+    return FORMAT("AOT_EXIT(0x%04X);", address);
+  return "goto " + LABEL(address) + ";";
+}
+
+//a byte at an address in a register pair or a constant
+static string READ_CHECK(WORD at, const string &address)
+{
+  return FORMAT("AOT_READ_PAGE(0x%04X, %s); ", at, address.c_str());
+}
+
+static string WRITE_CHECK(WORD at, const string &address)
+{
+  return FORMAT("AOT_WRITE_PAGE(0x%04X, %s); ", at, address.c_str());
+}
+
+//0xFF00 + offset, only HRAM is plain memory, the rest of the page is IO for STEP
+static bool HRAM(int offset)
+{
+  return offset >= 0x80 && offset < 0xFF;
+}
+
+//left to STEP, length 0 for opcodes the interpreter stalls on so nothing after them is reached
+static void STOP_HERE(Instruction &instruction, const string &name, int length)
+{
+  instruction.name = name;
+  instruction.length = length;
+  instruction.compiled = false;
+  instruction.falls_through = length > 0;
+}
+
+static Instruction DECODE(const vector<BYTE> &rom, WORD at)
+{
+  Instruction instruction;
+  BYTE opcode = rom[at];
+  BYTE n = at + 1 < 0x8000 ? rom[at + 1] : 0;
+  WORD nn = at + 2 < 0x8000 ? rom[at + 1] | rom[at + 2] << 8 : 0;
+  int8_t offset = (int8_t) n;
+
+  auto SIMPLE = [&](const string &name, int length, int cost, const string &effects) {
+    instruction.name = name;
+    instruction.length = length;
+    instruction.cost = cost;
+    instruction.tick = cost;
+    instruction.effects = effects;
+  };
+
+  //LD r,r' / LD r,(HL) / LD (HL),r, 0x4B is missing from the interpreter and 0xBC is LD C,E
+  if(opcode >= 0x40 && opcode < 0x80 && opcode != 0x76 && opcode != 0x4B)
+  {
+    int destination = (opcode >> 3) & 7;
+    int source = opcode & 7;
+    string name = FORMAT("LD %c,%c", REGISTER_NAMES[destination], REGISTER_NAMES[source]);
+    if(source == 6)
+    {
+      SIMPLE(FORMAT("LD %c,(HL)", REGISTER_NAMES[destination]), 1, 8, FORMAT("%s = page[HL.lo];", REGISTERS[destination]));
+      instruction.checks = READ_CHECK(at, "HL.reg");
+    }
+    else if(destination == 6)
+    {
+      SIMPLE(FORMAT("LD (HL),%c", REGISTER_NAMES[source]), 1, 8, FORMAT("page[HL.lo] = %s;", REGISTERS[source]));
+      instruction.checks = WRITE_CHECK(at, "HL.reg");
+    }
+    else
+      SIMPLE(name, 1, 4, FORMAT("%s = %s;", REGISTERS[destination], REGISTERS[source]));
+  }
+  else if(opcode >= 0x80 && opcode < 0x88)
+  {
+    int source = opcode & 7;
+    if(source == 6)
+    {
+      SIMPLE("ADD A,(HL)", 1, 8, "aot::ADD(AF.lo, AF.hi, page[HL.lo]);");
+      instruction.checks = READ_CHECK(at, "HL.reg");
+    }
+    else
+      SIMPLE(FORMAT("ADD A,%c", REGISTER_NAMES[source]), 1, 4, FORMAT("aot::ADD(AF.lo, AF.hi, %s);", REGISTERS[source]));
+  }
+  else switch(opcode)
+  {
+    case 0x00: SIMPLE("NOP", 1, 4, ""); break;
+    case 0xBC: SIMPLE("LD C,E", 1, 4, "BC.lo = DE.lo;"); break; //the interpreter's LD C,E
+    case 0x01: SIMPLE("LD BC,nn", 3, 12, FORMAT("BC.reg = 0x%04X;", nn)); break;
+    case 0x11: SIMPLE("LD DE,nn", 3, 12, FORMAT("DE.reg = 0x%04X;", nn)); break;
+    case 0x21: SIMPLE("LD HL,nn", 3, 12, FORMAT("HL.reg = 0x%04X;", nn)); break;
+    case 0x31: SIMPLE("LD SP,nn", 3, 12, FORMAT("SP = 0x%04X;", nn)); break;
+
+    case 0x02:
+    case 0x12: //0x12 writes through BC in the interpreter too
+      SIMPLE("LD (BC),A", 1, 8, "page[BC.lo] = AF.hi;");
+      instruction.checks = WRITE_CHECK(at, "BC.reg");
+      break;
+    case 0x0A:
+      SIMPLE("LD A,(BC)", 1, 8, "AF.hi = page[BC.lo];");
+      instruction.checks = READ_CHECK(at, "BC.reg");
+      break;
+    case 0x1A:
+      SIMPLE("LD A,(DE)", 1, 8, "AF.hi = page[DE.lo];");
+      instruction.checks = READ_CHECK(at, "DE.reg");
+      break;
+    case 0x22:
+      SIMPLE("LD (HL+),A", 1, 8, "page[HL.lo] = AF.hi; HL.reg++;");
+      instruction.checks = WRITE_CHECK(at, "HL.reg");
+      break;
+    case 0x32:
+      SIMPLE("LD (HL-),A", 1, 8, "page[HL.lo] = AF.hi; HL.reg--;");
+      instruction.checks = WRITE_CHECK(at, "HL.reg");
+      break;
+    case 0x2A:
+      SIMPLE("LD A,(HL+)", 1, 8, "AF.hi = page[HL.lo]; HL.reg++;");
+      instruction.checks = READ_CHECK(at, "HL.reg");
+      break;
+    case 0x3A:
+      SIMPLE("LD A,(HL-)", 1, 8, "AF.hi = page[HL.lo]; HL.reg--;");
+      instruction.checks = READ_CHECK(at, "HL.reg");
+      break;
+    case 0x34:
+      SIMPLE("INC (HL)", 1, 12, "{ BYTE operand = page[HL.lo]; aot::INC(AF.lo, operand); second[HL.lo] = operand; }");
+      instruction.checks = WRITE_CHECK(at, "HL.reg") + "second = page; " + READ_CHECK(at, "HL.reg");
+      break;
+    case 0x35:
+      SIMPLE("DEC (HL)", 1, 12, "{ BYTE operand = page[HL.lo]; aot::DEC(AF.lo, operand); second[HL.lo] = operand; }");
+      instruction.checks = WRITE_CHECK(at, "HL.reg") + "second = page; " + READ_CHECK(at, "HL.reg");
+      break;
+    case 0x36:
+      SIMPLE("LD (HL),n", 2, 12, FORMAT("page[HL.lo] = 0x%02X;", n));
+      instruction.checks = WRITE_CHECK(at, "HL.reg");
+      break;
+
+    case 0x03: SIMPLE("INC BC", 1, 8, "BC.reg++;"); break;
+    case 0x13: SIMPLE("INC DE", 1, 8, "DE.reg++;"); break;
+    case 0x23: SIMPLE("INC HL", 1, 8, "HL.reg++;"); break;
+    case 0x33: SIMPLE("INC SP", 1, 8, "SP++;"); break;
+    case 0x0B: SIMPLE("DEC BC", 1, 8, "BC.reg--;"); break;
+    case 0x1B: SIMPLE("DEC DE", 1, 8, "DE.reg--;"); break;
+    case 0x3B: SIMPLE("DEC SP", 1, 8, "SP--;"); break;
+
+    case 0x04: SIMPLE("INC B", 1, 4, "aot::INC(AF.lo, BC.hi);"); break;
+    case 0x0C: SIMPLE("INC C", 1, 4, "aot::INC(AF.lo, BC.lo);"); break;
+    case 0x14: SIMPLE("INC D", 1, 4, "aot::INC(AF.lo, DE.hi);"); break;
+    case 0x1C: SIMPLE("INC E", 1, 4, "aot::INC(AF.lo, DE.lo);"); break;
+    case 0x3C: SIMPLE("INC A", 1, 4, "aot::INC(AF.lo, AF.hi);"); break;
+    case 0x05: SIMPLE("DEC B", 1, 4, "aot::DEC(AF.lo, BC.hi);"); break;
+    case 0x0D: SIMPLE("DEC C", 1, 4, "aot::DEC(AF.lo, BC.lo);"); break;
+    case 0x15: SIMPLE("DEC D", 1, 4, "aot::DEC(AF.lo, DE.hi);"); break;
+    case 0x1D: SIMPLE("DEC E", 1, 4, "aot::DEC(AF.lo, DE.lo);"); break;
+    case 0x3D: SIMPLE("DEC A", 1, 4, "aot::DEC(AF.lo, AF.hi);"); break;
+
+    case 0x06: SIMPLE("LD B,n", 2, 8, FORMAT("BC.hi = 0x%02X;", n)); break;
+    case 0x0E: SIMPLE("LD C,n", 2, 8, FORMAT("BC.lo = 0x%02X;", n)); break;
+    case 0x16: SIMPLE("LD D,n", 2, 8, FORMAT("DE.hi = 0x%02X;", n)); break;
+    case 0x1E: SIMPLE("LD E,n", 2, 8, FORMAT("DE.lo = 0x%02X;", n)); break;
+    case 0x2E: SIMPLE("LD L,n", 2, 8, FORMAT("HL.lo = 0x%02X;", n)); break;
+    case 0x3E: SIMPLE("LD A,n", 2, 8, FORMAT("AF.hi = 0x%02X;", n)); break;
+
+    case 0x08:
+      //LD_W writes 0 then the low byte of SP
+      SIMPLE("LD (nn),SP", 3, 20, FORMAT("second[0x%02X] = 0; page[0x%02X] = SP & 0xFF;", nn & 0xFF, (nn + 1) & 0xFF));
+      instruction.checks = WRITE_CHECK(at, FORMAT("0x%04X", nn)) + "second = page; " + WRITE_CHECK(at, FORMAT("0x%04X", (nn + 1) & 0xFFFF));
+      break;
+
+    case 0x09:
+    case 0x19: //ADD HL,BC in the interpreter too
+      SIMPLE("ADD HL,BC", 1, 8, "aot::ADD(AF.lo, HL.reg, BC.reg);");
+      break;
+    case 0x39: SIMPLE("ADD HL,SP", 1, 8, "aot::ADD(AF.lo, HL.reg, SP);"); break;
+
+    case 0x17: SIMPLE("RLA", 1, 4, "aot::RLA(AF.lo, AF.hi);"); break;
+    case 0x76: SIMPLE("HALT", 1, 4, ""); break;
+    case 0xAF: SIMPLE("XOR A", 1, 4, "aot::XOR(AF.lo, AF.hi, AF.hi);"); break;
+    case 0xF3: SIMPLE("DI", 1, 4, "IME = 0;"); break;
+    case 0xFB: SIMPLE("EI", 1, 4, "IME = 1;"); break;
+    case 0xFE: SIMPLE("CP n", 2, 8, FORMAT("aot::CP(AF.lo, AF.hi, 0x%02X);", n)); break;
+
+    case 0x10:
+      //can switch speed, which HORIZON was worked out without
+      STOP_HERE(instruction, "STOP", 2);
+      break;
+
+    case 0x18:
+    {
+      WORD target = at + offset + 3; //JR then PC += 1 in the interpreter
+      SIMPLE("JR e", 2, 4, "");
+      instruction.flow = GOTO(target);
+      instruction.next.push_back(target);
+      instruction.falls_through = false;
+      break;
+    }
+    case 0x20:
+    case 0x28:
+    {
+      WORD target = at + offset + 2;
+      SIMPLE(opcode == 0x20 ? "JR NZ,e" : "JR Z,e", 2, 12, "");
+      //8 either way, the taken branch adds the other 4
+      instruction.flow = FORMAT("if(%s(AF.lo & 0x80)) { left -= 4; %s }", opcode == 0x20 ? "!" : "", GOTO(target).c_str());
+      instruction.next.push_back(target);
+      instruction.tick = 8;
+      break;
+    }
+
+    case 0xC3:
+      SIMPLE("JP nn", 3, 16, "");
+      instruction.flow = GOTO(nn);
+      instruction.next.push_back(nn);
+      instruction.falls_through = false;
+      break;
+    case 0xE9:
+      SIMPLE("JP (HL)", 1, 16, "PC = HL.reg;");
+      instruction.flow = "goto dispatch;";
+      instruction.falls_through = false;
+      break;
+    case 0xCD:
+    {
+      WORD back = at + 3;
+      SIMPLE("CALL nn", 3, 8, FORMAT("second[(SP - 1) & 0xFF] = 0x%02X; page[(SP - 2) & 0xFF] = 0x%02X; SP -= 2;", back >> 8, back & 0xFF));
+      instruction.checks = WRITE_CHECK(at, "SP - 1") + "second = page; " + WRITE_CHECK(at, "SP - 2");
+      instruction.flow = GOTO(nn);
+      instruction.next.push_back(nn);
+      instruction.next.push_back(back); //where RET comes back to
+      instruction.falls_through = false;
+      break;
+    }
+    case 0xC9:
+      SIMPLE("RET", 1, 16, "PC = page[SP & 0xFF] | second[(SP + 1) & 0xFF] << 8; SP += 2;");
+      instruction.checks = READ_CHECK(at, "SP + 1") + "second = page; " + READ_CHECK(at, "SP");
+      instruction.flow = "goto dispatch;";
+      instruction.falls_through = false;
+      break;
+
+    case 0xC1:
+    case 0xE1:
+    {
+      const char *pair = opcode == 0xC1 ? "BC" : "HL";
+      SIMPLE(FORMAT("POP %s", pair), 1, 12, FORMAT("%s.lo = page[SP & 0xFF]; %s.hi = second[(SP + 1) & 0xFF]; SP += 2;", pair, pair));
+      instruction.checks = READ_CHECK(at, "SP + 1") + "second = page; " + READ_CHECK(at, "SP");
+      break;
+    }
+    case 0xC5:
+    case 0xD5:
+    {
+      const char *pair = opcode == 0xC5 ? "BC" : "DE";
+      SIMPLE(FORMAT("PUSH %s", pair), 1, 16, FORMAT("second[(SP - 1) & 0xFF] = %s.hi; page[(SP - 2) & 0xFF] = %s.lo; SP -= 2;", pair, pair));
+      instruction.checks = WRITE_CHECK(at, "SP - 1") + "second = page; " + WRITE_CHECK(at, "SP - 2");
+      break;
+    }
+
+    case 0xE0:
+      if(!HRAM(n))
+        STOP_HERE(instruction, "LDH (n),A", 2);
+      else
+        SIMPLE("LDH (n),A", 2, 8, FORMAT("hram[0x%02X] = AF.hi;", n - 0x80));
+      break;
+    case 0xF0:
+      if(!HRAM(n))
+        STOP_HERE(instruction, "LDH A,(n)", 2);
+      else
+        SIMPLE("LDH A,(n)", 2, 12, FORMAT("AF.hi = hram[0x%02X];", n - 0x80));
+      break;
+    case 0xE2:
+      SIMPLE("LD (C),A", 1, 8, "hram[BC.lo - 0x80] = AF.hi;");
+      instruction.checks = FORMAT("if(BC.lo < 0x80 || BC.lo == 0xFF) AOT_EXIT(0x%04X); ", at);
+      break;
+    case 0xEA:
+      if(nn >= 0xFF00 && !HRAM(nn & 0xFF))
+        STOP_HERE(instruction, "LD (nn),A", 3);
+      else if(nn >= 0xFF00)
+        SIMPLE("LD (nn),A", 3, 16, FORMAT("hram[0x%02X] = AF.hi;", (nn & 0xFF) - 0x80));
+      else
+      {
+        SIMPLE("LD (nn),A", 3, 16, FORMAT("page[0x%02X] = AF.hi;", nn & 0xFF));
+        instruction.checks = WRITE_CHECK(at, FORMAT("0x%04X", nn));
+      }
+      break;
+
+    case 0xCB:
+      if(n == 0x11)
+        SIMPLE("RL C", 2, 8, "aot::RL(AF.lo, BC.lo);");
+      else if(n == 0x7C)
+        SIMPLE("BIT 7,H", 2, 8, "aot::BIT(AF.lo, 7, HL.hi);");
+      else
+        STOP_HERE(instruction, FORMAT("CB %02X, not implemented", n), 0);
+      break;
+
+    default:
+      STOP_HERE(instruction, FORMAT("%02X, not implemented", opcode), 0);
+      break;
+  }
+
+  if(at + instruction.length > 0x8000)
+    STOP_HERE(instruction, instruction.name + ", past the fixed banks", 0);
+  if(instruction.falls_through)
+    instruction.next.push_back(at + instruction.length);
+  return instruction;
+}
+
+static int USAGE()
+{
+  fprintf(stderr, "usage: gb++-aot ROM OUT.cpp [--entry ADDRESS]... [--coverage FILE]...\n");
+  return 1;
+}
+
+//the instruction starts in a WRITE_COVERAGE file, the fixed banks' bits are their addresses
+static bool LOAD_COVERAGE(const string &path, uint64_t rom_hash, vector<WORD> &worklist)
+{
+  ifstream file(path, ios::binary);
+  CoverageHeader header;
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if(!file || header.magic != COVERAGE_MAGIC || header.version != COVERAGE_VERSION)
+  {
+    fprintf(stderr, "%s isn't a coverage file\n", path.c_str());
+    return false;
+  }
+  if(header.rom_hash != rom_hash)
+  {
+    fprintf(stderr, "%s was recorded on another ROM\n", path.c_str());
+    return false;
+  }
+
+  vector<BYTE> executed((size_t) header.banks * header.bank_size / 8);
+  file.read(reinterpret_cast<char *>(executed.data()), executed.size());
+  if(!file)
+  {
+    fprintf(stderr, "%s is cut short\n", path.c_str());
+    return false;
+  }
+  for(size_t bit = 0; bit < executed.size() * 8 && bit < 0x8000; bit++)
+  {
+    if(executed[bit >> 3] & (1 << (bit & 7)))
+      worklist.push_back(bit);
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  string rom_path;
+  string out_path;
+  vector<string> coverage_paths;
+  vector<WORD> worklist = {0x0100, 0x0040, 0x0048, 0x0050, 0x0058, 0x0060}; //start and interrupts
+
+  for(int i = 1; i < argc; i++)
+  {
+    string arg = argv[i];
+    if(arg == "--entry" && i + 1 < argc)
+    {
+      char *end;
+      errno = 0;
+      unsigned long entry = strtoul(argv[++i], &end, 0);
+      if(!argv[i][0] || *end || errno || entry > 0xFFFF)
+      {
+        fprintf(stderr, "--entry %s isn't an address\n", argv[i]);
+        return USAGE();
+      }
+      worklist.push_back(entry);
+    }
+    else if(arg == "--coverage" && i + 1 < argc)
+      coverage_paths.push_back(argv[++i]);
+    else if(rom_path.empty() && arg[0] != '-')
+      rom_path = arg;
+    else if(out_path.empty() && arg[0] != '-')
+      out_path = arg;
+    else
+      return USAGE();
+  }
+  if(rom_path.empty() || out_path.empty())
+    return USAGE();
+
+  //what LOAD_ROM maps, zeros past the end of a short ROM like RomImage
+  vector<BYTE> rom(0x8000);
+  ifstream file(rom_path, ios::binary);
+  if(!file)
+  {
+    fprintf(stderr, "can't open %s\n", rom_path.c_str());
+    return 1;
+  }
+  file.read(reinterpret_cast<char *>(rom.data()), rom.size());
+
+  const BYTE *pages[0x80];
+  for(int page = 0; page < 0x80; page++)
+    pages[page] = &rom[page << 8];
+  uint64_t hash = AOT_ROM_HASH(pages);
+  for(const string &path : coverage_paths)
+  {
+    if(!LOAD_COVERAGE(path, hash, worklist))
+      return 1;
+  }
+
+  map<WORD, Instruction> found;
+  while(!worklist.empty())
+  {
+    WORD at = worklist.back();
+    worklist.pop_back();
+    if(at >= 0x8000 || found.count(at))
+      continue;
+    Instruction instruction = DECODE(rom, at);
+    for(WORD next : instruction.next)
+      worklist.push_back(next);
+    found[at] = instruction;
+  }
+
+  //the cartridge title, for telling programs apart, or the file for ROMs without one
+  string title;
+  for(int i = 0x134; i < 0x144 && rom[i]; i++)
+    title += isalnum(rom[i]) || rom[i] == ' ' ? (char) rom[i] : '_';
+  if(title.empty())
+    title = rom_path.substr(rom_path.find_last_of('/') + 1);
+
+  FILE *out = fopen(out_path.c_str(), "w");
+  if(!out)
+  {
+    fprintf(stderr, "can't write %s\n", out_path.c_str());
+    return 1;
+  }
+
+  fprintf(out, "//generated by gb++-aot from %s, regenerate rather than edit\n", rom_path.c_str());
+  fprintf(out, "#include \"aot.h\"\n\n");
+  fprintf(out, "static void RUN(AotState &state)\n{\n");
+  fprintf(out, "  AOT_ENTER(state);\n");
+  fprintf(out, "  goto dispatch;\n\n");
+
+  int compiled = 0;
+  for(auto it = found.begin(); it != found.end(); ++it)
+  {
+    WORD at = it->first;
+    const Instruction &instruction = it->second;
+    fprintf(out, "%s: //%s\n", LABEL(at).c_str(), instruction.name.c_str());
+    if(!instruction.compiled)
+    {
+      fprintf(out, "  AOT_EXIT(0x%04X);\n", at);
+      continue;
+    }
+    compiled++;
+
+    fprintf(out, "  AOT_BUDGET(0x%04X, %d);\n", at, instruction.cost);
+    if(!instruction.checks.empty())
+      fprintf(out, "  %s\n", instruction.checks.substr(0, instruction.checks.size() - 1).c_str());
+    fprintf(out, "  AOT_TICK(%d);\n", instruction.tick);
+    if(!instruction.effects.empty())
+      fprintf(out, "  %s\n", instruction.effects.c_str());
+    if(!instruction.flow.empty())
+      fprintf(out, "  %s\n", instruction.flow.c_str());
+
+    //falling through to something that isn't the next label
+    WORD after = at + instruction.length;
+    auto following = next(it);
+    if(instruction.falls_through && (following == found.end() || following->first != after))
+      fprintf(out, "  %s\n", GOTO(after).c_str());
+  }
+
+  fprintf(out, "\ndispatch:\n  switch(PC)\n  {\n");
+  for(const auto &[at, instruction] : found)
+    fprintf(out, "    case 0x%04X: goto %s;\n", at, LABEL(at).c_str());
+  fprintf(out, "    default: break;\n  }\n\n");
+  fprintf(out, "leave:\n  AOT_LEAVE(state);\n}\n\n");
+  vector<BYTE> bitmap(0x1000);
+  for(const auto &[at, instruction] : found)
+  {
+    if(instruction.compiled)
+      bitmap[at >> 3] |= 1 << (at & 7);
+  }
+  fprintf(out, "static const BYTE compiled[0x1000] = {");
+  for(int i = 0; i < 0x1000; i++)
+    fprintf(out, "%s0x%02X,", i % 16 ? " " : "\n  ", bitmap[i]);
+  fprintf(out, "\n};\n\n");
+
+  fprintf(out, "static const AotProgram program = {0x%016llXULL, RUN, compiled, \"%s\"};\n", (unsigned long long) hash, title.c_str());
+  fprintf(out, "static AotRegistration registration(program);\n");
+  fclose(out);
+
+  printf("%s: %zu instructions found, %d compiled\n", title.c_str(), found.size(), compiled);
+  return 0;
+}
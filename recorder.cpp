@@ -0,0 +1,277 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+//DMG shades to luma, 0 is the lightest
+static const BYTE SHADE_LUMA[4] = {255, 170, 85, 0};
+
+//5 bit CGB channel to 8 bits, 31 -> 255
+static double CHANNEL(WORD bits)
+{
+  bits &= 0x1F;
+  return (bits << 3) | (bits >> 2);
+}
+
+static BYTE PLANE_BYTE(double value)
+{
+  return (BYTE) clamp(value + 0.5, 0.0, 255.0);
+}
+
+Recorder::~Recorder()
+{
+  STOP();
+}
+
+bool Recorder::START(const string &prefix, int sample_rate, bool colour_frames)
+{
+  if(running)
+    return false;
+
+  video = fopen((prefix + ".y4m").c_str(), "wb");
+  audio = fopen((prefix + ".wav").c_str(), "wb");
+  if(!video || !audio)
+  {
+    if(video)
+      fclose(video);
+    if(audio)
+      fclose(audio);
+    video = audio = nullptr;
+    return false;
+  }
+
+  //big buffers so the writer does a few large writes instead of one per frame
+  setvbuf(video, nullptr, _IOFBF, RECORDER_WRITE_BUFFER);
+  setvbuf(audio, nullptr, _IOFBF, RECORDER_WRITE_BUFFER);
+
+  //the frame rate is CPU_FREQ / FULL_FRAME_FREQ, 4194304 / 70224 reduced
+  colour = colour_frames;
+  fprintf(video, "YUV4MPEG2 W%d H%d F262144:4389 Ip A1:1 %s XCOLORRANGE=FULL\n", LCD_WIDTH, LCD_HEIGHT,
+          colour ? "C444" : "Cmono");
+
+  audio_rate = sample_rate;
+  audio_bytes = 0;
+  WRITE_WAV_HEADER();
+
+  slots.resize(RECORDER_SLOTS);
+  head = 0;
+  tail = 0;
+  running = true;
+  writer = thread(&Recorder::WRITER_LOOP, this);
+
+  return true;
+}
+
+void Recorder::STOP()
+{
+  if(!running)
+    return;
+
+  running = false;
+  wake.notify_one();
+  writer.join();
+
+  //sizes are only known now, patch them into the header
+  WRITE_WAV_HEADER();
+
+  fclose(video);
+  fclose(audio);
+  video = audio = nullptr;
+}
+
+void Recorder::WRITE_WAV_HEADER()
+{
+  const uint16_t channels = 2;
+  const uint16_t bits = 16;
+  uint32_t byte_rate = audio_rate * channels * bits / 8;
+  uint16_t block_align = channels * bits / 8;
+  uint32_t riff_size = 36 + audio_bytes;
+  uint32_t fmt_size = 16;
+  uint16_t format = 1; //PCM
+  uint32_t rate = audio_rate;
+
+  fseek(audio, 0, SEEK_SET);
+  fwrite("RIFF", 1, 4, audio);
+  fwrite(&riff_size, 4, 1, audio);
+  fwrite("WAVEfmt ", 1, 8, audio);
+  fwrite(&fmt_size, 4, 1, audio);
+  fwrite(&format, 2, 1, audio);
+  fwrite(&channels, 2, 1, audio);
+  fwrite(&rate, 4, 1, audio);
+  fwrite(&byte_rate, 4, 1, audio);
+  fwrite(&block_align, 2, 1, audio);
+  fwrite(&bits, 2, 1, audio);
+  fwrite("data", 1, 4, audio);
+  fwrite(&audio_bytes, 4, 1, audio);
+  fseek(audio, 0, SEEK_END);
+}
+
+Recorder::Block *Recorder::ACQUIRE()
+{
+  size_t h = head.load(memory_order_relaxed);
+  if(h - tail.load(memory_order_acquire) >= RECORDER_SLOTS)
+    return nullptr;
+  return &slots[h % RECORDER_SLOTS];
+}
+
+void Recorder::PUBLISH()
+{
+  head.store(head.load(memory_order_relaxed) + 1, memory_order_release);
+  wake.notify_one();
+}
+
+bool Recorder::PUSH_FRAME(const BYTE *shades)
+{
+  if(!running || colour)
+    return false;
+
+  Block *block = ACQUIRE();
+  if(!block)
+  {
+    frames_dropped++;
+    return false;
+  }
+
+  block->type = BLOCK_FRAME;
+  block->size = LCD_WIDTH * LCD_HEIGHT;
+  memcpy(block->data, shades, block->size);
+  PUBLISH();
+
+  return true;
+}
+
+bool Recorder::PUSH_FRAME(const WORD *colours)
+{
+  if(!running || !colour)
+    return false;
+
+  Block *block = ACQUIRE();
+  if(!block)
+  {
+    frames_dropped++;
+    return false;
+  }
+
+  block->type = BLOCK_COLOUR_FRAME;
+  block->size = LCD_WIDTH * LCD_HEIGHT * sizeof(WORD);
+  memcpy(block->data, colours, block->size);
+  PUBLISH();
+
+  return true;
+}
+
+bool Recorder::PUSH_AUDIO(const int16_t *samples, size_t frames)
+{
+  if(!running)
+    return false;
+
+  const size_t per_block = RECORDER_SLOT_SIZE / (2 * sizeof(int16_t));
+  bool complete = true;
+
+  while(frames)
+  {
+    size_t n = frames < per_block ? frames : per_block;
+    Block *block = ACQUIRE();
+    if(!block)
+    {
+      audio_blocks_dropped++;
+      complete = false;
+    }
+    else
+    {
+      block->type = BLOCK_AUDIO;
+      block->size = n * 2 * sizeof(int16_t);
+      memcpy(block->data, samples, block->size);
+      PUBLISH();
+    }
+
+    samples += n * 2;
+    frames -= n;
+  }
+
+  return complete;
+}
+
+size_t Recorder::QUEUED()
+{
+  return head.load(memory_order_relaxed) - tail.load(memory_order_acquire);
+}
+
+void Recorder::WRITER_LOOP()
+{
+  while(true)
+  {
+    size_t t = tail.load(memory_order_relaxed);
+
+    if(t == head.load(memory_order_acquire))
+    {
+      if(!running)
+        break;
+
+      //the emulator notifies without taking the lock, so don't wait forever on a missed wakeup
+      unique_lock<mutex> lock(wake_lock);
+      wake.wait_for(lock, chrono::milliseconds(10));
+      continue;
+    }
+
+    WRITE_BLOCK(slots[t % RECORDER_SLOTS]);
+    tail.store(t + 1, memory_order_release);
+  }
+
+  fflush(video);
+  fflush(audio);
+}
+
+void Recorder::WRITE_BLOCK(Block &block)
+{
+  if(block.type == BLOCK_FRAME)
+  {
+    BYTE luma[LCD_WIDTH * LCD_HEIGHT];
+    for(size_t i = 0; i < block.size; i++)
+      luma[i] = SHADE_LUMA[block.data[i] & 0x03];
+
+    fwrite("FRAME\n", 1, 6, video);
+    fwrite(luma, 1, block.size, video);
+    frames_written++;
+    bytes_written += block.size + 6;
+  }
+  else if(block.type == BLOCK_COLOUR_FRAME)
+  {
+    //planar Y, Cb, Cr at full resolution, BT.601 full range
+    BYTE planes[3][LCD_WIDTH * LCD_HEIGHT];
+    const size_t pixels = LCD_WIDTH * LCD_HEIGHT;
+    for(size_t i = 0; i < pixels; i++)
+    {
+      WORD colour;
+      memcpy(&colour, &block.data[i * sizeof(WORD)], sizeof(WORD));
+      double r = CHANNEL(colour), g = CHANNEL(colour >> 5), b = CHANNEL(colour >> 10);
+      planes[0][i] = PLANE_BYTE(0.299 * r + 0.587 * g + 0.114 * b);
+      planes[1][i] = PLANE_BYTE(128 - 0.168736 * r - 0.331264 * g + 0.5 * b);
+      planes[2][i] = PLANE_BYTE(128 + 0.5 * r - 0.418688 * g - 0.081312 * b);
+    }
+
+    fwrite("FRAME\n", 1, 6, video);
+    fwrite(planes, 1, sizeof(planes), video);
+    frames_written++;
+    bytes_written += sizeof(planes) + 6;
+  }
+  else
+  {
+    fwrite(block.data, 1, block.size, audio);
+    audio_bytes += block.size;
+    audio_blocks_written++;
+    bytes_written += block.size;
+  }
+}
+
+RecorderStats Recorder::STATS()
+{
+  RecorderStats stats;
+  stats.frames_written = frames_written;
+  stats.frames_dropped = frames_dropped;
+  stats.audio_blocks_written = audio_blocks_written;
+  stats.audio_blocks_dropped = audio_blocks_dropped;
+  stats.bytes_written = bytes_written;
+  return stats;
+}
@@ -0,0 +1,85 @@
+#ifndef _RECORDER_H_
+#define _RECORDER_H_
+
+#include "cpu.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define RECORDER_SLOTS 64 //blocks in flight between the emulator and the writer, ~3MB
+#define RECORDER_SLOT_SIZE (LCD_WIDTH * LCD_HEIGHT * 2) //one RGB555 frame, or 11520 stereo audio frames
+#define RECORDER_WRITE_BUFFER (4 << 20) //stdio buffer per output file
+
+struct RecorderStats {
+    uint64_t frames_written;
+    uint64_t frames_dropped; //queue was full, the emulator moved on without them
+    uint64_t audio_blocks_written;
+    uint64_t audio_blocks_dropped;
+    uint64_t bytes_written;
+};
+
+//Streams frames to <prefix>.y4m and audio to <prefix>.wav from a writer thread.
+//The PUSH_ functions never block, when the queue is full the block is dropped and counted.
+//A colour recording takes CGB RGB555 frames and writes 4:4:4, a mono one takes DMG shades.
+class Recorder {
+ private:
+  enum BlockType {
+      BLOCK_FRAME,
+      BLOCK_COLOUR_FRAME,
+      BLOCK_AUDIO
+  };
+
+  struct Block {
+      BlockType type;
+      size_t size;
+      BYTE data[RECORDER_SLOT_SIZE];
+  };
+
+  vector<Block> slots;
+  atomic<size_t> head{0}; //next slot the emulator fills
+  atomic<size_t> tail{0}; //next slot the writer drains
+  atomic<bool> running{false};
+  bool colour = false;
+
+  thread writer;
+  mutex wake_lock;
+  condition_variable wake;
+
+  FILE *video = nullptr;
+  FILE *audio = nullptr;
+  int audio_rate = 0;
+  uint32_t audio_bytes = 0;
+
+  atomic<uint64_t> frames_written{0};
+  atomic<uint64_t> frames_dropped{0};
+  atomic<uint64_t> audio_blocks_written{0};
+  atomic<uint64_t> audio_blocks_dropped{0};
+  atomic<uint64_t> bytes_written{0};
+
+  Block *ACQUIRE();
+  void PUBLISH();
+  void WRITER_LOOP();
+  void WRITE_BLOCK(Block &block);
+  void WRITE_WAV_HEADER();
+
+ public:
+  ~Recorder();
+
+  bool START(const string &prefix, int sample_rate, bool colour_frames = false);
+  void STOP();
+
+  bool PUSH_FRAME(const BYTE *shades); //mono recordings only
+  bool PUSH_FRAME(const WORD *colours); //colour recordings only
+  bool PUSH_AUDIO(const int16_t *samples, size_t frames); //interleaved stereo
+
+  size_t QUEUED(); //blocks waiting for the writer, out of RECORDER_SLOTS
+
+  RecorderStats STATS();
+};
+
+#endif //_RECORDER_H_
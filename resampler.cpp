@@ -0,0 +1,214 @@
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLER_X86
+#endif
+
+static float DOT_SCALAR(const float *a, const float *b, int n)
+{
+  float sum = 0;
+  for(int i = 0; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+#ifdef RESAMPLER_X86
+__attribute__((target("sse")))
+static float DOT_SSE(const float *a, const float *b, int n)
+{
+  //two accumulators to hide the add latency, taps is always a multiple of 16
+  __m128 acc0 = _mm_setzero_ps();
+  __m128 acc1 = _mm_setzero_ps();
+  for(int i = 0; i < n; i += 8)
+  {
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+  }
+  acc0 = _mm_add_ps(acc0, acc1);
+  acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+  acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+  return _mm_cvtss_f32(acc0);
+}
+
+__attribute__((target("avx")))
+static float DOT_AVX(const float *a, const float *b, int n)
+{
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  for(int i = 0; i < n; i += 16)
+  {
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+  }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+}
+#endif
+
+double RESAMPLER_KERNEL(double distance, double cutoff, double half_width)
+{
+  if(fabs(distance) >= half_width)
+    return 0;
+
+  //sinc low pass at cutoff (cycles per input sample) under a blackman window
+  double x = 2 * cutoff * distance;
+  double sinc = x == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+  double t = distance / half_width;
+  double window = 0.42 + 0.5 * cos(M_PI * t) + 0.08 * cos(2 * M_PI * t);
+
+  return 2 * cutoff * sinc * window;
+}
+
+Resampler::Resampler(double input_rate, double output_rate)
+{
+  step = input_rate / output_rate;
+
+  dot = DOT_SCALAR;
+#ifdef RESAMPLER_X86
+  dot = DOT_SSE;
+  if(__builtin_cpu_supports("avx"))
+    dot = DOT_AVX;
+#endif
+
+  BUILD_TABLE();
+  RESET();
+}
+
+void Resampler::BUILD_TABLE()
+{
+  //leave a little room below the output nyquist for the +-0.5% rate control
+  double cutoff = step > 1 ? 0.455 / step : 0.455;
+  double half_width = RESAMPLER_ZERO_CROSSINGS / (2 * cutoff);
+
+  taps = 2 * (int) ceil(half_width);
+  taps = (taps + 15) & ~15;
+
+  table.assign((size_t) (RESAMPLER_PHASES + 1) * taps, 0.0f);
+
+  for(int phase = 0; phase <= RESAMPLER_PHASES; phase++)
+  {
+    double frac = (double) phase / RESAMPLER_PHASES;
+    float *row = &table[(size_t) phase * taps];
+
+    double sum = 0;
+    for(int k = 0; k < taps; k++)
+      sum += RESAMPLER_KERNEL(k - (taps / 2 - 1) - frac, cutoff, half_width);
+
+    //normalise every phase to unity gain so interpolating between phases doesn't ripple
+    for(int k = 0; k < taps; k++)
+      row[k] = (float) (RESAMPLER_KERNEL(k - (taps / 2 - 1) - frac, cutoff, half_width) / sum);
+  }
+}
+
+void Resampler::SET_RATIO(double new_ratio)
+{
+  ratio = new_ratio;
+}
+
+void Resampler::SET_MODE(ResamplerMode new_mode)
+{
+  mode = new_mode;
+}
+
+void Resampler::RESET()
+{
+  //pad with silence so the first output sample has a full filter history
+  for(auto &channel : history)
+    channel.assign(taps + RESAMPLER_BLOCK, 0.0f);
+  filled = taps / 2 - 1;
+  position = taps / 2 - 1;
+}
+
+int Resampler::TAPS()
+{
+  return taps;
+}
+
+size_t Resampler::MAX_OUTPUT(size_t frames_in)
+{
+  return (size_t) ((frames_in + taps) * ratio / step) + 2;
+}
+
+size_t Resampler::PROCESS(const float *in, size_t frames_in, float *out)
+{
+  size_t written = 0;
+  while(frames_in)
+  {
+    size_t block = min<size_t>(frames_in, RESAMPLER_BLOCK);
+    for(int c = 0; c < RESAMPLER_CHANNELS; c++)
+    {
+      float *channel = &history[c][filled];
+      for(size_t i = 0; i < block; i++)
+        channel[i] = in[i * RESAMPLER_CHANNELS + c];
+    }
+    filled += block;
+    in += block * RESAMPLER_CHANNELS;
+    frames_in -= block;
+
+    written += DRAIN(out + written * RESAMPLER_CHANNELS);
+
+    //only the tail a future output sample can still reach moves back to the front, under taps frames
+    size_t consumed = min((size_t) position - (taps / 2 - 1), filled);
+    for(auto &channel : history)
+      copy(channel.begin() + consumed, channel.begin() + filled, channel.begin());
+    filled -= consumed;
+    position -= consumed;
+  }
+  return written;
+}
+
+//every output sample the history has enough input for
+size_t Resampler::DRAIN(float *out)
+{
+  //in locals, the stores to out would otherwise make the compiler reload them every sample
+  const float *channels[RESAMPLER_CHANNELS];
+  for(int c = 0; c < RESAMPLER_CHANNELS; c++)
+    channels[c] = history[c].data();
+  double at = position;
+  double increment = step / ratio;
+  size_t written = 0;
+
+  while((size_t) at + taps / 2 < filled)
+  {
+    size_t n = (size_t) at;
+    double frac = at - n;
+
+    if(mode == RESAMPLE_LINEAR)
+    {
+      for(int c = 0; c < RESAMPLER_CHANNELS; c++)
+      {
+        const float *s = &channels[c][n];
+        out[written * RESAMPLER_CHANNELS + c] = s[0] + (float) frac * (s[1] - s[0]);
+      }
+    }
+    else
+    {
+      double scaled = frac * RESAMPLER_PHASES;
+      int phase = (int) scaled;
+      float blend = (float) (scaled - phase);
+      const float *row0 = &table[(size_t) phase * taps];
+      const float *row1 = row0 + taps;
+
+      for(int c = 0; c < RESAMPLER_CHANNELS; c++)
+      {
+        const float *s = &channels[c][n - (taps / 2 - 1)];
+        float a = dot(s, row0, taps);
+        float b = dot(s, row1, taps);
+        out[written * RESAMPLER_CHANNELS + c] = a + blend * (b - a);
+      }
+    }
+
+    written++;
+    at += increment;
+  }
+
+  position = at;
+  return written;
+}
@@ -0,0 +1,59 @@
+#ifndef _RESAMPLER_H_
+#define _RESAMPLER_H_
+
+#include "cpu.h"
+
+#include <cstddef>
+#include <vector>
+
+#define APU_FREQ (CPU_FREQ / 4) //1048576Hz, rate the APU produces samples at
+#define OUTPUT_FREQ 48000
+
+#define RESAMPLER_PHASES 256 //filter phases between two input samples, interpolated in between
+#define RESAMPLER_ZERO_CROSSINGS 8 //sinc lobes kept either side of the centre
+#define RESAMPLER_CHANNELS 2
+#define RESAMPLER_BLOCK 0x8000 //input frames taken per pass, more than an emulated frame's worth
+
+enum ResamplerMode {
+    RESAMPLE_SINC, //polyphase windowed sinc, use for normal speed
+    RESAMPLE_LINEAR //cheap, aliases badly, for fast forward
+};
+
+//Converts interleaved stereo from the APU rate down to the output rate.
+//The ratio from Pacer::UPDATE_AUDIO can be changed between calls.
+class Resampler {
+ private:
+  double step; //input samples per output sample at ratio 1.0
+  double position = 0; //fractional read position into history
+  double ratio = 1.0;
+  int taps;
+  ResamplerMode mode = RESAMPLE_SINC;
+
+  vector<float> table; //(RESAMPLER_PHASES + 1) rows of taps coefficients
+  vector<float> history[RESAMPLER_CHANNELS]; //taps + RESAMPLER_BLOCK frames, allocated once
+  size_t filled; //frames of history in use
+
+  float (*dot)(const float *, const float *, int);
+
+  void BUILD_TABLE();
+  size_t DRAIN(float *out);
+
+ public:
+  Resampler(double input_rate = APU_FREQ, double output_rate = OUTPUT_FREQ);
+
+  void SET_RATIO(double new_ratio);
+  void SET_MODE(ResamplerMode new_mode);
+  void RESET();
+
+  int TAPS();
+
+  //consumes all input frames, returns the number of output frames written
+  //out must have room for MAX_OUTPUT(frames_in) frames
+  size_t PROCESS(const float *in, size_t frames_in, float *out);
+  size_t MAX_OUTPUT(size_t frames_in);
+};
+
+//the filter the table is sampled from, exposed for the double precision reference in the benchmark
+double RESAMPLER_KERNEL(double distance, double cutoff, double half_width);
+
+#endif //_RESAMPLER_H_
@@ -0,0 +1,128 @@
+#include "shmexport.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SHARED_ALIGN 64 //every block starts on its own cache line
+
+static uint32_t ALIGN(uint32_t offset)
+{
+  return (offset + SHARED_ALIGN - 1) & ~(SHARED_ALIGN - 1);
+}
+
+SharedExport::~SharedExport()
+{
+  STOP();
+}
+
+SharedHeader *SharedExport::HEADER()
+{
+  return reinterpret_cast<SharedHeader *>(region);
+}
+
+//fills in the block offsets and sizes, returns the size of the whole region
+static uint32_t LAYOUT(SharedHeader &header)
+{
+  header.header_size = sizeof(SharedHeader);
+  header.width = LCD_WIDTH;
+  header.height = LCD_HEIGHT;
+
+  uint32_t offset = ALIGN(sizeof(SharedHeader));
+  auto BLOCK = [&offset](uint32_t &block_offset, uint32_t &block_size, uint32_t length) {
+    block_offset = offset;
+    block_size = length;
+    offset = ALIGN(offset + length);
+  };
+  BLOCK(header.framebuffer_offset, header.framebuffer_size, LCD_WIDTH * LCD_HEIGHT);
+  BLOCK(header.colour_offset, header.colour_size, LCD_WIDTH * LCD_HEIGHT * sizeof(WORD));
+  BLOCK(header.wram_offset, header.wram_size, 0x2000);
+  BLOCK(header.io_offset, header.io_size, 0x80);
+  BLOCK(header.hram_offset, header.hram_size, 0x7F);
+  BLOCK(header.registers_offset, header.registers_size, sizeof(SharedRegisters));
+
+  header.total_size = offset;
+  return offset;
+}
+
+bool SharedExport::START(const string &object_name)
+{
+  if(region)
+    return false;
+
+  name = object_name[0] == '/' ? object_name : "/" + object_name;
+  SharedHeader layout = {};
+  size = LAYOUT(layout);
+
+  fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+  if(fd < 0)
+    return false;
+  if(ftruncate(fd, size) != 0)
+  {
+    STOP();
+    return false;
+  }
+
+  void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(mapped == MAP_FAILED)
+  {
+    STOP();
+    return false;
+  }
+  region = static_cast<BYTE *>(mapped);
+
+  //nothing in the header changes after this but the sequence, the magic goes in last so a
+  //reader that finds it also finds the offsets
+  memset(region, 0, size);
+  SharedHeader *header = HEADER();
+  LAYOUT(*header);
+  header->version = SHARED_VERSION;
+  atomic_thread_fence(memory_order_release);
+  header->magic = SHARED_MAGIC;
+  return true;
+}
+
+void SharedExport::STOP()
+{
+  if(region)
+    munmap(region, size);
+  if(fd >= 0)
+  {
+    close(fd);
+    shm_unlink(name.c_str());
+  }
+  region = nullptr;
+  fd = -1;
+  size = 0;
+}
+
+void SharedExport::PUBLISH(CPU_ &machine)
+{
+  if(!region)
+    return;
+
+  SharedHeader *header = HEADER();
+  uint64_t sequence = header->sequence.load(memory_order_relaxed);
+
+  //odd until the copy is done, the fence keeps the copy from starting before readers can see that
+  header->sequence.store(sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  header->frame = machine.FRAME_COUNT();
+  header->cycles = machine.CYCLE_COUNT();
+  memcpy(region + header->framebuffer_offset, machine.FRAMEBUFFER(), header->framebuffer_size);
+  const WORD *colour = machine.COLOUR_FRAMEBUFFER();
+  if(colour)
+    memcpy(region + header->colour_offset, colour, header->colour_size);
+  machine.PEEK_BLOCK(0xC000, region + header->wram_offset, header->wram_size);
+  machine.PEEK_BLOCK(0xFF00, region + header->io_offset, header->io_size);
+  machine.PEEK_BLOCK(0xFF80, region + header->hram_offset, header->hram_size);
+
+  Registers registers = machine.GET_REGISTERS();
+  SharedRegisters shared = {registers.AF, registers.BC, registers.DE, registers.HL, registers.SP, registers.PC,
+                            machine.PEEK(0xFFFF), (uint8_t) machine.GET_MODEL(), {0, 0}};
+  memcpy(region + header->registers_offset, &shared, sizeof(shared));
+
+  header->sequence.store(sequence + 2, memory_order_release);
+}
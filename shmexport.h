@@ -0,0 +1,76 @@
+#ifndef _SHMEXPORT_H_
+#define _SHMEXPORT_H_
+
+#include "cpu.h"
+
+#include <atomic>
+#include <string>
+
+#define SHARED_MAGIC 0x4D534247 //"GBSM"
+#define SHARED_VERSION 1
+
+/*
+ * Once a frame the machine is copied into a POSIX shared memory object (/dev/shm/NAME on Linux)
+ * that any process can map read only. The region starts with SharedHeader, every block after it
+ * is found through its offset and size so readers in other languages don't need this file.
+ *
+ * The header's sequence is a seqlock: odd while a frame is being written. A reader loads it,
+ * retries while it is odd, copies what it needs, then loads it again and keeps the copy only if
+ * nothing moved. The emulator never waits for readers, a slow reader just retries or skips frames.
+ */
+
+struct SharedRegisters {
+    uint16_t AF;
+    uint16_t BC;
+    uint16_t DE;
+    uint16_t HL;
+    uint16_t SP;
+    uint16_t PC;
+    uint8_t IE;
+    uint8_t model; //Model
+    uint8_t padding[2];
+};
+
+struct SharedHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t total_size;
+    atomic<uint64_t> sequence;
+    uint64_t frame;
+    uint64_t cycles;
+    uint32_t width;
+    uint32_t height;
+    uint32_t framebuffer_offset; //width * height shades 0 (white) - 3 (black)
+    uint32_t framebuffer_size;
+    uint32_t colour_offset; //width * height RGB555, all zero unless the machine is a CGB
+    uint32_t colour_size;
+    uint32_t wram_offset; //0xC000 - 0xDFFF as currently mapped
+    uint32_t wram_size;
+    uint32_t io_offset; //0xFF00 - 0xFF7F as the CPU would read them
+    uint32_t io_size;
+    uint32_t hram_offset; //0xFF80 - 0xFFFE
+    uint32_t hram_size;
+    uint32_t registers_offset; //SharedRegisters
+    uint32_t registers_size;
+};
+
+class SharedExport {
+ private:
+  string name;
+  int fd = -1;
+  BYTE *region = nullptr;
+  size_t size = 0;
+
+  SharedHeader *HEADER();
+
+ public:
+  ~SharedExport();
+
+  bool START(const string &object_name); //"gbpp" or "/gbpp"
+  void STOP(); //unmaps and unlinks, readers that still have it mapped keep the last frame
+
+  void PUBLISH(CPU_ &machine);
+};
+
+#endif //_SHMEXPORT_H_
@@ -0,0 +1,292 @@
+#include "cpu.h"
+#include "hash.h"
+
+#include <cstring>
+
+//save states are the machine's own fields written one after another. Pointers (bus pages, IO
+//handlers) are never saved, LOAD_STATE rebuilds them for this instance
+
+#define STATE_MAGIC 0x53504247 //"GBPS"
+#define STATE_VERSION 3
+
+template<typename T>
+static void PUT(vector<BYTE> &state, const T &value)
+{
+  const BYTE *bytes = reinterpret_cast<const BYTE *>(&value);
+  state.insert(state.end(), bytes, bytes + sizeof(T));
+}
+
+struct StateReader {
+    const vector<BYTE> &state;
+    size_t offset = 0;
+    bool ok = true;
+
+    template<typename T>
+    void GET(T &value)
+    {
+      if(offset + sizeof(T) > state.size())
+      {
+        ok = false;
+        return;
+      }
+      memcpy(&value, &state[offset], sizeof(T));
+      offset += sizeof(T);
+    }
+};
+
+//same order for both directions
+#define STATE_FIELDS(F) \
+  F(cycles) F(instructions) F(AF.reg) F(BC.reg) F(DE.reg) F(HL.reg) F(SP) F(PC) F(IME) \
+  F(buttons) F(frame_cycles) F(event_at) F(div_base) F(tima_sync) \
+  F(lcd_sync) F(lcd_cycles) F(lcd_enabled) F(window_line) F(frame_count) F(framebuffer) \
+  F(vram) F(high)
+
+void CPU_::SAVE_STATE(vector<BYTE> &state)
+{
+  state.clear();
+  PUT(state, (uint32_t) STATE_MAGIC);
+  PUT(state, (uint32_t) STATE_VERSION);
+  PUT(state, model);
+
+#define SAVE_FIELD(field) PUT(state, field);
+  STATE_FIELDS(SAVE_FIELD)
+#undef SAVE_FIELD
+
+  for(int page = 0; page < PAGE_COUNT; page++)
+  {
+    if(PAGED(page))
+      PUT(state, memory[page]->data);
+  }
+
+  if(cgb)
+    PUT(state, *cgb);
+}
+
+bool CPU_::LOAD_STATE(const vector<BYTE> &state)
+{
+  StateReader reader{state};
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  Model saved_model = MODEL_DMG;
+  reader.GET(magic);
+  reader.GET(version);
+  reader.GET(saved_model);
+  if(!reader.ok || magic != STATE_MAGIC || version != STATE_VERSION)
+    return false;
+
+  //check the size before touching anything so a bad state leaves the machine alone
+  size_t expected = reader.offset;
+#define SIZE_FIELD(field) expected += sizeof(field);
+  STATE_FIELDS(SIZE_FIELD)
+#undef SIZE_FIELD
+  for(int page = 0; page < PAGE_COUNT; page++)
+  {
+    if(PAGED(page))
+      expected += sizeof(MemoryPage::data);
+  }
+  if(saved_model == MODEL_CGB)
+    expected += sizeof(CgbState);
+  if(state.size() != expected)
+    return false;
+
+#define LOAD_FIELD(field) reader.GET(field);
+  STATE_FIELDS(LOAD_FIELD)
+#undef LOAD_FIELD
+
+  //pages that already hold the saved bytes stay shared, ROM is never copied this way
+  bool rom_changed = false;
+  for(int page = 0; page < PAGE_COUNT; page++)
+  {
+    if(!PAGED(page))
+      continue;
+    const BYTE *saved = &state[reader.offset];
+    if(memcmp(memory[page]->data, saved, sizeof(MemoryPage::data)))
+    {
+      memcpy(OWN_PAGE(page), saved, sizeof(MemoryPage::data));
+      rom_changed |= page < 0x80;
+    }
+    reader.offset += sizeof(MemoryPage::data);
+  }
+
+  model = saved_model;
+  if(model == MODEL_CGB)
+  {
+    if(!cgb)
+      cgb = make_unique<CgbState>();
+    reader.GET(*cgb);
+  }
+
+  REBUILD_BUS();
+  if(rom_changed)
+  {
+    FIND_AOT();
+    if(coverage)
+      coverage = make_unique<CoverageState>();
+  }
+  return true;
+}
+
+//everything derived from the fields, for a machine that just had them replaced
+void CPU_::REBUILD_BUS()
+{
+  MAP_IO();
+  MAP_PAGES();
+
+  if(model == MODEL_CGB)
+    ENABLE_CGB();
+  else
+    cgb.reset();
+
+  bool dma = event_at[EVENT_DMA] != NEVER;
+  for(int page = 0; page < 0xFF; page++)
+    SET_PAGE_TRAP(page, TRAP_DMA, dma);
+
+  SCHEDULE(EVENT_TIMER, event_at[EVENT_TIMER]); //recomputes next_event
+
+  if(hashing)
+  {
+    for(int slot = 0; slot < HASH_SLOTS; slot++)
+      DIRTY_SLOT(slot);
+    ARM_HASH_TRAPS();
+  }
+}
+
+//a save state straight into another machine, except memory pages are shared rather than copied
+unique_ptr<CPU_> CPU_::FORK()
+{
+  auto child = make_unique<CPU_>();
+
+#define COPY_FIELD(field) memcpy(&child->field, &field, sizeof(field));
+  STATE_FIELDS(COPY_FIELD)
+#undef COPY_FIELD
+
+  SHARE_PAGES(*child);
+
+  child->requested_model = requested_model;
+  child->aot = aot;
+  child->model = model;
+  if(cgb)
+    child->cgb = make_unique<CgbState>(*cgb);
+
+  child->REBUILD_BUS();
+
+  //same memory, so the page hashes carry over and the child's first hash is as cheap as ours
+  if(hashing)
+  {
+    child->hashing = make_unique<HashState>(*hashing);
+    child->ARM_HASH_TRAPS();
+  }
+  return child;
+}
+
+//the slot a bus page from 0x80 up is writing to, echo pages write to the WRAM they mirror
+int CPU_::HASH_SLOT(int page)
+{
+  if(page >= 0xE0)
+    page -= 0x20;
+
+  if(cgb && page < 0xA0 && (IO(VBK) & 0x01))
+    return 0x100 + (page - 0x80);
+  if(cgb && page >= 0xD0 && (IO(SVBK) & 0x07) >= 2)
+    return 0x120 + ((IO(SVBK) & 0x07) - 2) * 0x10 + (page - 0xD0);
+  return page;
+}
+
+//null for slots this machine doesn't have
+const BYTE *CPU_::SLOT_DATA(int slot)
+{
+  if(slot < 0x80 || (slot >= 0xE0 && slot < 0x100))
+    return nullptr;
+  if(slot < 0x100)
+    return PAGED(slot) ? memory[slot]->data : UNPAGED(slot);
+  if(!cgb)
+    return nullptr;
+  if(slot < 0x120)
+    return &cgb->vram_bank1[(slot - 0x100) << 8];
+  return &cgb->wram_banks[(slot - 0x120) >> 4][((slot - 0x120) & 0x0F) << 8];
+}
+
+void CPU_::DIRTY_SLOT(int slot)
+{
+  if(hashing->dirty[slot])
+    return;
+  hashing->dirty[slot] = true;
+  hashing->dirty_slots[hashing->dirty_count++] = slot;
+}
+
+//the write trap on a clean page, it stays untrapped until the next STATE_HASH
+void CPU_::DIRTY_PAGE(int page)
+{
+  DIRTY_SLOT(HASH_SLOT(page));
+
+  SET_PAGE_TRAP(page, TRAP_HASH, false);
+  if(page >= 0xC0 && page < 0xDE)
+    SET_PAGE_TRAP(page + 0x20, TRAP_HASH, false);
+  else if(page >= 0xE0 && page < 0xFE)
+    SET_PAGE_TRAP(page - 0x20, TRAP_HASH, false);
+}
+
+void CPU_::ARM_HASH_TRAPS()
+{
+  for(int page = 0x80; page < 0xFE; page++)
+    SET_PAGE_TRAP(page, TRAP_HASH, !hashing->dirty[HASH_SLOT(page)]);
+}
+
+//per page hashes are seeded with the slot so XORing them together still depends on where
+//everything is. OAM, IO and HRAM change all the time and are hashed on every call
+uint64_t CPU_::STATE_HASH()
+{
+  if(!hashing)
+  {
+    hashing = make_unique<HashState>();
+    for(int slot = 0; slot < HASH_SLOTS; slot++)
+      DIRTY_SLOT(slot);
+  }
+  SYNC_TIMER();
+
+  if(hashing->dirty_count)
+  {
+    for(int i = 0; i < hashing->dirty_count; i++)
+    {
+      int slot = hashing->dirty_slots[i];
+      hashing->dirty[slot] = false;
+
+      const BYTE *data = SLOT_DATA(slot);
+      uint64_t hash = data ? HASH64(data, 0x100, slot) : 0;
+      hashing->combined ^= hashing->pages[slot] ^ hash;
+      hashing->pages[slot] = hash;
+
+      //the bus pages that reach the slot right now, a bank that isn't mapped has none
+      int page = slot < 0x100 ? slot : slot < 0x120 ? 0x80 + (slot - 0x100) : 0xD0 + ((slot - 0x120) & 0x0F);
+      for(int bus : {page, page + 0x20})
+      {
+        if(bus < 0xFE && (bus == page || page >= 0xC0) && HASH_SLOT(bus) == slot)
+          SET_PAGE_TRAP(bus, TRAP_HASH, true);
+      }
+    }
+    hashing->dirty_count = 0;
+  }
+
+  //scheduled events count from now, the DIV counter only matters up to the bits TIMA watches
+  uint64_t fields[] = {
+      AF.reg, BC.reg, DE.reg, HL.reg, SP, PC, IME, buttons, (uint64_t) model,
+      (uint64_t) frame_cycles, (uint64_t) lcd_cycles, lcd_enabled, (uint64_t) window_line,
+      cycles - lcd_sync, (cycles - div_base) & 0xFFFF,
+      event_at[EVENT_TIMER] == NEVER ? NEVER : event_at[EVENT_TIMER] - cycles,
+      event_at[EVENT_DMA] == NEVER ? NEVER : event_at[EVENT_DMA] - cycles
+  };
+
+  uint64_t hash = HASH64(high, sizeof(high), hashing->combined);
+  hash = HASH64(fields, sizeof(fields), hash);
+  if(cgb)
+  {
+    uint64_t colour[] = {
+        (uint64_t) cgb->speed_shift, cgb->hdma_source, cgb->hdma_destination, (uint64_t) cgb->hdma_blocks,
+        cgb->hdma_status
+    };
+    hash = HASH64(colour, sizeof(colour), hash);
+    hash = HASH64(cgb->bg_palettes, sizeof(cgb->bg_palettes), hash);
+    hash = HASH64(cgb->obj_palettes, sizeof(cgb->obj_palettes), hash);
+  }
+  return hash;
+}
@@ -0,0 +1,102 @@
+#include "cpu.h"
+
+//DIV and TIMA without any per instruction work. DIV is the top byte of a 16 bit system counter
+//that is just cycles - div_base. TIMA ticks on the falling edge of the counter bit TAC selects,
+//so the ticks between two points are a difference of shifted counter values. Accesses catch
+//TIMA up and the overflow is a scheduled event so the interrupt still lands on time
+
+//counter bit TIMA watches for TAC 0 - 3 (4096, 262144, 65536, 16384 Hz)
+static const int TIMER_BIT[4] = {9, 3, 5, 7};
+
+void CPU_::SYNC_TIMER()
+{
+  if(IO(TIMER_CONTROL) & 0x04)
+  {
+    int shift = TIMER_BIT[IO(TIMER_CONTROL) & 0x03] + 1;
+    TICK_TIMA(((cycles - div_base) >> shift) - ((tima_sync - div_base) >> shift));
+  }
+  tima_sync = cycles;
+}
+
+void CPU_::TICK_TIMA(uint64_t ticks)
+{
+  uint64_t value = IO(TIMER_COUNTER) + ticks;
+
+  if(value > 0xFF)
+  {
+    //reload from TMA, a late catch up can have wrapped more than once
+    value = IO(TIMER_MODULO) + (value - 0x100) % (0x100 - IO(TIMER_MODULO));
+    IO(IF) |= (1 << TIMER_INTERRUPT);
+  }
+  IO(TIMER_COUNTER) = value;
+}
+
+void CPU_::SCHEDULE_TIMER()
+{
+  if(!(IO(TIMER_CONTROL) & 0x04))
+  {
+    SCHEDULE(EVENT_TIMER, NEVER);
+    return;
+  }
+
+  int shift = TIMER_BIT[IO(TIMER_CONTROL) & 0x03] + 1;
+  uint64_t counter = cycles - div_base;
+  uint64_t overflow = ((counter >> shift) + (0x100 - IO(TIMER_COUNTER))) << shift;
+  SCHEDULE(EVENT_TIMER, div_base + overflow);
+}
+
+BYTE CPU_::READ_DIV(WORD)
+{
+  return (cycles - div_base) >> 8;
+}
+
+//any write resets the counter, which is a falling edge for TIMA if its bit was set
+void CPU_::WRITE_DIV(WORD, BYTE)
+{
+  SYNC_TIMER();
+  if((IO(TIMER_CONTROL) & 0x04) && (((cycles - div_base) >> TIMER_BIT[IO(TIMER_CONTROL) & 0x03]) & 1))
+    TICK_TIMA(1);
+
+  div_base = tima_sync = cycles;
+  SCHEDULE_TIMER();
+}
+
+BYTE CPU_::READ_TIMA(WORD)
+{
+  SYNC_TIMER();
+  return IO(TIMER_COUNTER);
+}
+
+void CPU_::WRITE_TIMA(WORD, BYTE value)
+{
+  SYNC_TIMER();
+  IO(TIMER_COUNTER) = value;
+  SCHEDULE_TIMER();
+}
+
+void CPU_::WRITE_TMA(WORD, BYTE value)
+{
+  SYNC_TIMER();
+  IO(TIMER_MODULO) = value;
+}
+
+BYTE CPU_::READ_TAC(WORD)
+{
+  return 0xF8 | IO(TIMER_CONTROL);
+}
+
+//TIMA sees the enable bit and the selected counter bit through an AND, so switching either
+//from a set bit to a clear one is a falling edge too (the DMG glitch)
+void CPU_::WRITE_TAC(WORD, BYTE value)
+{
+  SYNC_TIMER();
+
+  uint64_t counter = cycles - div_base;
+  bool before = (IO(TIMER_CONTROL) & 0x04) && ((counter >> TIMER_BIT[IO(TIMER_CONTROL) & 0x03]) & 1);
+  bool after = (value & 0x04) && ((counter >> TIMER_BIT[value & 0x03]) & 1);
+
+  IO(TIMER_CONTROL) = value & 0x07;
+  if(before && !after)
+    TICK_TIMA(1);
+  SCHEDULE_TIMER();
+}
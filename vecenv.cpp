@@ -0,0 +1,320 @@
+#include "vecenv.h"
+
+#include "condition.h"
+#include "cpu.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Every machine is its own CPU_, nothing is shared between them but the read only reset state
+//and settings, so the pool just splits the machines into one contiguous slice per thread. The
+//caller's thread takes slice 0 and the workers sleep on a generation counter between batches
+
+struct gb_vec_env {
+    vector<unique_ptr<CPU_>> machines;
+    vector<uint64_t> episode_frames;
+    vector<BYTE> reset_state;
+
+    int scale = 1;
+    vector<WORD> ram_addresses;
+    int frame_skip = 1;
+    BreakCondition done;
+    bool has_done = false;
+    uint64_t max_frames = 0;
+
+    //the batch being run
+    const uint8_t *actions = nullptr;
+    uint8_t *obs_out = nullptr;
+    uint8_t *ram_out = nullptr;
+    uint8_t *done_out = nullptr;
+    bool resetting = false;
+
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake;
+    condition_variable finished;
+    uint64_t generation = 0;
+    int pending = 0;
+    bool stopping = false;
+
+    size_t OBSERVATION_SIZE() const;
+    void OBSERVE(int index);
+    void RESET_MACHINE(int index);
+    void STEP_MACHINE(int index);
+    void RUN_SLICE(int slice);
+    void WORKER_LOOP(int slice);
+    void RUN_BATCH();
+};
+
+size_t gb_vec_env::OBSERVATION_SIZE() const
+{
+  return (LCD_WIDTH / scale) * (LCD_HEIGHT / scale);
+}
+
+//box filter down to the observation size, CGB colours go through Rec.601 luma
+void gb_vec_env::OBSERVE(int index)
+{
+  CPU_ &machine = *machines[index];
+
+  if(obs_out)
+  {
+    const BYTE *shades = machine.FRAMEBUFFER();
+    const WORD *colours = machine.COLOUR_FRAMEBUFFER();
+    int width = LCD_WIDTH / scale;
+    int height = LCD_HEIGHT / scale;
+    BYTE *out = obs_out + index * OBSERVATION_SIZE();
+
+    for(int y = 0; y < height; y++)
+    {
+      for(int x = 0; x < width; x++)
+      {
+        int sum = 0;
+        for(int dy = 0; dy < scale; dy++)
+        {
+          int pixel = (y * scale + dy) * LCD_WIDTH + x * scale;
+          for(int dx = 0; dx < scale; dx++)
+          {
+            if(colours)
+            {
+              WORD colour = colours[pixel + dx];
+              int r = colour & 0x1F;
+              int g = (colour >> 5) & 0x1F;
+              int b = (colour >> 10) & 0x1F;
+              sum += (r * 77 + g * 150 + b * 29) * 255 / (31 * 256);
+            }
+            else
+              sum += 255 - shades[pixel + dx] * 85;
+          }
+        }
+        out[y * width + x] = sum / (scale * scale);
+      }
+    }
+  }
+
+  if(ram_out)
+  {
+    BYTE *out = ram_out + index * ram_addresses.size();
+    for(size_t i = 0; i < ram_addresses.size(); i++)
+      out[i] = machine.PEEK(ram_addresses[i]);
+  }
+}
+
+void gb_vec_env::RESET_MACHINE(int index)
+{
+  machines[index]->LOAD_STATE(reset_state);
+  episode_frames[index] = 0;
+}
+
+void gb_vec_env::STEP_MACHINE(int index)
+{
+  CPU_ &machine = *machines[index];
+
+  if(resetting)
+  {
+    RESET_MACHINE(index);
+    OBSERVE(index);
+    return;
+  }
+
+  machine.SET_BUTTONS(actions ? actions[index] : 0);
+  for(int i = 0; i < frame_skip; i++)
+  {
+    machine.RUN_WHOLE_FRAME();
+  }
+  episode_frames[index] += frame_skip;
+
+  bool ended = (has_done && done.EVALUATE(machine)) || (max_frames && episode_frames[index] >= max_frames);
+  if(ended)
+    RESET_MACHINE(index);
+  if(done_out)
+    done_out[index] = ended;
+
+  OBSERVE(index);
+}
+
+void gb_vec_env::RUN_SLICE(int slice)
+{
+  int n = machines.size();
+  int slices = workers.size() + 1;
+
+  for(int i = n * slice / slices; i < n * (slice + 1) / slices; i++)
+    STEP_MACHINE(i);
+}
+
+void gb_vec_env::WORKER_LOOP(int slice)
+{
+  uint64_t seen = 0;
+
+  while(true)
+  {
+    {
+      unique_lock<mutex> hold(lock);
+      wake.wait(hold, [&]() { return stopping || generation != seen; });
+      if(stopping)
+        return;
+      seen = generation;
+    }
+
+    RUN_SLICE(slice);
+
+    lock_guard<mutex> hold(lock);
+    if(--pending == 0)
+      finished.notify_one();
+  }
+}
+
+void gb_vec_env::RUN_BATCH()
+{
+  {
+    lock_guard<mutex> hold(lock);
+    pending = workers.size();
+    generation++;
+  }
+  wake.notify_all();
+
+  RUN_SLICE(0);
+
+  unique_lock<mutex> hold(lock);
+  finished.wait(hold, [&]() { return pending == 0; });
+}
+
+gb_vec_env *gb_vec_env_create(int n, const uint8_t *rom, size_t rom_size, int threads)
+{
+  if(n < 1 || !rom || !rom_size)
+    return nullptr;
+
+  gb_vec_env *env = new gb_vec_env;
+  env->episode_frames.resize(n, 0);
+  env->machines.push_back(make_unique<CPU_>());
+  env->machines[0]->LOAD_ROM(rom, rom_size);
+  env->machines[0]->INIT_POST_BOOT();
+  env->machines[0]->SAVE_STATE(env->reset_state);
+
+  //forks, so every machine reads the one copy of the ROM
+  for(int i = 1; i < n; i++)
+    env->machines.push_back(env->machines[0]->FORK());
+
+  if(threads <= 0)
+    threads = max(1u, thread::hardware_concurrency());
+  threads = min(threads, n);
+  for(int slice = 1; slice < threads; slice++)
+    env->workers.emplace_back(&gb_vec_env::WORKER_LOOP, env, slice);
+
+  return env;
+}
+
+void gb_vec_env_destroy(gb_vec_env *env)
+{
+  if(!env)
+    return;
+
+  {
+    lock_guard<mutex> hold(env->lock);
+    env->stopping = true;
+  }
+  env->wake.notify_all();
+  for(thread &worker : env->workers)
+    worker.join();
+
+  delete env;
+}
+
+int gb_vec_env_count(const gb_vec_env *env)
+{
+  return env->machines.size();
+}
+
+int gb_vec_env_set_observation(gb_vec_env *env, int scale)
+{
+  if(scale != 1 && scale != 2 && scale != 4)
+    return -1;
+
+  env->scale = scale;
+  return env->OBSERVATION_SIZE();
+}
+
+size_t gb_vec_env_observation_size(const gb_vec_env *env)
+{
+  return env->OBSERVATION_SIZE();
+}
+
+int gb_vec_env_set_ram(gb_vec_env *env, const uint16_t *addresses, int count)
+{
+  if(count < 0 || (count && !addresses))
+    return -1;
+
+  env->ram_addresses.assign(addresses, addresses + count);
+  return 0;
+}
+
+int gb_vec_env_set_frame_skip(gb_vec_env *env, int frames)
+{
+  if(frames < 1)
+    return -1;
+
+  env->frame_skip = frames;
+  return 0;
+}
+
+int gb_vec_env_set_done(gb_vec_env *env, const char *condition, char *error, size_t error_size)
+{
+  if(!condition || !*condition)
+  {
+    env->has_done = false;
+    return 0;
+  }
+
+  string message;
+  BreakCondition compiled;
+  if(!compiled.COMPILE(condition, message))
+  {
+    if(error && error_size)
+      snprintf(error, error_size, "%s", message.c_str());
+    return -1;
+  }
+
+  env->done = move(compiled);
+  env->has_done = true;
+  return 0;
+}
+
+int gb_vec_env_set_max_frames(gb_vec_env *env, uint64_t max_frames)
+{
+  env->max_frames = max_frames;
+  return 0;
+}
+
+int gb_vec_env_set_reset_state(gb_vec_env *env, int index)
+{
+  if(index < 0 || index >= (int) env->machines.size())
+    return -1;
+
+  env->machines[index]->SAVE_STATE(env->reset_state);
+  return 0;
+}
+
+void gb_vec_env_reset(gb_vec_env *env, uint8_t *obs_out, uint8_t *ram_out)
+{
+  env->actions = nullptr;
+  env->obs_out = obs_out;
+  env->ram_out = ram_out;
+  env->done_out = nullptr;
+  env->resetting = true;
+  env->RUN_BATCH();
+}
+
+void gb_vec_env_step(gb_vec_env *env, const uint8_t *actions, uint8_t *obs_out, uint8_t *ram_out,
+                     uint8_t *done_out)
+{
+  env->actions = actions;
+  env->obs_out = obs_out;
+  env->ram_out = ram_out;
+  env->done_out = done_out;
+  env->resetting = false;
+  env->RUN_BATCH();
+}
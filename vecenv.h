@@ -0,0 +1,63 @@
+#ifndef _VECENV_H_
+#define _VECENV_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * N independent machines on one ROM, stepped one frame each per call across a thread pool.
+ * Meant for reinforcement learning: the caller owns every output array, sized once up front,
+ * and a step never allocates.
+ *
+ * Per step and per machine:
+ *   actions[i]                 SET_BUTTONS mask held for the whole step (BUTTON_ bits in cpu.h)
+ *   obs_out[i * OBS_SIZE]      grayscale frame, 0 black - 255 white, downsampled by the scale
+ *   ram_out[i * RAM_COUNT]     the bytes at the addresses given to gb_vec_env_set_ram
+ *   done_out[i]                1 if the episode ended on this step
+ *
+ * When an episode ends the machine is put back to the reset state straight away, so obs_out
+ * and ram_out for that machine already describe the first frame of the next episode. Any of
+ * the output pointers may be NULL. The set_ functions must not run while a step is running.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gb_vec_env gb_vec_env;
+
+//threads 0 means one per core. NULL if the ROM is empty or n < 1
+gb_vec_env *gb_vec_env_create(int n, const uint8_t *rom, size_t rom_size, int threads);
+void gb_vec_env_destroy(gb_vec_env *env);
+
+int gb_vec_env_count(const gb_vec_env *env);
+
+//scale 1, 2 or 4 (160x144, 80x72 or 40x36), returns the bytes per machine or -1
+int gb_vec_env_set_observation(gb_vec_env *env, int scale);
+size_t gb_vec_env_observation_size(const gb_vec_env *env);
+
+//copies the address list, returns 0 or -1
+int gb_vec_env_set_ram(gb_vec_env *env, const uint16_t *addresses, int count);
+
+//frames each action is held for, 1 by default
+int gb_vec_env_set_frame_skip(gb_vec_env *env, int frames);
+
+//an episode ends when the condition (debugger syntax, e.g. "[0xC0A0]==0") holds after a step,
+//or after max_frames frames if that isn't 0. NULL or "" clears the condition. Returns 0, or -1
+//with the reason in error
+int gb_vec_env_set_done(gb_vec_env *env, const char *condition, char *error, size_t error_size);
+int gb_vec_env_set_max_frames(gb_vec_env *env, uint64_t max_frames);
+
+//machine index's current state becomes what every machine resets to (the post boot state at first)
+int gb_vec_env_set_reset_state(gb_vec_env *env, int index);
+//puts every machine back to the reset state and fills the outputs like a step would
+void gb_vec_env_reset(gb_vec_env *env, uint8_t *obs_out, uint8_t *ram_out);
+
+void gb_vec_env_step(gb_vec_env *env, const uint8_t *actions, uint8_t *obs_out, uint8_t *ram_out,
+                     uint8_t *done_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_VECENV_H_